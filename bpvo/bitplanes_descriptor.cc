@@ -35,7 +35,7 @@ BitPlanesDescriptor::BitPlanesDescriptor(float s0, float s1)
 BitPlanesDescriptor::~BitPlanesDescriptor() {}
 
 template <typename TDst> static inline
-void ExtractChannel(const cv::Mat& src, cv::Mat& dst, int bit, float sigma)
+void ExtractChannel(const cv::Mat& src, cv::Mat& dst, int bit)
 {
   dst.create(src.size(),  cv::DataType<TDst>::type);
 
@@ -51,43 +51,184 @@ void ExtractChannel(const cv::Mat& src, cv::Mat& dst, int bit, float sigma)
 #endif
   for(int i = 0; i < n; ++i)
     dst_ptr[i] = Scale * ((src_ptr[i] & (1 << bit)) >> bit) - Bias;
-
-  if(sigma > 0.0f)
-    cv::GaussianBlur(dst, dst, cv::Size(5,5), sigma, sigma);
 }
 
 template <typename TDst>
 class BitPlanesComputeBody : public ParallelForBody
 {
  public:
-  BitPlanesComputeBody(const cv::Mat& I, float sigma_ct, float sigma_bp,
-                       std::array<cv::Mat,8>& bp)
-      : ParallelForBody()
-      , _C( census(I, sigma_ct) )
-      , _sigma_bp(sigma_bp)
-      , _channels(bp) {}
+  BitPlanesComputeBody(const cv::Mat& C, std::array<cv::Mat,8>& bp)
+      : ParallelForBody(), _C(C), _channels(bp) {}
 
   virtual ~BitPlanesComputeBody() {}
 
   void operator()(const Range& range) const
   {
     for(int b = range.begin(); b != range.end(); ++b)
-      ExtractChannel<TDst>(_C, _channels[b], b, _sigma_bp);
+      ExtractChannel<TDst>(_C, _channels[b], b);
   }
 
  protected:
-  cv::Mat _C;
-  float _sigma_bp;
+  const cv::Mat& _C;
   std::array<cv::Mat,8>& _channels;
 }; // BitPlanesComputeBody
 
+namespace {
+
+/** rows of the output per band of the fused kernel */
+constexpr int BandRows = 32;
+
+/** the bit-planes are smoothed with a 5x5 Gaussian */
+constexpr int BlurRadius = 2;
+constexpr int BlurSize = 2*BlurRadius + 1;
+
+/** per band, one unpacked bit-plane row plus a ring of filtered rows per plane */
+constexpr int BandBufferRows = 1 + 8*BlurSize;
+
+static inline int NumBands(int rows) { return (rows + BandRows - 1) / BandRows; }
+
+}; // namespace
+
+/**
+ * computes the census, the bit split and the 5x5 smoothing over bands of rows
+ * in one pass.
+ *
+ * Each band computes the census of the rows it needs (including BlurRadius
+ * rows above and below), splits each row into the 8 bits and filters them
+ * horizontally into a ring of BlurSize rows per bit-plane. The vertical pass
+ * writes the final channels. The working set of a band is a few rows, so
+ * neither the census nor the unsmoothed bit-planes go through memory.
+ *
+ * The arithmetic is the same as gaussianBlur, hence the output is the same as
+ * computing the census, the bit-planes and smoothing them separately
+ */
+class BitPlanesFusedBody : public ParallelForBody
+{
+ public:
+  BitPlanesFusedBody(const cv::Mat& I, float sigma_bp, std::array<cv::Mat,8>& bp,
+                     cv::Mat& band_buffer, cv::Mat& band_census)
+      : ParallelForBody(), _I(I), _channels(bp), _buffer(band_buffer)
+      , _census(band_census)
+  {
+    gaussianKernel(BlurSize, sigma_bp, _k);
+  }
+
+  virtual ~BitPlanesFusedBody() {}
+
+  void operator()(const Range& range) const
+  {
+    for(int b = range.begin(); b != range.end(); ++b)
+      runBand(b);
+  }
+
+ protected:
+  inline float* bufferRow(int band, int i) const
+  {
+    return _buffer.ptr<float>(band * BandBufferRows + i);
+  }
+
+  inline float* ringRow(int band, int bit, int row) const
+  {
+    return bufferRow(band, 1 + bit*BlurSize + row % BlurSize);
+  }
+
+  void runBand(int band) const
+  {
+    const int rows = _I.rows, cols = _I.cols;
+    const int y0 = band * BandRows, y1 = std::min(rows, y0 + BandRows);
+
+    uint8_t* c = _census.ptr<uint8_t>(band);
+    float* bits = bufferRow(band, 0);
+
+    const float* rp[BlurSize];
+    for(int y = y0, n_done = std::max(0, y0 - BlurRadius); y < y1; ++y)
+    {
+      for( ; n_done < std::min(y + BlurRadius + 1, rows); ++n_done) {
+        census(_I, n_done, c);
+        for(int bit = 0; bit < 8; ++bit) {
+          for(int x = 0; x < cols; ++x)
+            bits[x] = (float) ((c[x] >> bit) & 1);
+          filterRow(bits, cols, ringRow(band, bit, n_done));
+        }
+      }
+
+      for(int bit = 0; bit < 8; ++bit) {
+        for(int j = 0; j < BlurSize; ++j)
+          rp[j] = ringRow(band, bit, borderReflect101(y + j - BlurRadius, rows));
+
+        float* d = _channels[bit].ptr<float>(y);
+        for(int x = 0; x < cols; ++x) {
+          float v = _k[2] * rp[2][x];
+          v += _k[3] * (rp[1][x] + rp[3][x]);
+          v += _k[4] * (rp[0][x] + rp[4][x]);
+          d[x] = v;
+        }
+      }
+    }
+  }
+
+  inline void filterRow(const float* src, int cols, float* dst) const
+  {
+    const int x0 = std::min(BlurRadius, cols), x1 = std::max(x0, cols - BlurRadius);
+
+    for(int x = 0; x < x0; ++x)
+      dst[x] = filterBorder(src, cols, x);
+
+    for(int x = x0; x < x1; ++x) {
+      float v = _k[2] * src[x];
+      v += _k[3] * (src[x-1] + src[x+1]);
+      v += _k[4] * (src[x-2] + src[x+2]);
+      dst[x] = v;
+    }
+
+    for(int x = x1; x < cols; ++x)
+      dst[x] = filterBorder(src, cols, x);
+  }
+
+  inline float filterBorder(const float* src, int cols, int x) const
+  {
+    float v = _k[2] * src[x];
+    for(int j = 1; j <= BlurRadius; ++j)
+      v += _k[2+j] * (src[borderReflect101(x-j, cols)] + src[borderReflect101(x+j, cols)]);
+    return v;
+  }
+
+ protected:
+  const cv::Mat& _I;
+  std::array<cv::Mat,8>& _channels;
+  cv::Mat& _buffer;
+  cv::Mat& _census;
+  float _k[BlurSize];
+}; // BitPlanesFusedBody
+
 void BitPlanesDescriptor::compute(const cv::Mat& I_)
 {
   _rows = I_.rows;
   _cols = I_.cols;
 
-  BitPlanesComputeBody<float> func(I_, _sigma_ct, _sigma_bp, _channels);
-  parallel_for(Range(0, 8), func);
+  THROW_ERROR_IF( I_.type() != CV_8UC1, "BitPlanes requires a CV_8UC1 image" );
+
+  // all intermediate images are members and are reused between frames
+  const cv::Mat* src = &I_;
+  if(_sigma_ct > 0.0f) {
+    gaussianBlur(I_, _blurred, 3, _sigma_ct, _buffer);
+    src = &_blurred;
+  }
+
+  if(_sigma_bp > 0.0f) {
+    const int num_bands = NumBands(_rows);
+    _band_buffer.create(num_bands * BandBufferRows, _cols, CV_32FC1);
+    _census.create(num_bands, _cols, CV_8UC1);
+    for(auto& c : _channels)
+      c.create(_rows, _cols, CV_32FC1);
+
+    BitPlanesFusedBody func(*src, _sigma_bp, _channels, _band_buffer, _census);
+    parallel_for(Range(0, num_bands), func, num_bands);
+  } else {
+    census(*src, _census);
+    BitPlanesComputeBody<float> func(_census, _channels);
+    parallel_for(Range(0, 8), func);
+  }
 }
 
 } // bpvo
@@ -82,6 +82,12 @@ class BitPlanesDescriptor : public DenseDescriptor
   int _rows, _cols;
   float _sigma_ct, _sigma_bp;
   std::array<cv::Mat,8> _channels;
+
+  // scratch space, kept to avoid allocations on every frame. With smoothing of
+  // the bit-planes, _census holds one row per band of the fused kernel and
+  // _band_buffer its filtered rows, otherwise _census is the full image
+  cv::Mat _blurred, _census;
+  cv::Mat _buffer, _band_buffer;
 }; // BitPlanesDescriptor
 
 }; // bpvo
@@ -20,11 +20,14 @@
  */
 
 #include "bpvo/census.h"
+#include "bpvo/census_avx.h"
 #include "bpvo/v128.h"
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
+#include <algorithm>
+
 namespace bpvo {
 
 static const __m128i K0x01 = _mm_set1_epi8(0x01);
@@ -56,36 +59,230 @@ static FORCE_INLINE void censusOp(const uint8_t* src, int stride, uint8_t* dst)
 #undef C_OP
 }
 
-cv::Mat census(const cv::Mat& src, float s)
+/**
+ * census of an interior row, src points to the first pixel of the row
+ */
+static inline void censusRow(const uint8_t* src_ptr, int stride, int cols, uint8_t* dst_ptr)
 {
-  assert( src.type() == CV_8UC1 && src.channels() == 1 && src.isContinuous() );
+  *(dst_ptr + 0) = 0;
+  *(dst_ptr + cols - 1) = 0;
 
-  cv::Mat image = src;
-  if(s > 0.0f)
-    cv::GaussianBlur(src, image, cv::Size(3,3), s, s);
+  // wider kernels if the CPU has them
+  if(HasCensusAvx512() && CensusRowAvx512(src_ptr, stride, cols, dst_ptr))
+    return;
+  if(HasCensusAvx2() && CensusRowAvx2(src_ptr, stride, cols, dst_ptr))
+    return;
+
+  if(cols < 18) {
+    // narrower than one vector
+    for(int c = 1; c < cols - 1; ++c) {
+      const uint8_t* p = src_ptr + c;
+      const uint8_t v = *p;
+      dst_ptr[c] = ((p[-stride-1] >= v) << 0) | ((p[-stride] >= v) << 1) |
+          ((p[-stride+1] >= v) << 2) | ((p[-1] >= v) << 3) | ((p[1] >= v) << 4) |
+          ((p[stride-1] >= v) << 5) | ((p[stride] >= v) << 6) | ((p[stride+1] >= v) << 7);
+    }
+    return;
+  }
+
+  const int W = 1 + ((cols - 2) & ~15);
+  for(int c = 1; c < W; c += 16)
+    censusOp(src_ptr + c, stride, dst_ptr + c);
+
+  if(W != cols - 1)
+    censusOp(src_ptr + cols - 1 - 16, stride, dst_ptr + cols - 1 - 16);
+}
+
+void census(const cv::Mat& src, cv::Mat& dst)
+{
+  assert( src.type() == CV_8UC1 && src.channels() == 1 );
 
-  cv::Mat dst(src.size(), CV_8UC1);
-  const int W = 1 + ((src.cols - 2) & ~15);
-  auto src_ptr = image.ptr<const uint8_t>();
+  dst.create(src.size(), CV_8UC1);
+  // the input may be a borrowed view with padded rows
+  const int stride = src.step;
+  auto src_ptr = src.ptr<const uint8_t>();
   auto dst_ptr = dst.ptr<uint8_t>();
 
   memset(dst_ptr, 0, src.cols); // set two rows to 0
-  src_ptr += src.cols;
+  src_ptr += stride;
   dst_ptr += dst.cols;
 
-  for(int r = 2; r < src.rows; ++r, src_ptr += src.cols, dst_ptr += dst.cols)
-  {
-    *(dst_ptr + 0) = 0;
-    for(int c = 1; c < W; c += 16)
-      censusOp(src_ptr + c, src.cols, dst_ptr + c);
+  for(int r = 2; r < src.rows; ++r, src_ptr += stride, dst_ptr += dst.cols)
+    censusRow(src_ptr, stride, src.cols, dst_ptr);
 
-    if(W != src.cols - 1)
-      censusOp(src_ptr + src.cols - 1 - 16, src.cols, dst_ptr + dst.cols - 1 - 16);
+  memset(dst_ptr, 0, dst.cols);
+}
+
+void census(const cv::Mat& src, int row, uint8_t* dst)
+{
+  assert( src.type() == CV_8UC1 && src.channels() == 1 );
+
+  if(row <= 0 || row >= src.rows - 1)
+    memset(dst, 0, src.cols);
+  else
+    censusRow(src.ptr<const uint8_t>(row), src.step, src.cols, dst);
+}
 
-    *(dst_ptr + dst.cols - 1) = 0;
+/**
+ * 5x5 census of columns [x0, x1) of a row. One pass over the row per
+ * neighbour, the inner loops have no branches
+ */
+static inline void census5x5Row(const uint8_t* src, int stride, int x0, int x1, uint32_t* dst)
+{
+  std::fill(dst + x0, dst + x1, 0u);
+  for(int t = 0; t < 24; ++t) {
+    const uint8_t* n = src + Census5x5Offsets[t][0]*stride + Census5x5Offsets[t][1];
+    const int shift = 8*(t/8) + 7 - (t%8);
+    for(int x = x0; x < x1; ++x)
+      dst[x] |= uint32_t(n[x] < src[x]) << shift;
   }
+}
 
-  memset(dst_ptr, 0, dst.cols);
+/**
+ * 9x7 census of columns [x0, x1) of a row
+ */
+static inline void census9x7Row(const uint8_t* src, int stride, int x0, int x1, uint64_t* dst)
+{
+  std::fill(dst + x0, dst + x1, uint64_t(0));
+  for(int t = 0; t < 44; ++t) {
+    const int off = Census9x7Offsets[t][0]*stride + Census9x7Offsets[t][1];
+    const uint8_t* p0 = src + off;
+    const uint8_t* p1 = src - off;
+    for(int x = x0; x < x1; ++x)
+      dst[x] = (dst[x] << 1) | (p0[x] > p1[x]);
+  }
+}
+
+//
+// SSE2 versions, 16 pixels at a time. Same layout as the AVX2 kernels within a
+// 128-bit lane
+//
+
+static inline __m128i LoadSigned(const uint8_t* p)
+{
+  return _mm_xor_si128(_mm_loadu_si128((const __m128i*) p), _mm_set1_epi8((char) 0x80));
+}
+
+static inline void census5x5Block(const uint8_t* src, int stride, uint32_t* dst)
+{
+  const __m128i c = LoadSigned(src);
+
+  __m128i B[3];
+  for(int k = 0; k < 3; ++k) {
+    __m128i b = _mm_setzero_si128();
+    for(int j = 0; j < 8; ++j) {
+      const int8_t* o = Census5x5Offsets[8*k + j];
+      const __m128i n = LoadSigned(src + o[0]*stride + o[1]);
+      b = _mm_or_si128(b, _mm_and_si128(_mm_cmpgt_epi8(c, n), _mm_set1_epi8((char) (0x80 >> j))));
+    }
+    B[k] = b;
+  }
+
+  const __m128i z = _mm_setzero_si128();
+  const __m128i lo = _mm_unpacklo_epi8(B[0], B[1]), hi = _mm_unpackhi_epi8(B[0], B[1]);
+  const __m128i lo2 = _mm_unpacklo_epi8(B[2], z), hi2 = _mm_unpackhi_epi8(B[2], z);
+  _mm_storeu_si128((__m128i*) (dst +  0), _mm_unpacklo_epi16(lo, lo2));
+  _mm_storeu_si128((__m128i*) (dst +  4), _mm_unpackhi_epi16(lo, lo2));
+  _mm_storeu_si128((__m128i*) (dst +  8), _mm_unpacklo_epi16(hi, hi2));
+  _mm_storeu_si128((__m128i*) (dst + 12), _mm_unpackhi_epi16(hi, hi2));
+}
+
+static inline void census9x7Block(const uint8_t* src, int stride, uint64_t* dst)
+{
+  __m128i B[6];
+  for(int k = 0; k < 6; ++k) {
+    __m128i b = _mm_setzero_si128();
+    for(int j = 0; j < 8 && 8*k + j < 44; ++j) {
+      const int8_t* o = Census9x7Offsets[43 - 8*k - j];
+      const __m128i p0 = LoadSigned(src + o[0]*stride + o[1]);
+      const __m128i p1 = LoadSigned(src - o[0]*stride - o[1]);
+      b = _mm_or_si128(b, _mm_and_si128(_mm_cmpgt_epi8(p0, p1), _mm_set1_epi8((char) (1 << j))));
+    }
+    B[k] = b;
+  }
+
+  const __m128i z = _mm_setzero_si128();
+  const __m128i p01l = _mm_unpacklo_epi8(B[0], B[1]), p01h = _mm_unpackhi_epi8(B[0], B[1]);
+  const __m128i p23l = _mm_unpacklo_epi8(B[2], B[3]), p23h = _mm_unpackhi_epi8(B[2], B[3]);
+  const __m128i p45l = _mm_unpacklo_epi8(B[4], B[5]), p45h = _mm_unpackhi_epi8(B[4], B[5]);
+
+  const __m128i q[4] = {
+    _mm_unpacklo_epi16(p01l, p23l), _mm_unpackhi_epi16(p01l, p23l),
+    _mm_unpacklo_epi16(p01h, p23h), _mm_unpackhi_epi16(p01h, p23h) };
+  const __m128i r[4] = {
+    _mm_unpacklo_epi16(p45l, z), _mm_unpackhi_epi16(p45l, z),
+    _mm_unpacklo_epi16(p45h, z), _mm_unpackhi_epi16(p45h, z) };
+
+  for(int k = 0; k < 4; ++k) {
+    _mm_storeu_si128((__m128i*) (dst + 4*k + 0), _mm_unpacklo_epi32(q[k], r[k]));
+    _mm_storeu_si128((__m128i*) (dst + 4*k + 2), _mm_unpackhi_epi32(q[k], r[k]));
+  }
+}
+
+/**
+ * runs the SSE2 blocks over [r, cols-r) of a row, falls back to the scalar
+ * version for narrow rows
+ */
+template <class T, class Block, class Scalar> static inline
+void censusRowSse2(const uint8_t* src, int stride, int cols, int r, T* dst,
+                   Block block, Scalar scalar)
+{
+  const int x1 = cols - r;
+  if(x1 - r < 16) {
+    scalar(src, stride, r, x1, dst);
+    return;
+  }
+
+  // the last block is moved back to end at x1
+  for(int x = r; x < x1; x += 16) {
+    x = std::min(x, x1 - 16);
+    block(src + x, stride, dst + x);
+  }
+}
+
+void census5x5(const uint8_t* src, int rows, int cols, uint32_t* dst)
+{
+  const bool has_avx512 = HasCensusAvx512(), has_avx2 = HasCensusAvx2();
+
+  memset(dst, 0, sizeof(uint32_t) * rows * cols);
+  for(int y = 2; y < rows - 2; ++y) {
+    const uint8_t* s = src + y*cols;
+    uint32_t* d = dst + y*cols;
+    if(has_avx512 && Census5x5RowAvx512(s, cols, cols, d))
+      continue;
+    if(has_avx2 && Census5x5RowAvx2(s, cols, cols, d))
+      continue;
+    censusRowSse2(s, cols, cols, 2, d, census5x5Block, census5x5Row);
+  }
+}
+
+void census9x7(const uint8_t* src, int rows, int cols, uint64_t* dst)
+{
+  const bool has_avx512 = HasCensusAvx512(), has_avx2 = HasCensusAvx2();
+
+  memset(dst, 0, sizeof(uint64_t) * rows * cols);
+  for(int y = 3; y < rows - 3; ++y) {
+    const uint8_t* s = src + y*cols;
+    uint64_t* d = dst + y*cols;
+    if(has_avx512 && Census9x7RowAvx512(s, cols, cols, d))
+      continue;
+    if(has_avx2 && Census9x7RowAvx2(s, cols, cols, d))
+      continue;
+    censusRowSse2(s, cols, cols, 4, d, census9x7Block, census9x7Row);
+  }
+}
+
+cv::Mat census(const cv::Mat& src, float s)
+{
+  cv::Mat dst;
+  if(s > 0.0f) {
+    // blur into a new image, the input belongs to the caller
+    cv::Mat image;
+    cv::GaussianBlur(src, image, cv::Size(3,3), s, s);
+    census(image, dst);
+  } else {
+    census(src, dst);
+  }
 
   return dst;
 }
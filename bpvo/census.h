@@ -22,6 +22,8 @@
 #ifndef BPVO_CENSUS_H
 #define BPVO_CENSUS_H
 
+#include <cstdint>
+
 namespace cv {
 class Mat;
 };
@@ -36,6 +38,36 @@ namespace bpvo {
  */
 cv::Mat census(const cv::Mat& src, float sigma = -1.0f);
 
+/**
+ * compute the Census Transform of src into dst without smoothing. dst is
+ * reused if it has the right size and type
+ */
+void census(const cv::Mat& src, cv::Mat& dst);
+
+/**
+ * compute the Census Transform of a single row of src into dst, which must
+ * hold src.cols bytes. The output is the same as row 'row' of census(src, dst)
+ */
+void census(const cv::Mat& src, int row, uint8_t* dst);
+
+/**
+ * 5x5 census of a rows x cols image (stride is cols). Each of the 24 neighbours
+ * sets a bit if it is smaller than the center, see Census5x5Offsets for the
+ * order. Pixels within 2 of the border are set to 0
+ */
+void census5x5(const uint8_t* src, int rows, int cols, uint32_t* dst);
+
+/**
+ * 9x7 center-symmetric census with 44 pixel pairs, see Census9x7Offsets.
+ * Rows within 3 and columns within 4 of the border are set to 0
+ */
+void census9x7(const uint8_t* src, int rows, int cols, uint64_t* dst);
+
+/*
+ * All the census functions use AVX2 or AVX-512BW kernels when the CPU supports
+ * them, the output does not depend on the kernel
+ */
+
 }; // bpvo
 
 #endif // BPVO_CENSUS_H
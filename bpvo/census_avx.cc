@@ -0,0 +1,412 @@
+/*
+   This file is part of bpvo.
+
+   bpvo is free software: you can redistribute it and/or modify
+   it under the terms of the Lesser GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   bpvo is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   Lesser GNU General Public License for more details.
+
+   You should have received a copy of the Lesser GNU General Public License
+   along with bpvo.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/*
+ * Contributor: halismai@cs.cmu.edu
+ */
+
+#include "bpvo/census_avx.h"
+#include "bpvo/cpu_features.h"
+#include "bpvo/debug.h"
+
+#include <immintrin.h>
+#include <algorithm>
+
+namespace bpvo {
+
+bool HasCensusAvx2() { return HasSimdLevel(kSimdAVX2); }
+
+bool HasCensusAvx512() { return HasSimdLevel(kSimdAVX512); }
+
+#if defined(__x86_64__) || defined(__i386__)
+
+namespace {
+
+//
+// AVX2
+//
+
+TARGET_ISA("avx2") static inline __m256i Load256(const uint8_t* p)
+{
+  return _mm256_loadu_si256((const __m256i*) p);
+}
+
+/** loads 32 pixels with the sign bit flipped for unsigned compares */
+TARGET_ISA("avx2") static inline __m256i LoadSigned256(const uint8_t* p)
+{
+  return _mm256_xor_si256(Load256(p), _mm256_set1_epi8((char) 0x80));
+}
+
+/** unsigned a >= b */
+TARGET_ISA("avx2") static inline __m256i CmpGe256(__m256i a, __m256i b)
+{
+  return _mm256_cmpeq_epi8(_mm256_max_epu8(a, b), a);
+}
+
+TARGET_ISA("avx2") static inline
+void Census3x3Block256(const uint8_t* src, int stride, uint8_t* dst)
+{
+  const __m256i c = Load256(src);
+  __m256i r = _mm256_setzero_si256();
+  r = _mm256_or_si256(r, _mm256_and_si256(CmpGe256(Load256(src - stride - 1), c), _mm256_set1_epi8(0x01)));
+  r = _mm256_or_si256(r, _mm256_and_si256(CmpGe256(Load256(src - stride    ), c), _mm256_set1_epi8(0x02)));
+  r = _mm256_or_si256(r, _mm256_and_si256(CmpGe256(Load256(src - stride + 1), c), _mm256_set1_epi8(0x04)));
+  r = _mm256_or_si256(r, _mm256_and_si256(CmpGe256(Load256(src          - 1), c), _mm256_set1_epi8(0x08)));
+  r = _mm256_or_si256(r, _mm256_and_si256(CmpGe256(Load256(src          + 1), c), _mm256_set1_epi8(0x10)));
+  r = _mm256_or_si256(r, _mm256_and_si256(CmpGe256(Load256(src + stride - 1), c), _mm256_set1_epi8(0x20)));
+  r = _mm256_or_si256(r, _mm256_and_si256(CmpGe256(Load256(src + stride    ), c), _mm256_set1_epi8(0x40)));
+  r = _mm256_or_si256(r, _mm256_and_si256(CmpGe256(Load256(src + stride + 1), c), _mm256_set1_epi8((char) 0x80)));
+  _mm256_storeu_si256((__m256i*) dst, r);
+}
+
+/**
+ * interleaves the bytes of B[0..nb) into 32 values of 32 or 64 bits, B[k] is
+ * byte k of every value. Within a 128-bit lane the unpacks produce values in
+ * order, the lanes are put back together with the permutes
+ */
+TARGET_ISA("avx2") static inline
+void Store4Bytes256(const __m256i* B, uint32_t* dst)
+{
+  const __m256i z = _mm256_setzero_si256();
+  const __m256i lo = _mm256_unpacklo_epi8(B[0], B[1]), hi = _mm256_unpackhi_epi8(B[0], B[1]);
+  const __m256i lo2 = _mm256_unpacklo_epi8(B[2], z), hi2 = _mm256_unpackhi_epi8(B[2], z);
+
+  const __m256i w0 = _mm256_unpacklo_epi16(lo, lo2), w1 = _mm256_unpackhi_epi16(lo, lo2);
+  const __m256i w2 = _mm256_unpacklo_epi16(hi, hi2), w3 = _mm256_unpackhi_epi16(hi, hi2);
+
+  _mm256_storeu_si256((__m256i*) (dst +  0), _mm256_permute2x128_si256(w0, w1, 0x20));
+  _mm256_storeu_si256((__m256i*) (dst +  8), _mm256_permute2x128_si256(w2, w3, 0x20));
+  _mm256_storeu_si256((__m256i*) (dst + 16), _mm256_permute2x128_si256(w0, w1, 0x31));
+  _mm256_storeu_si256((__m256i*) (dst + 24), _mm256_permute2x128_si256(w2, w3, 0x31));
+}
+
+TARGET_ISA("avx2") static inline
+void Store8Bytes256(const __m256i* B, uint64_t* dst)
+{
+  const __m256i z = _mm256_setzero_si256();
+  const __m256i p01l = _mm256_unpacklo_epi8(B[0], B[1]), p01h = _mm256_unpackhi_epi8(B[0], B[1]);
+  const __m256i p23l = _mm256_unpacklo_epi8(B[2], B[3]), p23h = _mm256_unpackhi_epi8(B[2], B[3]);
+  const __m256i p45l = _mm256_unpacklo_epi8(B[4], B[5]), p45h = _mm256_unpackhi_epi8(B[4], B[5]);
+
+  const __m256i q[4] = {
+    _mm256_unpacklo_epi16(p01l, p23l), _mm256_unpackhi_epi16(p01l, p23l),
+    _mm256_unpacklo_epi16(p01h, p23h), _mm256_unpackhi_epi16(p01h, p23h) };
+  const __m256i r[4] = {
+    _mm256_unpacklo_epi16(p45l, z), _mm256_unpackhi_epi16(p45l, z),
+    _mm256_unpacklo_epi16(p45h, z), _mm256_unpackhi_epi16(p45h, z) };
+
+  for(int k = 0; k < 4; ++k) {
+    const __m256i o0 = _mm256_unpacklo_epi32(q[k], r[k]);
+    const __m256i o1 = _mm256_unpackhi_epi32(q[k], r[k]);
+    _mm256_storeu_si256((__m256i*) (dst + 4*k +  0), _mm256_permute2x128_si256(o0, o1, 0x20));
+    _mm256_storeu_si256((__m256i*) (dst + 4*k + 16), _mm256_permute2x128_si256(o0, o1, 0x31));
+  }
+}
+
+TARGET_ISA("avx2") static inline
+void Census5x5Block256(const uint8_t* src, int stride, uint32_t* dst)
+{
+  const __m256i c = LoadSigned256(src);
+
+  __m256i B[3];
+  for(int k = 0; k < 3; ++k) {
+    __m256i b = _mm256_setzero_si256();
+    for(int j = 0; j < 8; ++j) {
+      const int8_t* o = Census5x5Offsets[8*k + j];
+      const __m256i n = LoadSigned256(src + o[0]*stride + o[1]);
+      b = _mm256_or_si256(b, _mm256_and_si256(_mm256_cmpgt_epi8(c, n),
+                                              _mm256_set1_epi8((char) (0x80 >> j))));
+    }
+    B[k] = b;
+  }
+
+  Store4Bytes256(B, dst);
+}
+
+TARGET_ISA("avx2") static inline
+void Census9x7Block256(const uint8_t* src, int stride, uint64_t* dst)
+{
+  __m256i B[6];
+  for(int k = 0; k < 6; ++k) {
+    __m256i b = _mm256_setzero_si256();
+    for(int j = 0; j < 8 && 8*k + j < 44; ++j) {
+      const int8_t* o = Census9x7Offsets[43 - 8*k - j];
+      const __m256i p0 = LoadSigned256(src + o[0]*stride + o[1]);
+      const __m256i p1 = LoadSigned256(src - o[0]*stride - o[1]);
+      b = _mm256_or_si256(b, _mm256_and_si256(_mm256_cmpgt_epi8(p0, p1),
+                                              _mm256_set1_epi8((char) (1 << j))));
+    }
+    B[k] = b;
+  }
+
+  Store8Bytes256(B, dst);
+}
+
+//
+// AVX-512BW
+//
+
+TARGET_ISA("avx512bw") static inline __m512i Load512(const uint8_t* p)
+{
+  return _mm512_loadu_si512((const void*) p);
+}
+
+/** sets the bits in mask m of r */
+TARGET_ISA("avx512bw") static inline
+__m512i SetBits512(__m512i r, __mmask64 m, char bits)
+{
+  return _mm512_or_si512(r, _mm512_maskz_mov_epi8(m, _mm512_set1_epi8(bits)));
+}
+
+TARGET_ISA("avx512bw") static inline
+void Census3x3Block512(const uint8_t* src, int stride, uint8_t* dst)
+{
+  const __m512i c = Load512(src);
+  __m512i r = _mm512_setzero_si512();
+  r = SetBits512(r, _mm512_cmpge_epu8_mask(Load512(src - stride - 1), c), 0x01);
+  r = SetBits512(r, _mm512_cmpge_epu8_mask(Load512(src - stride    ), c), 0x02);
+  r = SetBits512(r, _mm512_cmpge_epu8_mask(Load512(src - stride + 1), c), 0x04);
+  r = SetBits512(r, _mm512_cmpge_epu8_mask(Load512(src          - 1), c), 0x08);
+  r = SetBits512(r, _mm512_cmpge_epu8_mask(Load512(src          + 1), c), 0x10);
+  r = SetBits512(r, _mm512_cmpge_epu8_mask(Load512(src + stride - 1), c), 0x20);
+  r = SetBits512(r, _mm512_cmpge_epu8_mask(Load512(src + stride    ), c), 0x40);
+  r = SetBits512(r, _mm512_cmpge_epu8_mask(Load512(src + stride + 1), c), (char) 0x80);
+  _mm512_storeu_si512((void*) dst, r);
+}
+
+/**
+ * same as the AVX2 version, lane L of the k-th unpacked vector holds the values
+ * starting at 16*L + k*(values per 128 bits)
+ */
+/**
+ * Transposes the 128-bit lanes of a[0..3], row j = { a[0].j, a[1].j, a[2].j, a[3].j }
+ * is stored at dst + j*stride bytes.
+ *
+ * Done with permutes instead of _mm512_extracti32x4_epi32, the undefined
+ * passthrough of the extract (and of the unpack_epi32) triggers
+ * -Wmaybe-uninitialized with gcc
+ */
+TARGET_ISA("avx512bw") static inline
+void StoreLanesTransposed512(const __m512i* a, uint8_t* dst, int stride)
+{
+  // 64-bit indices, 8 and up select the second operand
+  const __m512i even = _mm512_set_epi64(11, 10, 3, 2, 9, 8, 1, 0);
+  const __m512i odd  = _mm512_set_epi64(15, 14, 7, 6, 13, 12, 5, 4);
+  const __m512i lo   = _mm512_set_epi64(11, 10, 9, 8, 3, 2, 1, 0);
+  const __m512i hi   = _mm512_set_epi64(15, 14, 13, 12, 7, 6, 5, 4);
+
+  // { a0.0 a1.0 a0.1 a1.1 }, { a0.2 a1.2 a0.3 a1.3 } and the same for a2, a3
+  const __m512i t0 = _mm512_permutex2var_epi64(a[0], even, a[1]);
+  const __m512i t1 = _mm512_permutex2var_epi64(a[0], odd,  a[1]);
+  const __m512i t2 = _mm512_permutex2var_epi64(a[2], even, a[3]);
+  const __m512i t3 = _mm512_permutex2var_epi64(a[2], odd,  a[3]);
+
+  _mm512_storeu_si512(dst + 0*stride, _mm512_permutex2var_epi64(t0, lo, t2));
+  _mm512_storeu_si512(dst + 1*stride, _mm512_permutex2var_epi64(t0, hi, t2));
+  _mm512_storeu_si512(dst + 2*stride, _mm512_permutex2var_epi64(t1, lo, t3));
+  _mm512_storeu_si512(dst + 3*stride, _mm512_permutex2var_epi64(t1, hi, t3));
+}
+
+TARGET_ISA("avx512bw") static inline
+void Store4Bytes512(const __m512i* B, uint32_t* dst)
+{
+  const __m512i z = _mm512_setzero_si512();
+  const __m512i lo = _mm512_unpacklo_epi8(B[0], B[1]), hi = _mm512_unpackhi_epi8(B[0], B[1]);
+  const __m512i lo2 = _mm512_unpacklo_epi8(B[2], z), hi2 = _mm512_unpackhi_epi8(B[2], z);
+
+  const __m512i w[4] = {
+    _mm512_unpacklo_epi16(lo, lo2), _mm512_unpackhi_epi16(lo, lo2),
+    _mm512_unpacklo_epi16(hi, hi2), _mm512_unpackhi_epi16(hi, hi2) };
+
+  StoreLanesTransposed512(w, (uint8_t*) dst, 64);
+}
+
+TARGET_ISA("avx512bw") static inline
+void Store8Bytes512(const __m512i* B, uint64_t* dst)
+{
+  const __m512i z = _mm512_setzero_si512();
+  const __m512i p01l = _mm512_unpacklo_epi8(B[0], B[1]), p01h = _mm512_unpackhi_epi8(B[0], B[1]);
+  const __m512i p23l = _mm512_unpacklo_epi8(B[2], B[3]), p23h = _mm512_unpackhi_epi8(B[2], B[3]);
+  const __m512i p45l = _mm512_unpacklo_epi8(B[4], B[5]), p45h = _mm512_unpackhi_epi8(B[4], B[5]);
+
+  const __m512i q[4] = {
+    _mm512_unpacklo_epi16(p01l, p23l), _mm512_unpackhi_epi16(p01l, p23l),
+    _mm512_unpacklo_epi16(p01h, p23h), _mm512_unpackhi_epi16(p01h, p23h) };
+  const __m512i r[4] = {
+    _mm512_unpacklo_epi16(p45l, z), _mm512_unpackhi_epi16(p45l, z),
+    _mm512_unpacklo_epi16(p45h, z), _mm512_unpackhi_epi16(p45h, z) };
+
+  // the zero-masked unpacks are the plain ones without the undefined passthrough
+  const __mmask16 all = 0xffff;
+  __m512i o[8];
+  for(int k = 0; k < 4; ++k) {
+    o[2*k + 0] = _mm512_maskz_unpacklo_epi32(all, q[k], r[k]);
+    o[2*k + 1] = _mm512_maskz_unpackhi_epi32(all, q[k], r[k]);
+  }
+
+  StoreLanesTransposed512(o + 0, (uint8_t*) (dst + 0), 128);
+  StoreLanesTransposed512(o + 4, (uint8_t*) (dst + 8), 128);
+}
+
+TARGET_ISA("avx512bw") static inline
+void Census5x5Block512(const uint8_t* src, int stride, uint32_t* dst)
+{
+  const __m512i c = Load512(src);
+
+  __m512i B[3];
+  for(int k = 0; k < 3; ++k) {
+    __m512i b = _mm512_setzero_si512();
+    for(int j = 0; j < 8; ++j) {
+      const int8_t* o = Census5x5Offsets[8*k + j];
+      b = SetBits512(b, _mm512_cmplt_epu8_mask(Load512(src + o[0]*stride + o[1]), c),
+                     (char) (0x80 >> j));
+    }
+    B[k] = b;
+  }
+
+  Store4Bytes512(B, dst);
+}
+
+TARGET_ISA("avx512bw") static inline
+void Census9x7Block512(const uint8_t* src, int stride, uint64_t* dst)
+{
+  __m512i B[6];
+  for(int k = 0; k < 6; ++k) {
+    __m512i b = _mm512_setzero_si512();
+    for(int j = 0; j < 8 && 8*k + j < 44; ++j) {
+      const int8_t* o = Census9x7Offsets[43 - 8*k - j];
+      b = SetBits512(b, _mm512_cmpgt_epu8_mask(Load512(src + o[0]*stride + o[1]),
+                                               Load512(src - o[0]*stride - o[1])),
+                     (char) (1 << j));
+    }
+    B[k] = b;
+  }
+
+  Store8Bytes512(B, dst);
+}
+
+} // namespace
+
+TARGET_ISA("avx2")
+bool CensusRowAvx2(const uint8_t* src, int stride, int cols, uint8_t* dst)
+{
+  const int x1 = cols - 1;
+  if(x1 - 1 < 32)
+    return false;
+
+  // the last block is moved back to end at x1
+  for(int x = 1; x < x1; x += 32) {
+    x = std::min(x, x1 - 32);
+    Census3x3Block256(src + x, stride, dst + x);
+  }
+
+  return true;
+}
+
+TARGET_ISA("avx512bw")
+bool CensusRowAvx512(const uint8_t* src, int stride, int cols, uint8_t* dst)
+{
+  const int x1 = cols - 1;
+  if(x1 - 1 < 64)
+    return false;
+
+  // the last block is moved back to end at x1
+  for(int x = 1; x < x1; x += 64) {
+    x = std::min(x, x1 - 64);
+    Census3x3Block512(src + x, stride, dst + x);
+  }
+
+  return true;
+}
+
+TARGET_ISA("avx2")
+bool Census5x5RowAvx2(const uint8_t* src, int stride, int cols, uint32_t* dst)
+{
+  const int x1 = cols - 2;
+  if(x1 - 2 < 32)
+    return false;
+
+  // the last block is moved back to end at x1
+  for(int x = 2; x < x1; x += 32) {
+    x = std::min(x, x1 - 32);
+    Census5x5Block256(src + x, stride, dst + x);
+  }
+
+  return true;
+}
+
+TARGET_ISA("avx512bw")
+bool Census5x5RowAvx512(const uint8_t* src, int stride, int cols, uint32_t* dst)
+{
+  const int x1 = cols - 2;
+  if(x1 - 2 < 64)
+    return false;
+
+  // the last block is moved back to end at x1
+  for(int x = 2; x < x1; x += 64) {
+    x = std::min(x, x1 - 64);
+    Census5x5Block512(src + x, stride, dst + x);
+  }
+
+  return true;
+}
+
+TARGET_ISA("avx2")
+bool Census9x7RowAvx2(const uint8_t* src, int stride, int cols, uint64_t* dst)
+{
+  const int x1 = cols - 4;
+  if(x1 - 4 < 32)
+    return false;
+
+  // the last block is moved back to end at x1
+  for(int x = 4; x < x1; x += 32) {
+    x = std::min(x, x1 - 32);
+    Census9x7Block256(src + x, stride, dst + x);
+  }
+
+  return true;
+}
+
+TARGET_ISA("avx512bw")
+bool Census9x7RowAvx512(const uint8_t* src, int stride, int cols, uint64_t* dst)
+{
+  const int x1 = cols - 4;
+  if(x1 - 4 < 64)
+    return false;
+
+  // the last block is moved back to end at x1
+  for(int x = 4; x < x1; x += 64) {
+    x = std::min(x, x1 - 64);
+    Census9x7Block512(src + x, stride, dst + x);
+  }
+
+  return true;
+}
+
+#else
+
+bool CensusRowAvx2(const uint8_t*, int, int, uint8_t*) { return false; }
+bool CensusRowAvx512(const uint8_t*, int, int, uint8_t*) { return false; }
+bool Census5x5RowAvx2(const uint8_t*, int, int, uint32_t*) { return false; }
+bool Census5x5RowAvx512(const uint8_t*, int, int, uint32_t*) { return false; }
+bool Census9x7RowAvx2(const uint8_t*, int, int, uint64_t*) { return false; }
+bool Census9x7RowAvx512(const uint8_t*, int, int, uint64_t*) { return false; }
+
+#endif
+
+}; // bpvo
@@ -0,0 +1,100 @@
+/*
+   This file is part of bpvo.
+
+   bpvo is free software: you can redistribute it and/or modify
+   it under the terms of the Lesser GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   bpvo is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   Lesser GNU General Public License for more details.
+
+   You should have received a copy of the Lesser GNU General Public License
+   along with bpvo.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/*
+ * Contributor: halismai@cs.cmu.edu
+ */
+
+#ifndef BPVO_CENSUS_AVX_H
+#define BPVO_CENSUS_AVX_H
+
+#include <cstdint>
+
+namespace bpvo {
+
+/**
+ * Census kernels for a single row, 32 pixels at a time with AVX2 and 64 pixels
+ * at a time with AVX-512BW.
+ *
+ * The kernels are compiled for their instruction set regardless of the
+ * compiler flags, the caller must check HasCensusAvx2() or HasCensusAvx512()
+ * first. They compute the interior pixels of the row only and return false,
+ * without writing anything, if the row is narrower than one vector. The last
+ * block overlaps the previous one, as in census()
+ *
+ * \param src    pointer to the first pixel of the row
+ * \param stride the image stride in bytes
+ * \param cols   number of columns
+ * \param dst    pointer to the first pixel of the output row
+ */
+
+/**
+ * (dy, dx) of the neighbours compared to the center by the 5x5 census, in
+ * raster order. Neighbour t sets bit 8*(t/8) + 7 - t%8 if it is smaller than
+ * the center
+ */
+static constexpr int8_t Census5x5Offsets[24][2] = {
+  {-2,-2}, {-2,-1}, {-2,0}, {-2,1}, {-2,2},
+  {-1,-2}, {-1,-1}, {-1,0}, {-1,1}, {-1,2},
+  { 0,-2}, { 0,-1},         { 0,1}, { 0,2},
+  { 1,-2}, { 1,-1}, { 1,0}, { 1,1}, { 1,2},
+  { 2,-2}, { 2,-1}, { 2,0}, { 2,1}, { 2,2}
+};
+
+/**
+ * (dy, dx) of the pixel pairs compared by the 9x7 center-symmetric census.
+ * Pair t sets bit 43 - t if I(y+dy, x+dx) > I(y-dy, x-dx). The order, with the
+ * repeated pairs, is the one used by the RSGM stereo
+ */
+static constexpr int8_t Census9x7Offsets[44][2] = {
+  {-3,-4}, {-3,-3}, {-3,-2}, {-3,-1}, {-3, 0}, {-2,-4}, {-2,-3}, {-2,-2},
+  {-2,-1}, {-2, 0}, {-1,-4}, {-1,-3}, {-1,-2}, {-1,-1}, {-1, 0}, { 0,-4},
+  { 0,-3}, { 0,-2}, { 0,-1}, {-3, 1}, {-3, 2}, {-3, 3}, {-3, 4}, {-2, 1},
+  {-2, 2}, {-2, 3}, {-2, 4}, {-1, 1}, {-1, 2}, {-1, 3}, {-1, 4}, {-1,-4},
+  {-1,-3}, {-1,-2}, {-1,-1}, { 0,-4}, { 0,-3}, { 0,-2}, { 0,-1}, { 1,-4},
+  { 1,-3}, { 1,-2}, { 1,-1}, {-1, 0}
+};
+
+/** \return true if the CPU supports the AVX2 kernels */
+bool HasCensusAvx2();
+
+/** \return true if the CPU supports the AVX-512BW kernels */
+bool HasCensusAvx512();
+
+/**
+ * 3x3 census, same bits as census(). Columns [1, cols-1) are written
+ */
+bool CensusRowAvx2(const uint8_t* src, int stride, int cols, uint8_t* dst);
+bool CensusRowAvx512(const uint8_t* src, int stride, int cols, uint8_t* dst);
+
+/**
+ * 5x5 census, same bits as census5x5(). Columns [2, cols-2) are written
+ */
+bool Census5x5RowAvx2(const uint8_t* src, int stride, int cols, uint32_t* dst);
+bool Census5x5RowAvx512(const uint8_t* src, int stride, int cols, uint32_t* dst);
+
+/**
+ * 9x7 center-symmetric census, same bits as census9x7(). Columns [4, cols-4)
+ * are written
+ */
+bool Census9x7RowAvx2(const uint8_t* src, int stride, int cols, uint64_t* dst);
+bool Census9x7RowAvx512(const uint8_t* src, int stride, int cols, uint64_t* dst);
+
+}; // bpvo
+
+#endif // BPVO_CENSUS_AVX_H
@@ -0,0 +1,116 @@
+/*
+   This file is part of bpvo.
+
+   bpvo is free software: you can redistribute it and/or modify
+   it under the terms of the Lesser GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   bpvo is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   Lesser GNU General Public License for more details.
+
+   You should have received a copy of the Lesser GNU General Public License
+   along with bpvo.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Contributor: halismai@cs.cmu.edu
+ */
+
+#include "bpvo/cpu_features.h"
+#include "bpvo/debug.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+namespace bpvo {
+
+static CpuFeatures DetectCpuFeatures()
+{
+  CpuFeatures ret;
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+  __builtin_cpu_init();
+  ret.sse2     = __builtin_cpu_supports("sse2");
+  ret.sse4_1   = __builtin_cpu_supports("sse4.1");
+  ret.avx      = __builtin_cpu_supports("avx");
+  ret.avx2     = __builtin_cpu_supports("avx2");
+  ret.fma      = __builtin_cpu_supports("fma");
+  ret.avx512f  = __builtin_cpu_supports("avx512f");
+  ret.avx512bw = __builtin_cpu_supports("avx512bw");
+#endif
+
+  return ret;
+}
+
+const CpuFeatures& GetCpuFeatures()
+{
+  static const CpuFeatures features = DetectCpuFeatures();
+  return features;
+}
+
+SimdLevel GetMaxSimdLevel()
+{
+  const auto& cpu = GetCpuFeatures();
+
+  if(cpu.avx512f && cpu.avx512bw && cpu.avx2 && cpu.fma) return kSimdAVX512;
+  if(cpu.avx2 && cpu.fma) return kSimdAVX2;
+  if(cpu.avx) return kSimdAVX;
+  if(cpu.sse4_1) return kSimdSSE4_1;
+  if(cpu.sse2) return kSimdSSE2;
+  return kSimdScalar;
+}
+
+const char* ToString(SimdLevel l)
+{
+  switch(l) {
+    case kSimdScalar: return "scalar";
+    case kSimdSSE2: return "sse2";
+    case kSimdSSE4_1: return "sse4.1";
+    case kSimdAVX: return "avx";
+    case kSimdAVX2: return "avx2";
+    case kSimdAVX512: return "avx512";
+  }
+
+  return "unknown";
+}
+
+static SimdLevel InitialSimdLevel()
+{
+  const SimdLevel max_level = GetMaxSimdLevel();
+
+  const char* env = std::getenv("BPVO_SIMD_LEVEL");
+  if(env) {
+    for(int l = kSimdScalar; l <= kSimdAVX512; ++l)
+      if(0 == std::strcmp(env, ToString(static_cast<SimdLevel>(l))))
+        return std::min(max_level, static_cast<SimdLevel>(l));
+
+    Warn("unknown BPVO_SIMD_LEVEL '%s', using '%s'\n", env, ToString(max_level));
+  }
+
+  return max_level;
+}
+
+static std::atomic<int>& SimdLevelStorage()
+{
+  static std::atomic<int> level(InitialSimdLevel());
+  return level;
+}
+
+SimdLevel GetSimdLevel()
+{
+  return static_cast<SimdLevel>(SimdLevelStorage().load(std::memory_order_relaxed));
+}
+
+SimdLevel SetSimdLevel(SimdLevel l)
+{
+  const SimdLevel ret = std::min(l, GetMaxSimdLevel());
+  SimdLevelStorage().store(ret, std::memory_order_relaxed);
+  return ret;
+}
+
+}; // bpvo
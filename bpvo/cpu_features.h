@@ -0,0 +1,106 @@
+/*
+   This file is part of bpvo.
+
+   bpvo is free software: you can redistribute it and/or modify
+   it under the terms of the Lesser GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   bpvo is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   Lesser GNU General Public License for more details.
+
+   You should have received a copy of the Lesser GNU General Public License
+   along with bpvo.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Contributor: halismai@cs.cmu.edu
+ */
+
+#ifndef BPVO_CPU_FEATURES_H
+#define BPVO_CPU_FEATURES_H
+
+namespace bpvo {
+
+/**
+ * Instruction sets supported by the CPU we are running on.
+ *
+ * This may be more than what the library was compiled for. Kernels compiled
+ * with TARGET_ISA are used only if the CPU supports them
+ */
+struct CpuFeatures
+{
+  bool sse2     = false;
+  bool sse4_1   = false;
+  bool avx      = false;
+  bool avx2     = false;
+  bool fma      = false;
+  bool avx512f  = false;
+  bool avx512bw = false;
+}; // CpuFeatures
+
+/**
+ * \return the features of the CPU, detected on the first call
+ */
+const CpuFeatures& GetCpuFeatures();
+
+/**
+ * Kernel variants, in increasing order. kSimdAVX2 includes FMA and kSimdAVX512
+ * is AVX-512F with BW
+ */
+enum SimdLevel
+{
+  kSimdScalar = 0,
+  kSimdSSE2,
+  kSimdSSE4_1,
+  kSimdAVX,
+  kSimdAVX2,
+  kSimdAVX512
+}; // SimdLevel
+
+/**
+ * \return the highest level supported by the CPU
+ */
+SimdLevel GetMaxSimdLevel();
+
+/**
+ * \return the level used to pick the kernels that are selected at runtime.
+ *
+ * This is GetMaxSimdLevel(), unless the environment variable BPVO_SIMD_LEVEL
+ * (scalar, sse2, sse4.1, avx, avx2 or avx512) was set when the library first
+ * checked it, or SetSimdLevel() was called.
+ *
+ * The library is compiled for the SIMD_BASELINE cmake option, SSE2 by default.
+ * The kernels above it (SSE4.1, AVX, AVX2, AVX-512) are compiled for their own
+ * instruction set and used only if the level allows it. Code compiled for the
+ * baseline is not affected, a level lower than the baseline only disables the
+ * wider kernels
+ */
+SimdLevel GetSimdLevel();
+
+/**
+ * Sets the level used for dispatching, for testing and benchmarking. The level
+ * is clamped to GetMaxSimdLevel().
+ *
+ * Some objects choose their kernels when they are constructed, the level should
+ * be set before creating them
+ *
+ * \return the level that will be used
+ */
+SimdLevel SetSimdLevel(SimdLevel);
+
+/**
+ * \return true if kernels of the given level may be used
+ */
+inline bool HasSimdLevel(SimdLevel l) { return GetSimdLevel() >= l; }
+
+/**
+ * \return the name of the level, the same names as BPVO_SIMD_LEVEL
+ */
+const char* ToString(SimdLevel);
+
+}; // bpvo
+
+#endif // BPVO_CPU_FEATURES_H
@@ -30,6 +30,7 @@
 #define FORCE_INLINE inline __attribute__((always_inline))
 #define NO_INLINE           __attribute__((noinline))
 #define ALIGNED(...)        __attribute__((aligned(__VA_ARGS__)))
+#define TARGET_ISA(...)     __attribute__((target(__VA_ARGS__)))
 
 #define likely(expr)        __builtin_expect((expr),true)
 #define unlikey(expr)       __builtin_expect((expr),false)
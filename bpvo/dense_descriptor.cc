@@ -27,10 +27,13 @@
 #include "bpvo/central_difference_descriptor.h"
 
 #include "bpvo/imgproc.h"
+#include "bpvo/interp_avx2.h"
 #include "bpvo/utils.h"
 
 #include <opencv2/imgproc/imgproc.hpp>
 
+#include <cmath>
+
 namespace bpvo {
 
 DenseDescriptor::~DenseDescriptor() {}
@@ -104,6 +107,87 @@ void DenseDescriptor::copyTo(DenseDescriptor* dst) const
   int nchannels = this->numChannels();
   for(int i = 0; i < nchannels; ++i)
     this->getChannel(i).copyTo( dst->getChannel(i) );
+
+  dst->_packed = _packed;
+  dst->_packed_i16 = _packed_i16;
+  dst->_packed_stride = _packed_stride;
+  dst->_packed_scale = _packed_scale;
+}
+
+void DenseDescriptor::packChannels()
+{
+  const int nchannels = this->numChannels();
+  if(nchannels == 1)
+    return;
+
+  const int rows = this->rows(), cols = this->cols();
+  _packed_stride = (nchannels + 7) & ~7;
+  _packed.resize(rows * cols * _packed_stride);
+  _packed_i16.clear();
+
+  const bool use_avx2 = HasBilinearAvx2();
+  for(int y = 0; y < rows; ++y)
+  {
+    float* dst = _packed.data() + y*cols*_packed_stride;
+    for(int c0 = 0; c0 < _packed_stride; c0 += 8)
+    {
+      const float* src[8];
+      const int nc = std::min(8, nchannels - c0);
+      for(int c = 0; c < nc; ++c)
+        src[c] = this->getChannel(c0 + c).ptr<const float>(y);
+
+      int x = use_avx2 ? PackChannelsAvx2(src, nc, cols, dst + c0, _packed_stride) : 0;
+      for( ; x < cols; ++x)
+        for(int c = 0; c < 8; ++c)
+          dst[x*_packed_stride + c0 + c] = c < nc ? src[c][x] : 0.0f;
+    }
+  }
+}
+
+void DenseDescriptor::packChannelsInt16()
+{
+  const int nchannels = this->numChannels();
+  if(nchannels == 1)
+    return;
+
+  const int rows = this->rows(), cols = this->cols();
+
+  float max_abs = 0.0f;
+  for(int c = 0; c < nchannels; ++c)
+  {
+    const auto& C = this->getChannel(c);
+    for(int y = 0; y < rows; ++y)
+    {
+      const float* src = C.ptr<const float>(y);
+      for(int x = 0; x < cols; ++x)
+        max_abs = std::max(max_abs, std::fabs(src[x]));
+    }
+  }
+
+  _packed_scale = max_abs > 0.0f ? 32767.0f / max_abs : 1.0f;
+  _packed_stride = (nchannels + 7) & ~7;
+  _packed_i16.resize(rows * cols * _packed_stride);
+  _packed.clear();
+
+  const bool use_avx2 = HasBilinearAvx2();
+  for(int y = 0; y < rows; ++y)
+  {
+    int16_t* dst = _packed_i16.data() + y*cols*_packed_stride;
+    for(int c0 = 0; c0 < _packed_stride; c0 += 8)
+    {
+      const float* src[8];
+      const int nc = std::min(8, nchannels - c0);
+      for(int c = 0; c < nc; ++c)
+        src[c] = this->getChannel(c0 + c).ptr<const float>(y);
+
+      int x = use_avx2 ?
+          PackChannelsInt16Avx2(src, nc, cols, _packed_scale, dst + c0, _packed_stride) : 0;
+      for( ; x < cols; ++x)
+        for(int c = 0; c < 8; ++c)
+          dst[x*_packed_stride + c0 + c] = c < nc ?
+              static_cast<int16_t>(std::lrint(src[c][x] * _packed_scale)) : 0;
+    }
+  }
 }
 
 }; // bpvo
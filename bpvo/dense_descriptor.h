@@ -91,7 +91,62 @@ class DenseDescriptor
    */
   virtual int cols() const = 0;
 
+  /**
+   * Interleaves the channels pixel-major, such that the channels of a pixel
+   * are contiguous. The number of floats per pixel is numChannels() rounded up
+   * to a multiple of 8, the extra channels are zero. Hence, the 2x2
+   * neighborhood of a pixel covers all the channels in 4 cache lines.
+   *
+   * compute() must be called first, the packed channels are not updated by
+   * compute(). Descriptors with a single channel are not packed
+   */
+  void packChannels();
+
+  /**
+   * \return the packed channels, or nullptr if packChannels() was not called.
+   * Channel c of pixel (y,x) is at (y*cols() + x)*packedStride() + c
+   */
+  inline const float* getPackedChannels() const
+  {
+    return _packed.empty() ? nullptr : _packed.data();
+  }
+
+  /**
+   * Same as packChannels() with the channels stored as 16-bit fixed point,
+   * halving the bandwidth of warping the packed layout. The values are
+   * scaled by packedScale() such that the largest magnitude maps to 32767.
+   *
+   * Only one of the packed layouts is kept. The channel planes are not freed
+   */
+  void packChannelsInt16();
+
+  /**
+   * \return the fixed point packed channels, or nullptr if
+   * packChannelsInt16() was not called. The layout is the same as
+   * getPackedChannels()
+   */
+  inline const int16_t* getPackedChannelsInt16() const
+  {
+    return _packed_i16.empty() ? nullptr : _packed_i16.data();
+  }
+
+  /**
+   * \return the scale of the fixed point channels, value = fixed / scale
+   */
+  inline float packedScale() const { return _packed_scale; }
+
+  /**
+   * \return the number of values per pixel in the packed channels
+   */
+  inline int packedStride() const { return _packed_stride; }
+
   static DenseDescriptor* Create(const AlgorithmParameters&, int pyr_level = 0);
+
+ protected:
+  typename AlignedVector<float>::type _packed;
+  typename AlignedVector<int16_t>::type _packed_i16;
+  int _packed_stride = 0;
+  float _packed_scale = 1.0f;
 }; // DenseDescriptor
 
 
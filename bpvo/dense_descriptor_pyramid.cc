@@ -32,7 +32,9 @@ namespace bpvo {
 struct DenseDescriptorPyramid::Impl
 {
   inline Impl(const AlgorithmParameters& p)
-      : _max_test_level(p.maxTestLevel)
+      : _max_test_level(p.maxTestLevel), _pack_channels(p.packDescriptorChannels)
+      , _pack_int16(p.packDescriptorChannelsInt16)
+      , _image_pyramid(p.numPyramidLevels)
   {
     THROW_ERROR_IF( p.numPyramidLevels <= 0, "invalid number of pyramid levels" );
     THROW_ERROR_IF( p.maxTestLevel < 0, "invalid maxTestLevel" );
@@ -67,20 +69,31 @@ struct DenseDescriptorPyramid::Impl
   inline void init(const ImagePyramid& image_pyramid)
   {
     for(int i = image_pyramid.size()-1; i >= _max_test_level; --i)
+    {
       _desc_pyr[i]->compute(image_pyramid[i]);
+      if(_pack_channels && _pack_int16)
+        _desc_pyr[i]->packChannelsInt16();
+      else if(_pack_channels)
+        _desc_pyr[i]->packChannels();
+    }
   }
 
   inline void init(const cv::Mat& image)
   {
-    ImagePyramid image_pyramid(_desc_pyr.size());
-    image_pyramid.compute(image);
-    init(image_pyramid);
+    // the pyramid is kept to reuse its memory between frames. We do not hold
+    // on to the input image as it might be borrowed from the caller
+    _image_pyramid.compute(image);
+    init(_image_pyramid);
+    _image_pyramid[0].release();
   }
 
   inline int size() const { return static_cast<int>(_desc_pyr.size()); }
 
   int _max_test_level;
+  bool _pack_channels;
+  bool _pack_int16;
   std::vector<UniquePointer<DenseDescriptor>> _desc_pyr;
+  ImagePyramid _image_pyramid;
 }; // DenseDescriptorPyramid::Impl
 
 DenseDescriptorPyramid::DenseDescriptorPyramid(const AlgorithmParameters& p)
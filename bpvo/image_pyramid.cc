@@ -20,7 +20,7 @@
  */
 
 #include "bpvo/image_pyramid.h"
-#include <opencv2/imgproc/imgproc.hpp>
+#include "bpvo/imgproc.h"
 
 namespace bpvo {
 
@@ -45,8 +45,9 @@ void ImagePyramid::compute(const cv::Mat& I)
   assert( !_pyr.empty() );
   _pyr[0] = I; //.clone();
 
+  // the levels are allocated once and reused if the image size does not change
   for(size_t i = 1; i < _pyr.size(); ++i)
-    cv::pyrDown(_pyr[i-1], _pyr[i]);
+    bpvo::pyrDown(_pyr[i-1], _pyr[i], _buffer);
 }
 
 } // bpvo
@@ -55,6 +55,7 @@ class ImagePyramid
 
  protected:
   std::vector<cv::Mat> _pyr;
+  cv::Mat _buffer; //< scratch space for pyrDown
 }; // ImagePyramid
 
 }; // bpvo
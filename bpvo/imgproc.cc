@@ -22,6 +22,7 @@
 #include "bpvo/imgproc.h"
 #include "bpvo/debug.h"
 #include "bpvo/simd.h"
+#include "bpvo/utils.h"
 
 #include <opencv2/imgproc/imgproc.hpp>
 
@@ -177,6 +178,154 @@ cv::Mat imsmooth(const cv::Mat& src, double sigma)
   return ret;
 }
 
+template <typename T> static FORCE_INLINE T CastFromFloat(float);
+template <> FORCE_INLINE float CastFromFloat<float>(float v) { return v; }
+template <> FORCE_INLINE uint8_t CastFromFloat<uint8_t>(float v)
+{
+  return cv::saturate_cast<uint8_t>(v);
+}
+
+/**
+ * horizontal pass of a symmetric kernel with radius r
+ */
+template <typename T> static inline
+void gaussianBlurRow(const T* src, int cols, const float* k, int r, float* dst)
+{
+  const int x0 = std::min(r, cols), x1 = std::max(x0, cols - r);
+
+  for(int x = 0; x < x0; ++x) {
+    float v = k[r] * src[x];
+    for(int j = 1; j <= r; ++j)
+      v += k[r+j] * (src[borderReflect101(x-j, cols)] + src[borderReflect101(x+j, cols)]);
+    dst[x] = v;
+  }
+
+  for(int x = x0; x < x1; ++x) {
+    float v = k[r] * src[x];
+    for(int j = 1; j <= r; ++j)
+      v += k[r+j] * (src[x-j] + src[x+j]);
+    dst[x] = v;
+  }
+
+  for(int x = x1; x < cols; ++x) {
+    float v = k[r] * src[x];
+    for(int j = 1; j <= r; ++j)
+      v += k[r+j] * (src[borderReflect101(x-j, cols)] + src[borderReflect101(x+j, cols)]);
+    dst[x] = v;
+  }
+}
+
+template <typename T> static inline
+void gaussianBlur(const cv::Mat& src, cv::Mat& dst, const float* k, int r, cv::Mat& buffer)
+{
+  const int rows = src.rows, cols = src.cols, ksize = 2*r + 1;
+
+  // ring buffer of horizontally filtered rows. Output row y needs the input
+  // rows in [y-r, y+r], which map to distinct slots. The input row y is
+  // consumed before output row y is written, hence src may be the same as dst
+  buffer.create(ksize, cols, CV_32FC1);
+  dst.create(rows, cols, src.type());
+
+  const float* rp[7];
+  for(int y = 0, n_done = 0; y < rows; ++y)
+  {
+    for( ; n_done < std::min(y + r + 1, rows); ++n_done)
+      gaussianBlurRow(src.ptr<T>(n_done), cols, k, r, buffer.ptr<float>(n_done % ksize));
+
+    for(int j = 0; j < ksize; ++j)
+      rp[j] = buffer.ptr<float>(borderReflect101(y + j - r, rows) % ksize);
+
+    T* d = dst.ptr<T>(y);
+    for(int x = 0; x < cols; ++x) {
+      float v = k[r] * rp[r][x];
+      for(int j = 1; j <= r; ++j)
+        v += k[r+j] * (rp[r-j][x] + rp[r+j][x]);
+      d[x] = CastFromFloat<T>(v);
+    }
+  }
+}
+
+void gaussianKernel(int ksize, float sigma, float* k)
+{
+  // same as cv::getGaussianKernel for sigma > 0
+  const int r = ksize / 2;
+  double sum = 0.0;
+  for(int i = 0; i < ksize; ++i) {
+    const double x = i - r;
+    k[i] = std::exp(-x*x / (2.0 * sigma * sigma));
+    sum += k[i];
+  }
+  for(int i = 0; i < ksize; ++i)
+    k[i] /= sum;
+}
+
+void gaussianBlur(const cv::Mat& src, cv::Mat& dst, int ksize, float sigma, cv::Mat& buffer)
+{
+  THROW_ERROR_IF( !(ksize & 1) || ksize > 7, "ksize must be odd and <= 7" );
+  THROW_ERROR_IF( sigma <= 0.0f, "sigma must be > 0" );
+
+  float k[7];
+  const int r = ksize / 2;
+  gaussianKernel(ksize, sigma, k);
+
+  switch(src.type())
+  {
+    case CV_8UC1: gaussianBlur<uint8_t>(src, dst, k, r, buffer); break;
+    case CV_32FC1: gaussianBlur<float>(src, dst, k, r, buffer); break;
+    default: THROW_ERROR("unsupported image type");
+  }
+}
+
+void pyrDown(const cv::Mat& src, cv::Mat& dst, cv::Mat& buffer)
+{
+  if(src.type() != CV_8UC1) {
+    cv::pyrDown(src, dst);
+    return;
+  }
+
+  const int rows = src.rows, cols = src.cols;
+  const int d_rows = (rows + 1) / 2, d_cols = (cols + 1) / 2;
+
+  // the buffer is shared by all levels of a pyramid, hence it is reallocated
+  // only when it is too small and the rows are addressed with a d_cols stride
+  if(buffer.type() != CV_32SC1 || !buffer.isContinuous() ||
+     buffer.total() < (size_t) rows * d_cols)
+    buffer.create(rows, d_cols, CV_32SC1);
+
+  int* buf = buffer.ptr<int>();
+
+  // horizontal [1 4 6 4 1] at the even columns, then vertical at the even rows
+  for(int y = 0; y < rows; ++y)
+  {
+    const uint8_t* s = src.ptr<uint8_t>(y);
+    int* b = buf + y*d_cols;
+    for(int x = 0; x < d_cols; ++x)
+    {
+      const int c = 2*x;
+      if(c >= 2 && c + 2 < cols)
+        b[x] = s[c-2] + 4*(s[c-1] + s[c+1]) + 6*s[c] + s[c+2];
+      else
+        b[x] = s[borderReflect101(c-2, cols)] + 6*s[c] + s[borderReflect101(c+2, cols)] +
+            4*(s[borderReflect101(c-1, cols)] + s[borderReflect101(c+1, cols)]);
+    }
+  }
+
+  dst.create(d_rows, d_cols, CV_8UC1);
+  for(int y = 0; y < d_rows; ++y)
+  {
+    const int r = 2*y;
+    const int* b0 = buf + borderReflect101(r-2, rows)*d_cols;
+    const int* b1 = buf + borderReflect101(r-1, rows)*d_cols;
+    const int* b2 = buf + r*d_cols;
+    const int* b3 = buf + borderReflect101(r+1, rows)*d_cols;
+    const int* b4 = buf + borderReflect101(r+2, rows)*d_cols;
+
+    uint8_t* d = dst.ptr<uint8_t>(y);
+    for(int x = 0; x < d_cols; ++x)
+      d[x] = (b0[x] + 4*(b1[x] + b3[x]) + 6*b2[x] + b4[x] + 128) >> 8;
+  }
+}
+
 }; // bpvo
 
 
@@ -62,6 +62,47 @@ void gradientAbsoluteMagnitudeAcc(const cv::Mat_<float>& src, float* dst);
 void imsmooth(const cv::Mat& src, cv::Mat& dst, double sigma);
 cv::Mat imsmooth(const cv::Mat& src, double sigma);
 
+/**
+ * fills k with the ksize taps of a Gaussian with std. dev sigma > 0, the same
+ * as cv::getGaussianKernel
+ */
+void gaussianKernel(int ksize, float sigma, float* k);
+
+/**
+ * Gaussian smoothing with a separable ksize x ksize kernel with std. dev sigma.
+ * The kernel and the border (reflect 101) are the same as cv::GaussianBlur
+ *
+ * Supports CV_8UC1 and CV_32FC1 images, ksize must be odd and at most 7. Unlike
+ * cv::GaussianBlur, there are no memory allocations once dst and buffer have
+ * been allocated. The buffer holds ksize filtered rows only.
+ *
+ * src and dst may be the same image
+ */
+void gaussianBlur(const cv::Mat& src, cv::Mat& dst, int ksize, float sigma,
+                  cv::Mat& buffer);
+
+/**
+ * Same as cv::pyrDown for CV_8UC1 images, without memory allocations once dst
+ * and buffer have been allocated. Other image types are passed to cv::pyrDown
+ */
+void pyrDown(const cv::Mat& src, cv::Mat& dst, cv::Mat& buffer);
+
+/**
+ * \return the index i reflected into [0, n) as in cv::BORDER_REFLECT_101
+ */
+static inline int borderReflect101(int i, int n)
+{
+  if(n == 1)
+    return 0;
+
+  while(i < 0 || i >= n) {
+    if(i < 0) i = -i;
+    if(i >= n) i = 2*n - 2 - i;
+  }
+
+  return i;
+}
+
 
 /**
  * allows to subsample the disparities using a pyramid level
@@ -5,6 +5,15 @@
 
 namespace bpvo {
 
+/**
+ * floor with SSE2 only, x must be in the range of int
+ */
+static inline __m128 Floor(__m128 x)
+{
+  const __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+  return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, x), _mm_set1_ps(1.0f)));
+}
+
 struct CameraProjection
 {
   CameraProjection(const float* P_matrix)
@@ -64,7 +73,7 @@ int computeInterpCoeffs(const float* uv, int N, float* c)
   for(i = 0; i <= N - 4; i += 4)
   {
     xf = _mm_load_ps(uv + 4*i);
-    xi = _mm_floor_ps(xf);
+    xi = Floor(xf);
     xf = _mm_sub_ps(xf, xi);
 
     wx = _mm_sub_ps(ONES, xf);
@@ -79,7 +88,7 @@ int computeInterpCoeffs(const float* uv, int N, float* c)
     _mm_store_ps(c + 4*i + 4, _mm_mul_ps(xx, yy));
 
     xf = _mm_load_ps(uv + 4*i + 4);
-    xi = _mm_floor_ps(xf);
+    xi = Floor(xf);
     xf = _mm_sub_ps(xf, xi);
 
     wx = _mm_sub_ps(ONES, xf);
@@ -128,7 +137,7 @@ void imwarp_init_sse4(const ImageSize& image_size, const float* P_matrix,
 
     xf0 = proj(p);
 
-    xi0 = _mm_floor_ps(xf0);
+    xi0 = Floor(xf0);
     xf0 = _mm_sub_ps(xf0, xi0);
 
     wx0 = _mm_sub_ps(ONES, xf0);
@@ -145,7 +154,7 @@ void imwarp_init_sse4(const ImageSize& image_size, const float* P_matrix,
     _mm_store_si128((__m128i*) buf, _mm_cvtps_epi32(xi0));
 
     xf1 = proj(p + 8);
-    xi1 = _mm_floor_ps(xf1);
+    xi1 = Floor(xf1);
     xf1 = _mm_sub_ps(xf1, xi1);
 
     wx1 = _mm_sub_ps(ONES, xf1);
@@ -30,16 +30,17 @@ namespace bpvo {
 
 void IntensityDescriptor::compute(const cv::Mat& src)
 {
+  // convert directly into _I, which is reused between frames of the same size
   if(src.channels() == 3) {
-    cv::cvtColor(src, _I, CV_BGR2GRAY);
+    cv::cvtColor(src, _gray, CV_BGR2GRAY);
+    _gray.convertTo(_I, CV_32FC1);
   } else if(src.channels() == 4) {
-    cv::cvtColor(src, _I, CV_BGRA2GRAY);
+    cv::cvtColor(src, _gray, CV_BGRA2GRAY);
+    _gray.convertTo(_I, CV_32FC1);
   } else {
     THROW_ERROR_IF( src.channels() != 1, "unsupported image type" );
-    _I = src;
+    src.convertTo(_I, CV_32FC1);
   }
-
-  _I.convertTo(_I, CV_32FC1);
 }
 
 void IntensityDescriptor::computeSaliencyMap(cv::Mat& dst) const
@@ -68,6 +68,7 @@ class IntensityDescriptor : public DenseDescriptor
 
  protected:
   cv::Mat_<float> _I;
+  cv::Mat _gray; //< buffer for color input
 }; // IntensityDescriptor
 
 }; // bpvo
@@ -0,0 +1,376 @@
+/*
+   This file is part of bpvo.
+
+   bpvo is free software: you can redistribute it and/or modify
+   it under the terms of the Lesser GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   bpvo is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   Lesser GNU General Public License for more details.
+
+   You should have received a copy of the Lesser GNU General Public License
+   along with bpvo.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/*
+ * Contributor: halismai@cs.cmu.edu
+ */
+
+#include "bpvo/interp_avx2.h"
+#include "bpvo/cpu_features.h"
+#include "bpvo/debug.h"
+
+#include <immintrin.h>
+
+namespace bpvo {
+
+bool HasBilinearAvx2() { return HasSimdLevel(kSimdAVX2); }
+
+#if defined(__x86_64__) || defined(__i386__)
+
+namespace {
+
+static constexpr int PrefetchDistance = 32;
+
+/**
+ * loads 8 valid flags as an all-ones/zero mask
+ */
+TARGET_ISA("avx2,fma") static inline
+__m256i LoadValidMask(const uint16_t* v)
+{
+  const __m256i m = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*) v));
+  return _mm256_xor_si256(_mm256_cmpeq_epi32(m, _mm256_setzero_si256()),
+                          _mm256_set1_epi32(-1));
+}
+
+TARGET_ISA("avx2,fma") static inline
+__m256i LoadValidMask(const uint8_t* v)
+{
+  const __m256i m = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*) v));
+  return _mm256_xor_si256(_mm256_cmpeq_epi32(m, _mm256_setzero_si256()),
+                          _mm256_set1_epi32(-1));
+}
+
+/**
+ * the four taps of 8 points and their interpolation coefficients
+ */
+struct Taps
+{
+  __m256i i00, i01, i10, i11;
+  __m256 ax, ay, mask;
+}; // Taps
+
+TARGET_ISA("avx2,fma") static inline
+void LoadTaps(Taps& t, int stride, const int* inds, const float* xf, const float* yf,
+              const typename ValidVector::value_type* valid)
+{
+  const __m256i one = _mm256_set1_epi32(1);
+
+  // invalid points may index outside the image, they are not gathered
+  t.mask = _mm256_castsi256_ps(LoadValidMask(valid));
+  t.i00 = _mm256_loadu_si256((const __m256i*) inds);
+  t.i01 = _mm256_add_epi32(t.i00, one);
+  t.i10 = _mm256_add_epi32(t.i00, _mm256_set1_epi32(stride));
+  t.i11 = _mm256_add_epi32(t.i10, one);
+  t.ax = _mm256_loadu_ps(xf);
+  t.ay = _mm256_loadu_ps(yf);
+}
+
+TARGET_ISA("avx2,fma") static inline
+__m256 Residuals(const Taps& t, const float* I1, const float* I0)
+{
+  const __m256 z = _mm256_setzero_ps();
+  const __m256 I00 = _mm256_mask_i32gather_ps(z, I1, t.i00, t.mask, 4);
+  const __m256 I01 = _mm256_mask_i32gather_ps(z, I1, t.i01, t.mask, 4);
+  const __m256 I10 = _mm256_mask_i32gather_ps(z, I1, t.i10, t.mask, 4);
+  const __m256 I11 = _mm256_mask_i32gather_ps(z, I1, t.i11, t.mask, 4);
+
+  const __m256 top = _mm256_fmadd_ps(t.ax, _mm256_sub_ps(I01, I00), I00);
+  const __m256 bot = _mm256_fmadd_ps(t.ax, _mm256_sub_ps(I11, I10), I10);
+  const __m256 Iw = _mm256_fmadd_ps(t.ay, _mm256_sub_ps(bot, top), top);
+
+  return _mm256_blendv_ps(z, _mm256_sub_ps(Iw, _mm256_loadu_ps(I0)), t.mask);
+}
+
+TARGET_ISA("avx2,fma") static inline
+void Transpose8x8(__m256* v)
+{
+  const __m256 t0 = _mm256_unpacklo_ps(v[0], v[1]);
+  const __m256 t1 = _mm256_unpackhi_ps(v[0], v[1]);
+  const __m256 t2 = _mm256_unpacklo_ps(v[2], v[3]);
+  const __m256 t3 = _mm256_unpackhi_ps(v[2], v[3]);
+  const __m256 t4 = _mm256_unpacklo_ps(v[4], v[5]);
+  const __m256 t5 = _mm256_unpackhi_ps(v[4], v[5]);
+  const __m256 t6 = _mm256_unpacklo_ps(v[6], v[7]);
+  const __m256 t7 = _mm256_unpackhi_ps(v[6], v[7]);
+
+  const __m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1,0,1,0));
+  const __m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3,2,3,2));
+  const __m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1,0,1,0));
+  const __m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3,2,3,2));
+  const __m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1,0,1,0));
+  const __m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3,2,3,2));
+  const __m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1,0,1,0));
+  const __m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3,2,3,2));
+
+  v[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+  v[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+  v[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+  v[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+  v[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+  v[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+  v[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+  v[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+}
+
+/**
+ * interpolates the 8 channels of one point
+ */
+TARGET_ISA("avx2,fma") static inline
+__m256 InterpolatePacked(const float* p, int packed_stride, int row_stride, float xf, float yf)
+{
+  const __m256 I00 = _mm256_loadu_ps(p);
+  const __m256 I01 = _mm256_loadu_ps(p + packed_stride);
+  const __m256 I10 = _mm256_loadu_ps(p + row_stride);
+  const __m256 I11 = _mm256_loadu_ps(p + row_stride + packed_stride);
+
+  const __m256 ax = _mm256_set1_ps(xf);
+  const __m256 top = _mm256_fmadd_ps(ax, _mm256_sub_ps(I01, I00), I00);
+  const __m256 bot = _mm256_fmadd_ps(ax, _mm256_sub_ps(I11, I10), I10);
+  return _mm256_fmadd_ps(_mm256_set1_ps(yf), _mm256_sub_ps(bot, top), top);
+}
+
+/**
+ * number of fractional bits of the interpolation weights for the fixed point
+ * channels. Two taps weighted in 14 bits fit in int32 without overflow
+ */
+static constexpr int FixedPointWeightBits = 14;
+
+/**
+ * interpolates the 8 fixed point channels of one point
+ */
+TARGET_ISA("avx2,fma") static inline
+__m256 InterpolatePackedInt16(const int16_t* p, int packed_stride, int row_stride,
+                              float xf, float yf)
+{
+  // taps of x in A and of x+1 in B, the top row in the low lane
+  const __m256i A = _mm256_inserti128_si256(
+      _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*) p)),
+      _mm_loadu_si128((const __m128i*) (p + row_stride)), 1);
+  const __m256i B = _mm256_inserti128_si256(
+      _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*) (p + packed_stride))),
+      _mm_loadu_si128((const __m128i*) (p + row_stride + packed_stride)), 1);
+
+  const int w1 = static_cast<int>(xf * (1 << FixedPointWeightBits) + 0.5f);
+  const int w0 = (1 << FixedPointWeightBits) - w1;
+  const __m256i w = _mm256_set1_epi32((w1 << 16) | w0);
+
+  // channels 0-3 and 4-7 of the top row (low lane) and the bottom row
+  const __m256i h_lo = _mm256_madd_epi16(_mm256_unpacklo_epi16(A, B), w);
+  const __m256i h_hi = _mm256_madd_epi16(_mm256_unpackhi_epi16(A, B), w);
+
+  const __m256 top = _mm256_cvtepi32_ps(_mm256_permute2x128_si256(h_lo, h_hi, 0x20));
+  const __m256 bot = _mm256_cvtepi32_ps(_mm256_permute2x128_si256(h_lo, h_hi, 0x31));
+  return _mm256_fmadd_ps(_mm256_set1_ps(yf), _mm256_sub_ps(bot, top), top);
+}
+
+} // namespace
+
+TARGET_ISA("avx2,fma")
+int BilinearResidualsAvx2(const float* I1, int stride, const int* inds,
+                          const float* xf, const float* yf,
+                          const typename ValidVector::value_type* valid,
+                          const float* I0, float* r, int n)
+{
+  Taps t;
+  const int n8 = n & ~7;
+  for(int i = 0; i < n8; i += 8)
+  {
+    LoadTaps(t, stride, inds + i, xf + i, yf + i, valid + i);
+    _mm256_storeu_ps(r + i, Residuals(t, I1, I0 + i));
+  }
+
+  return n8;
+}
+
+TARGET_ISA("avx2,fma")
+int BilinearResidualsAvx2(const float* const* I1, int num_channels, int stride,
+                          const int* inds, const float* xf, const float* yf,
+                          const typename ValidVector::value_type* valid,
+                          const float* I0, int I0_stride, float* r, int r_stride, int n)
+{
+  Taps t;
+  const int n8 = n & ~7;
+  for(int i = 0; i < n8; i += 8)
+  {
+    // the points are roughly in raster order, fetch the rows of the points
+    // PrefetchDistance ahead in all channels
+    if(i + PrefetchDistance < n) {
+      const int k = inds[i + PrefetchDistance];
+      for(int c = 0; c < num_channels; ++c) {
+        _mm_prefetch((const char*) (I1[c] + k), _MM_HINT_T0);
+        _mm_prefetch((const char*) (I1[c] + k + stride), _MM_HINT_T0);
+      }
+    }
+
+    LoadTaps(t, stride, inds + i, xf + i, yf + i, valid + i);
+    for(int c = 0; c < num_channels; ++c)
+      _mm256_storeu_ps(r + c*r_stride + i, Residuals(t, I1[c], I0 + c*I0_stride + i));
+  }
+
+  return n8;
+}
+
+TARGET_ISA("avx2,fma")
+int BilinearResidualsPackedAvx2(const float* I1, int packed_stride, int num_channels,
+                                int stride, const int* inds, const float* xf,
+                                const float* yf, const typename ValidVector::value_type* valid,
+                                const float* I0, int I0_stride, float* r, int r_stride, int n)
+{
+  const int row_stride = stride * packed_stride;
+  const __m256 z = _mm256_setzero_ps();
+
+  __m256 v[8];
+  const int n8 = n & ~7;
+  for(int i = 0; i < n8; i += 8)
+  {
+    if(i + PrefetchDistance < n) {
+      const float* p = I1 + inds[i + PrefetchDistance] * packed_stride;
+      _mm_prefetch((const char*) p, _MM_HINT_T0);
+      _mm_prefetch((const char*) (p + row_stride), _MM_HINT_T0);
+    }
+
+    // one vector per point with the channels in the lanes. Invalid points have
+    // index 0 and are masked after the transpose
+    for(int j = 0; j < 8; ++j)
+      v[j] = InterpolatePacked(I1 + inds[i + j] * packed_stride, packed_stride,
+                               row_stride, xf[i + j], yf[i + j]);
+
+    Transpose8x8(v);
+
+    const __m256 mask = _mm256_castsi256_ps(LoadValidMask(valid + i));
+    for(int c = 0; c < num_channels; ++c)
+    {
+      const __m256 e = _mm256_sub_ps(v[c], _mm256_loadu_ps(I0 + c*I0_stride + i));
+      _mm256_storeu_ps(r + c*r_stride + i, _mm256_blendv_ps(z, e, mask));
+    }
+  }
+
+  return n8;
+}
+
+TARGET_ISA("avx2,fma")
+int PackChannelsAvx2(const float* const* src, int num_channels, int n,
+                     float* dst, int dst_stride)
+{
+  __m256 v[8];
+  const int n8 = n & ~7;
+  for(int i = 0; i < n8; i += 8)
+  {
+    for(int c = 0; c < 8; ++c)
+      v[c] = c < num_channels ? _mm256_loadu_ps(src[c] + i) : _mm256_setzero_ps();
+
+    Transpose8x8(v);
+    for(int j = 0; j < 8; ++j)
+      _mm256_storeu_ps(dst + (i + j)*dst_stride, v[j]);
+  }
+
+  return n8;
+}
+
+TARGET_ISA("avx2,fma")
+int BilinearResidualsPackedInt16Avx2(const int16_t* I1, float inv_scale, int packed_stride,
+                                     int num_channels, int stride, const int* inds,
+                                     const float* xf, const float* yf,
+                                     const typename ValidVector::value_type* valid,
+                                     const float* I0, int I0_stride, float* r, int r_stride,
+                                     int n)
+{
+  const int row_stride = stride * packed_stride;
+  const __m256 z = _mm256_setzero_ps();
+  const __m256 s = _mm256_set1_ps(inv_scale / (1 << FixedPointWeightBits));
+
+  __m256 v[8];
+  const int n8 = n & ~7;
+  for(int i = 0; i < n8; i += 8)
+  {
+    if(i + PrefetchDistance < n) {
+      const int16_t* p = I1 + inds[i + PrefetchDistance] * packed_stride;
+      _mm_prefetch((const char*) p, _MM_HINT_T0);
+      _mm_prefetch((const char*) (p + row_stride), _MM_HINT_T0);
+    }
+
+    for(int j = 0; j < 8; ++j)
+      v[j] = InterpolatePackedInt16(I1 + inds[i + j] * packed_stride, packed_stride,
+                                    row_stride, xf[i + j], yf[i + j]);
+
+    Transpose8x8(v);
+
+    const __m256 mask = _mm256_castsi256_ps(LoadValidMask(valid + i));
+    for(int c = 0; c < num_channels; ++c)
+    {
+      const __m256 e = _mm256_fmsub_ps(v[c], s, _mm256_loadu_ps(I0 + c*I0_stride + i));
+      _mm256_storeu_ps(r + c*r_stride + i, _mm256_blendv_ps(z, e, mask));
+    }
+  }
+
+  return n8;
+}
+
+TARGET_ISA("avx2,fma")
+int PackChannelsInt16Avx2(const float* const* src, int num_channels, int n, float scale,
+                          int16_t* dst, int dst_stride)
+{
+  const __m256 s = _mm256_set1_ps(scale);
+
+  __m256 v[8];
+  const int n8 = n & ~7;
+  for(int i = 0; i < n8; i += 8)
+  {
+    for(int c = 0; c < 8; ++c)
+      v[c] = c < num_channels ? _mm256_mul_ps(_mm256_loadu_ps(src[c] + i), s) : _mm256_setzero_ps();
+
+    Transpose8x8(v);
+    for(int j = 0; j < 8; j += 2)
+    {
+      // packs interleaves the lanes, [j0-3 j+1_0-3 | j4-7 j+1_4-7]
+      const __m256i q = _mm256_permute4x64_epi64(_mm256_packs_epi32(
+              _mm256_cvtps_epi32(v[j]), _mm256_cvtps_epi32(v[j + 1])), _MM_SHUFFLE(3,1,2,0));
+      _mm_storeu_si128((__m128i*) (dst + (i + j)*dst_stride), _mm256_castsi256_si128(q));
+      _mm_storeu_si128((__m128i*) (dst + (i + j + 1)*dst_stride), _mm256_extracti128_si256(q, 1));
+    }
+  }
+
+  return n8;
+}
+
+#else
+
+int BilinearResidualsAvx2(const float*, int, const int*, const float*, const float*,
+                          const typename ValidVector::value_type*, const float*,
+                          float*, int) { return 0; }
+
+int BilinearResidualsAvx2(const float* const*, int, int, const int*, const float*,
+                          const float*, const typename ValidVector::value_type*,
+                          const float*, int, float*, int, int) { return 0; }
+
+int BilinearResidualsPackedAvx2(const float*, int, int, int, const int*, const float*,
+                                const float*, const typename ValidVector::value_type*,
+                                const float*, int, float*, int, int) { return 0; }
+
+int PackChannelsAvx2(const float* const*, int, int, float*, int) { return 0; }
+
+int BilinearResidualsPackedInt16Avx2(const int16_t*, float, int, int, int, const int*,
+                                     const float*, const float*,
+                                     const typename ValidVector::value_type*,
+                                     const float*, int, float*, int, int) { return 0; }
+
+int PackChannelsInt16Avx2(const float* const*, int, int, float, int16_t*, int) { return 0; }
+
+#endif
+
+}; // bpvo
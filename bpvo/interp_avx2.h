@@ -0,0 +1,122 @@
+/*
+   This file is part of bpvo.
+
+   bpvo is free software: you can redistribute it and/or modify
+   it under the terms of the Lesser GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   bpvo is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   Lesser GNU General Public License for more details.
+
+   You should have received a copy of the Lesser GNU General Public License
+   along with bpvo.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/*
+ * Contributor: halismai@cs.cmu.edu
+ */
+
+#ifndef BPVO_INTERP_AVX2_H
+#define BPVO_INTERP_AVX2_H
+
+#include <bpvo/types.h>
+
+namespace bpvo {
+
+/**
+ * Bilinear interpolation of the photometric error, 8 points at a time. The four
+ * taps are fetched with gathers and invalid points are masked out with a blend
+ *
+ * The kernel is compiled for AVX2/FMA regardless of the compiler flags, the
+ * caller must check HasBilinearAvx2() first.
+ *
+ * \param I1     the input image
+ * \param stride the image stride (in floats)
+ * \param inds   index of the top-left tap y*stride + x for each point
+ * \param xf     fractional part of x (SoA)
+ * \param yf     fractional part of y (SoA)
+ * \param valid  valid flags
+ * \param I0     template values
+ * \param r      output residuals I1(x) - I0
+ * \param n      number of points
+ *
+ * \return the number of points processed, n rounded down to a multiple of 8
+ */
+int BilinearResidualsAvx2(const float* I1, int stride, const int* inds,
+                          const float* xf, const float* yf,
+                          const typename ValidVector::value_type* valid,
+                          const float* I0, float* r, int n);
+
+/**
+ * Same as above for several channels sampled at the same points. The tap
+ * indices, coefficients and valid mask are loaded once per 8 points and used
+ * for every channel
+ *
+ * \param I1           the channels of the input image
+ * \param num_channels number of channels
+ * \param I0           template values, channel c starts at I0 + c*I0_stride
+ * \param r            output residuals, channel c starts at r + c*r_stride
+ */
+int BilinearResidualsAvx2(const float* const* I1, int num_channels, int stride,
+                          const int* inds, const float* xf, const float* yf,
+                          const typename ValidVector::value_type* valid,
+                          const float* I0, int I0_stride, float* r, int r_stride, int n);
+
+/**
+ * Same as above with the channels interleaved per pixel. The 8 channels of a
+ * tap are read with one load and the results of 8 points are transposed in
+ * registers. 8 floats are read per tap regardless of num_channels
+ *
+ * \param I1            packed channels, offset to the first channel to use
+ * \param packed_stride number of floats per pixel
+ * \param num_channels  number of channels to store, at most 8
+ */
+int BilinearResidualsPackedAvx2(const float* I1, int packed_stride, int num_channels,
+                                int stride, const int* inds, const float* xf,
+                                const float* yf, const typename ValidVector::value_type* valid,
+                                const float* I0, int I0_stride, float* r, int r_stride, int n);
+
+/**
+ * Interleaves up to 8 channels of n pixels, 8 pixels at a time with a
+ * transpose in registers. This is the layout used by the kernel above, the
+ * 8 floats of a pixel are written at dst + i*dst_stride and channels past
+ * num_channels are set to zero
+ *
+ * \return the number of pixels processed, n rounded down to a multiple of 8
+ */
+int PackChannelsAvx2(const float* const* src, int num_channels, int n,
+                     float* dst, int dst_stride);
+
+/**
+ * Same as BilinearResidualsPackedAvx2 with the channels in 16-bit fixed point.
+ * The horizontal interpolation is done with _mm256_madd_epi16 on 14-bit
+ * weights, the vertical one in floating point
+ *
+ * \param inv_scale converts the fixed point values to float
+ */
+int BilinearResidualsPackedInt16Avx2(const int16_t* I1, float inv_scale, int packed_stride,
+                                     int num_channels, int stride, const int* inds,
+                                     const float* xf, const float* yf,
+                                     const typename ValidVector::value_type* valid,
+                                     const float* I0, int I0_stride, float* r, int r_stride,
+                                     int n);
+
+/**
+ * Same as PackChannelsAvx2 with the output in 16-bit fixed point, i.e.
+ * round(value * scale) saturated to int16
+ */
+int PackChannelsInt16Avx2(const float* const* src, int num_channels, int n, float scale,
+                          int16_t* dst, int dst_stride);
+
+/**
+ * \return true if the CPU supports the kernels above
+ */
+bool HasBilinearAvx2();
+
+}; // bpvo
+
+#endif // BPVO_INTERP_AVX2_H
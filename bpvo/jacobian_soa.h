@@ -0,0 +1,106 @@
+/*
+   This file is part of bpvo.
+
+   bpvo is free software: you can redistribute it and/or modify
+   it under the terms of the Lesser GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   bpvo is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   Lesser GNU General Public License for more details.
+
+   You should have received a copy of the Lesser GNU General Public License
+   along with bpvo.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Contributor: halismai@cs.cmu.edu
+ */
+
+#ifndef BPVO_JACOBIAN_SOA_H
+#define BPVO_JACOBIAN_SOA_H
+
+#include <bpvo/types.h>
+#include <algorithm>
+
+namespace bpvo {
+
+/**
+ * Jacobians stored as DOF contiguous arrays, one per parameter (SoA).
+ *
+ * Each array is aligned and padded with zeros to a multiple of Padding points,
+ * such that SIMD code may load 8 or 16 consecutive points of a component
+ * without reading past the buffer
+ */
+template <int DOF>
+class JacobianSoA
+{
+ public:
+  static constexpr int Padding = 16;
+
+ public:
+  /**
+   * sets the number of points. The components are set to zero
+   */
+  inline void resize(int n)
+  {
+    _size = n;
+    _stride = Padding * ((n + Padding - 1) / Padding);
+    _data.assign(DOF * _stride, 0.0f);
+  }
+
+  /**
+   * reserves the storage for n points
+   */
+  inline void reserve(int n)
+  {
+    _data.reserve(DOF * Padding * ((n + Padding - 1) / Padding));
+  }
+
+  /**
+   * copies n Jacobians from an AoS array, where J[i].data() has DOF elements
+   */
+  template <class Jacobian> inline
+  void assign(const Jacobian* J, int n)
+  {
+    resize(n);
+    for(int i = 0; i < n; ++i)
+      set(i, J[i].data());
+  }
+
+  inline void clear() { _size = _stride = 0; _data.clear(); }
+
+  inline int size() const { return _size; }
+  inline bool empty() const { return _size == 0; }
+
+  /**
+   * \return the number of floats between the start of two components
+   */
+  inline int stride() const { return _stride; }
+
+  inline const float* component(int k) const { return _data.data() + k*_stride; }
+  inline       float* component(int k)       { return _data.data() + k*_stride; }
+
+  inline void set(int i, const float* J)
+  {
+    for(int k = 0; k < DOF; ++k)
+      _data[k*_stride + i] = J[k];
+  }
+
+  inline void get(int i, float* J) const
+  {
+    for(int k = 0; k < DOF; ++k)
+      J[k] = _data[k*_stride + i];
+  }
+
+ private:
+  typename AlignedVector<float>::type _data;
+  int _size = 0;
+  int _stride = 0;
+}; // JacobianSoA
+
+}; // bpvo
+
+#endif // BPVO_JACOBIAN_SOA_H
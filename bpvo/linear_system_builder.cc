@@ -21,6 +21,8 @@
 
 #include "bpvo/linear_system_builder.h"
 #include "bpvo/parallel.h"
+#include "bpvo/rank_update_avx2.h"
+#include "bpvo/task_scheduler.h"
 
 #define LINEAR_SYSTEM_PARALLEL 1
 #define DO_PARALLEL defined(WITH_TBB) && LINEAR_SYSTEM_PARALLEL
@@ -37,6 +39,77 @@
 
 namespace bpvo {
 
+/**
+ * adds the point with jacobian J, weight w and residual r to the packed
+ * hessian in data, the gradient G and the residuals norm
+ */
+static FORCE_INLINE
+void RankUpdate(const float* J, float w, float r, float* data, float* G, float& res_norm)
+{
+  float wR = w * r;
+
+#if defined(WITH_SIMD)
+  // this reduction is based on DVO SLAM by Christian Kerl.
+  /**
+   *  This file is part of dvo.
+   *
+   *  Copyright 2012 Christian Kerl <christian.kerl@in.tum.de> (Technical University of Munich)
+   *  For more information see <http://vision.in.tum.de/data/software/dvo>.
+   *
+   *  dvo is free software: you can redistribute it and/or modify
+   *  it under the terms of the GNU General Public License as published by
+   *  the Free Software Foundation, either version 3 of the License, or
+   *  (at your option) any later version.
+   *
+   *  dvo is distributed in the hope that it will be useful,
+   *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+   *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   *  GNU General Public License for more details.
+   *
+   *  You should have received a copy of the GNU General Public License
+   *  along with dvo.  If not, see <http://www.gnu.org/licenses/>.
+   */
+
+  __m128 wwww = _mm_set1_ps(w);
+  __m128 v1234 = _mm_loadu_ps(J);
+  __m128 v56xx = _mm_loadu_ps(J + 4);
+
+  __m128 v1212 = _mm_movelh_ps(v1234, v1234);
+  __m128 v3434 = _mm_movehl_ps(v1234, v1234);
+  __m128 v5656 = _mm_movelh_ps(v56xx, v56xx);
+
+  __m128 v1122 = _mm_mul_ps(wwww, _mm_unpacklo_ps(v1212, v1212));
+
+  _mm_store_ps(data + 0, _mm_add_ps(_mm_load_ps(data + 0), _mm_mul_ps(v1122, v1212)));
+  _mm_store_ps(data + 4, _mm_add_ps(_mm_load_ps(data + 4), _mm_mul_ps(v1122, v3434)));
+  _mm_store_ps(data + 8, _mm_add_ps(_mm_load_ps(data + 8), _mm_mul_ps(v1122, v5656)));
+
+  __m128 v3344 = _mm_mul_ps(wwww, _mm_unpacklo_ps(v3434, v3434));
+
+  _mm_store_ps(data + 12, _mm_add_ps(_mm_load_ps(data + 12), _mm_mul_ps(v3344, v3434)));
+  _mm_store_ps(data + 16, _mm_add_ps(_mm_load_ps(data + 16), _mm_mul_ps(v3344, v5656)));
+
+  __m128 v5566 = _mm_mul_ps(wwww, _mm_unpacklo_ps(v5656, v5656));
+  _mm_store_ps(data + 20, _mm_add_ps(_mm_load_ps(data + 20), _mm_mul_ps(v5566, v5656)));
+
+  __m128 g1 = _mm_load_ps(G);
+  __m128 g2 = _mm_load_ps(G + 4);
+  __m128 wr = _mm_mul_ps(wwww, _mm_set1_ps(r));
+
+  _mm_store_ps(G, _mm_add_ps(g1, _mm_mul_ps(wr, v1234)));
+  _mm_store_ps(G+4, _mm_add_ps(g2, _mm_mul_ps(wr, v56xx)));
+
+#else
+  typedef LinearSystemBuilder::Hessian Hessian;
+  typedef LinearSystemBuilder::Gradient Gradient;
+  typedef Eigen::Map<const Gradient> JacobianMap;
+  Eigen::Map<Hessian>(data).noalias() += w * JacobianMap(J) * JacobianMap(J).transpose();
+  Eigen::Map<Gradient>(G).noalias() += wR * JacobianMap(J);
+#endif
+
+  res_norm += wR * r;
+}
+
 class LinearSystemBuilderReduction
 {
  public:
@@ -63,7 +136,7 @@ class LinearSystemBuilderReduction
                    const ResidualsVector& W, const ValidVector& V,
                    Hessian* H = nullptr, Gradient* G = nullptr);
 
-  FORCE_INLINE void rankUpdatePoint(int i, float* H_data, float* G_data, float& res_norm);
+  FORCE_INLINE void rankUpdate(int begin, int end, float* H_data, float* G_data, float& res_norm);
 
  protected:
   const JacobianVector& _J;
@@ -77,8 +150,8 @@ class LinearSystemBuilderReduction
 
   void setZero();
 
+ public:
   static Hessian toEigen(const float*);
-
 }; // LinearSystemBuilderReduction
 
 LinearSystemBuilderReduction::
@@ -117,8 +190,7 @@ void LinearSystemBuilderReduction::operator()(const tbb::blocked_range<int>& ran
   std::fill_n(G_data, 8, 0.0f);
 
   float res_sq_norm = 0.0f;
-  for(int i = range.begin(); i != range.end(); ++i)
-      rankUpdatePoint(i, h_data, G_data, res_sq_norm);
+  rankUpdate(range.begin(), range.end(), h_data, G_data, res_sq_norm);
 
 #if defined(WITH_SIMD)
   _H.noalias() += LinearSystemBuilderReduction::toEigen(h_data);
@@ -138,70 +210,18 @@ void LinearSystemBuilderReduction::setZero()
 }
 
 FORCE_INLINE void LinearSystemBuilderReduction::
-rankUpdatePoint(int i, float* data, float* G, float& res_norm)
+rankUpdate(int begin, int end, float* data, float* G, float& res_norm)
 {
-  float w = _W[i] * static_cast<float>( _valid[i] );
-  float wR = w *_R[i];
-
-#if defined(WITH_SIMD)
-  // this reduction is based on DVO SLAM by Christian Kerl.
-  /**
-   *  This file is part of dvo.
-   *
-   *  Copyright 2012 Christian Kerl <christian.kerl@in.tum.de> (Technical University of Munich)
-   *  For more information see <http://vision.in.tum.de/data/software/dvo>.
-   *
-   *  dvo is free software: you can redistribute it and/or modify
-   *  it under the terms of the GNU General Public License as published by
-   *  the Free Software Foundation, either version 3 of the License, or
-   *  (at your option) any later version.
-   *
-   *  dvo is distributed in the hope that it will be useful,
-   *  but WITHOUT ANY WARRANTY; without even the implied warranty of
-   *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
-   *  GNU General Public License for more details.
-   *
-   *  You should have received a copy of the GNU General Public License
-   *  along with dvo.  If not, see <http://www.gnu.org/licenses/>.
-   */
-
-  __m128 wwww = _mm_set1_ps(w);
-  __m128 v1234 = _mm_loadu_ps(_J[i].data());
-  __m128 v56xx = _mm_loadu_ps(_J[i].data() + 4);
-
-  __m128 v1212 = _mm_movelh_ps(v1234, v1234);
-  __m128 v3434 = _mm_movehl_ps(v1234, v1234);
-  __m128 v5656 = _mm_movelh_ps(v56xx, v56xx);
-
-  __m128 v1122 = _mm_mul_ps(wwww, _mm_unpacklo_ps(v1212, v1212));
-
-  _mm_store_ps(data + 0, _mm_add_ps(_mm_load_ps(data + 0), _mm_mul_ps(v1122, v1212)));
-  _mm_store_ps(data + 4, _mm_add_ps(_mm_load_ps(data + 4), _mm_mul_ps(v1122, v3434)));
-  _mm_store_ps(data + 8, _mm_add_ps(_mm_load_ps(data + 8), _mm_mul_ps(v1122, v5656)));
-
-  __m128 v3344 = _mm_mul_ps(wwww, _mm_unpacklo_ps(v3434, v3434));
-
-  _mm_store_ps(data + 12, _mm_add_ps(_mm_load_ps(data + 12), _mm_mul_ps(v3344, v3434)));
-  _mm_store_ps(data + 16, _mm_add_ps(_mm_load_ps(data + 16), _mm_mul_ps(v3344, v5656)));
-
-  __m128 v5566 = _mm_mul_ps(wwww, _mm_unpacklo_ps(v5656, v5656));
-  _mm_store_ps(data + 20, _mm_add_ps(_mm_load_ps(data + 20), _mm_mul_ps(v5566, v5656)));
-
-  __m128 g1 = _mm_load_ps(G);
-  __m128 g2 = _mm_load_ps(G + 4);
-  __m128 wr = _mm_mul_ps(wwww, _mm_set1_ps(_R[i]));
-
-  _mm_store_ps(G, _mm_add_ps(g1, _mm_mul_ps(wr, v1234)));
-  _mm_store_ps(G+4, _mm_add_ps(g2, _mm_mul_ps(wr, v56xx)));
-
-#else
-  typedef Eigen::Map<Hessian, Eigen::Aligned> HessianMap;
-  typedef Eigen::Map<Gradient, Eigen::Aligned> GradientMap;
-  HessianMap(data).noalias() += _W[i] * _J[i].transpose() * _J[i];
-  GradientMap(G).noalias() += wR[i] * _J[i].transpose();
-#endif
-
-  res_norm += wR * _R[i];
+  // the valid flags are per point and shared by all channels. off is the
+  // index of the first residual of the channel
+  const int n = static_cast<int>(_valid.size());
+  for(int off = (begin / n) * n; off < end; off += n)
+  {
+    const int e = std::min(end, off + n);
+    for(int i = std::max(begin, off); i < e; ++i)
+      RankUpdate(_J[i].data(), _W[i] * static_cast<float>(_valid[i - off]), _R[i],
+                 data, G, res_norm);
+  }
 }
 
 auto LinearSystemBuilderReduction::toEigen(const float* data) -> Hessian
@@ -220,11 +240,52 @@ auto LinearSystemBuilderReduction::toEigen(const float* data) -> Hessian
   return ret;
 }
 
+#if !(defined(WITH_TBB) && LINEAR_SYSTEM_PARALLEL)
+namespace {
+
+static constexpr int MaxReductionChunks = 64;
+static constexpr int MinPointsPerReductionChunk = 4096;
+
+/**
+ * a range of points reduced by one task of the TaskScheduler
+ */
+struct ReductionChunk
+{
+  ALIGNED(16) float H[36]; // 24 are used with SIMD
+  ALIGNED(16) float G[8];
+  float res_sq_norm;
+
+  LinearSystemBuilderReduction* reduction;
+  Range range;
+
+  inline ReductionChunk() : res_sq_norm(0.0f), reduction(nullptr), range(0, 0)
+  {
+    std::fill_n(H, 36, 0.0f);
+    std::fill_n(G, 8, 0.0f);
+  }
+
+  inline void add(const ReductionChunk& o)
+  {
+    for(int i = 0; i < 36; ++i) H[i] += o.H[i];
+    for(int i = 0; i < 8; ++i) G[i] += o.G[i];
+    res_sq_norm += o.res_sq_norm;
+  }
+
+  static void Run(void* chunk, int)
+  {
+    auto c = static_cast<ReductionChunk*>(chunk);
+    c->reduction->rankUpdate(c->range.begin(), c->range.end(), c->H, c->G, c->res_sq_norm);
+  }
+}; // ReductionChunk
+
+} // namespace
+#endif
+
 float LinearSystemBuilderReduction::
 Run(const JacobianVector& J, const ResidualsVector& R, const ResidualsVector& W,
     const ValidVector& V, Hessian* H, Gradient* G)
 {
-  assert( R.size() == W.size() && R.size() == V.size() );
+  assert( R.size() == W.size() && !V.empty() && R.size() % V.size() == 0 );
   assert( J.size()-1 && R.size() );
 
   if(H && G) {
@@ -236,47 +297,57 @@ Run(const JacobianVector& J, const ResidualsVector& R, const ResidualsVector& W,
     *G = reduction.gradient();
     return reduction.residualsSquaredNorm();
 #else
-    H->setZero();
-    G->setZero();
-    float ret = 0.0f;
-
-    float* h_data = nullptr;
-
-#if defined(WITH_SIMD)
-    ALIGNED(16) float data[24];
-    std::fill_n(data, 24, 0.0f);
-    h_data = data;
-#else
-    h_data = H->data();
-#endif
-
-    ALIGNED(16) float G_data[8];
-    std::fill_n(G_data, 8, 0.0f);
-
-    for(size_t i = 0; i < R.size(); ++i) {
-      reduction.rankUpdatePoint(i, h_data, G_data, ret);
+    const int n = static_cast<int>(R.size());
+    const int n_chunks = std::max(1, std::min(
+            std::min(TaskScheduler::Instance().numThreads(), MaxReductionChunks),
+            LINEAR_SYSTEM_PARALLEL ? n / MinPointsPerReductionChunk : 1));
+
+    // each chunk accumulates into its own buffers, then we sum the chunks
+    ReductionChunk chunks[MaxReductionChunks];
+    {
+      TaskGroup group;
+      for(int c = 0; c < n_chunks; ++c)
+      {
+        chunks[c].reduction = &reduction;
+        chunks[c].range = Range((c*n) / n_chunks, ((c+1)*n) / n_chunks);
+        if(c > 0)
+          group.run(&ReductionChunk::Run, &chunks[c], 0);
+      }
+
+      ReductionChunk::Run(&chunks[0], 0);
+      group.wait();
     }
 
+    for(int c = 1; c < n_chunks; ++c)
+      chunks[0].add(chunks[c]);
+
+    const float* h_data = chunks[0].H;
 #if defined(WITH_SIMD)
     *H = LinearSystemBuilderReduction::toEigen(h_data);
+#else
+    memcpy(H->data(), h_data, 36 * sizeof(float));
 #endif
 
-    memcpy(G->data(), G_data, 6 * sizeof(float));
+    memcpy(G->data(), chunks[0].G, 6 * sizeof(float));
 
-    return ret;
+    return chunks[0].res_sq_norm;
 #endif
   } else {
     // for sum of squares, it is faster to not parallarize
     auto ret = 0.0f;
-    const auto* r_ptr = R.data();
-    const auto* w_ptr = W.data();
     const auto* v_ptr = V.data();
+    const size_t n = V.size();
+    for(size_t off = 0; off < R.size(); off += n)
+    {
+      const auto* r_ptr = R.data() + off;
+      const auto* w_ptr = W.data() + off;
 
 #if defined(WITH_OPENMP)
 #pragma omp simd
 #endif
-    for(size_t i = 0; i < R.size(); ++i) {
+      for(size_t i = 0; i < n; ++i) {
         ret += static_cast<float>(v_ptr[i]) * w_ptr[i] * r_ptr[i] * r_ptr[i];
+      }
     }
 
     return ret;
@@ -314,32 +385,85 @@ static inline void getValidResiduals(const std::vector<uint8_t>& valid,
 #undef USE_ALL_DATA
 }
 
-/**
- * makes the valid vector flags the same size as the number of residuals
- * NC is the number of channels of the descriptor
- */
-static inline
-ValidVector makeValidFlags(const ValidVector& v, int NC = 8)
+NormalEquationsAccumulator::NormalEquationsAccumulator()
+  : _res_sq_norm(0.0f)
 {
-  ValidVector ret(v.size()*NC);
-  auto* p = ret.data();
+  std::fill_n(_H, 36, 0.0f);
+  std::fill_n(_G, 8, 0.0f);
+  std::fill_n(_H_upper, 21, 0.0f);
+}
 
-  for(int b = 0; b < NC; ++b)
-    for(size_t i = 0; i < v.size(); ++i)
-      *p++ = v[i];
+bool NormalEquationsAccumulator::SupportsSoA()
+{
+  return HasRankUpdateAvx2();
+}
 
-  return ret;
+void NormalEquationsAccumulator::
+add(const Jacobian* J, const float* residuals, const float* weights, int n)
+{
+  float res_sq_norm = 0.0f;
+  for(int i = 0; i < n; ++i)
+    RankUpdate(J[i].data(), weights[i], residuals[i], _H, _G, res_sq_norm);
+
+  _res_sq_norm += res_sq_norm;
+}
+
+void NormalEquationsAccumulator::
+add(const JacobianSoAType& J, int k, const float* residuals, const float* weights, int n)
+{
+  int i = 0;
+  if(SupportsSoA())
+  {
+    const float* J_k[6];
+    for(int c = 0; c < 6; ++c)
+      J_k[c] = J.component(c) + k;
+
+    i = RankUpdateAvx2(J_k, residuals, weights, n, _H_upper, _G, &_res_sq_norm);
+  }
+
+  float res_sq_norm = 0.0f;
+  for( ; i < n; ++i)
+  {
+    float J_i[8] = {0.0f}; // RankUpdate loads 8 floats
+    J.get(k + i, J_i);
+    RankUpdate(J_i, weights[i], residuals[i], _H, _G, res_sq_norm);
+  }
+
+  _res_sq_norm += res_sq_norm;
+}
+
+void NormalEquationsAccumulator::add(const NormalEquationsAccumulator& other)
+{
+  for(int i = 0; i < 36; ++i) _H[i] += other._H[i];
+  for(int i = 0; i < 8; ++i) _G[i] += other._G[i];
+  for(int i = 0; i < 21; ++i) _H_upper[i] += other._H_upper[i];
+  _res_sq_norm += other._res_sq_norm;
+}
+
+float NormalEquationsAccumulator::get(Hessian* H, Gradient* G) const
+{
+#if defined(WITH_SIMD)
+  *H = LinearSystemBuilderReduction::toEigen(_H);
+#else
+  memcpy(H->data(), _H, 36 * sizeof(float));
+#endif
+  memcpy(G->data(), _G, 6 * sizeof(float));
+
+  for(int i = 0, k = 0; i < 6; ++i)
+    for(int j = i; j < 6; ++j, ++k) {
+      (*H)(i, j) += _H_upper[k];
+      if(i != j)
+        (*H)(j, i) += _H_upper[k];
+    }
+
+  return _res_sq_norm;
 }
 
 float LinearSystemBuilder::Run(const JacobianVector& J, const ResidualsVector& residuals,
                                const ResidualsVector& weights, const ValidVector& valid,
                                Hessian* A, Gradient* b)
 {
-  auto nc = residuals.size() / valid.size();
-  assert( (J.size()-1) == residuals.size() && valid.size() == residuals.size()/nc );
-
-  auto valid2 = residuals.size() != valid.size() ? makeValidFlags(valid, nc) : valid;
-  assert( valid2.size() == residuals.size() );
+  assert( (J.size()-1) == residuals.size() && residuals.size() % valid.size() == 0 );
 
 #if defined(__AVX__)
   _mm256_zeroupper();
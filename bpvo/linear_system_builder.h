@@ -24,6 +24,7 @@
 
 #include <bpvo/types.h>
 #include <bpvo/warps.h>
+#include <bpvo/jacobian_soa.h>
 
 namespace bpvo {
 
@@ -42,9 +43,10 @@ class LinearSystemBuilder
    * \param J the jacobians per pixel
    * \param R the residuals
    * \param weighted M-estimator weights
-   * \param valid incidates which elements are valid. Invalid elements are the
+   * \param valid incidates which points are valid. Invalid points are the
    * ones that project outside the image and we do not need to add them to the
-   * optimization. NOTE: their weight will be 0
+   * optimization. NOTE: their weight will be 0. There is one flag per point,
+   * shared by all channels, i.e. residual k uses valid[k % valid.size()]
    *
    * \param H = J'*W*J
    * \param G = J'*W*R
@@ -56,6 +58,57 @@ class LinearSystemBuilder
 
 }; // LinearSystemBuilder
 
+/**
+ * Accumulates H = J'*W*J, G = J'*W*R and the weighted residuals squared norm a
+ * block of points at a time. Used to build the linear system in the same pass
+ * that computes the residuals and the weights
+ */
+class NormalEquationsAccumulator
+{
+ public:
+  typedef LinearSystemBuilder::Jacobian Jacobian;
+  typedef LinearSystemBuilder::Hessian  Hessian;
+  typedef LinearSystemBuilder::Gradient Gradient;
+  typedef JacobianSoA<6>                JacobianSoAType;
+
+ public:
+  NormalEquationsAccumulator();
+
+  /**
+   * adds n points. J must be readable for n+1 elements (see TemplateData)
+   */
+  void add(const Jacobian* J, const float* residuals, const float* weights, int n);
+
+  /**
+   * adds the n points starting at index k of J. Uses the AVX2/FMA kernel if
+   * SupportsSoA()
+   */
+  void add(const JacobianSoAType& J, int k, const float* residuals,
+           const float* weights, int n);
+
+  /**
+   * \return true if the CPU has the AVX2/FMA kernel for Jacobians in SoA. It
+   * is the faster option when available, otherwise use the AoS version
+   */
+  static bool SupportsSoA();
+
+  /**
+   * adds the results of another accumulator
+   */
+  void add(const NormalEquationsAccumulator&);
+
+  /**
+   * \return the weighted residuals squared norm
+   */
+  float get(Hessian* H, Gradient* G) const;
+
+ private:
+  alignas(16) float _H[36]; // packed upper triangle with SIMD
+  alignas(16) float _G[8];
+  float _H_upper[21];       // upper triangle, row major, from the SoA path
+  float _res_sq_norm;
+}; // NormalEquationsAccumulator
+
 }; // bpvo
 
 #endif // LINEAR_SYSTEM_BUILDER_H
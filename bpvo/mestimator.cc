@@ -20,11 +20,13 @@
  */
 
 #include "bpvo/mestimator.h"
-#include "bpvo/approximate_median.h"
+#include "bpvo/cpu_features.h"
 #include "bpvo/math_utils.h"
 #include "bpvo/utils.h"
 
 #include <algorithm>
+#include <cstring>
+#include <limits>
 
 #if defined(WITH_SIMD)
 #include <immintrin.h>
@@ -72,18 +74,6 @@ void computeWeights(const ResidualsVector& residuals, float sigma,
                  [=](float x) { return robust_fn(sigma_inv * x); });
 }
 
-template <class RobustFunction, class... Args> static inline
-void computeWeights(const ResidualsVector& residuals, const ValidVector& valid,
-                    float sigma, WeightsVector& weights, Args ... args)
-{
-  RobustFunction robust_fn(std::forward<Args>(args)...);
-
-  float sigma_inv = 1.0f / sigma;
-  for(size_t i = 0; i < valid.size(); ++i) {
-    weights[i] = valid[i] ? robust_fn(sigma_inv * residuals[i]) : 0.0f;
-  }
-}
-
 void MEstimator::
 ComputeWeights(LossFunctionType loss_func, const ResidualsVector& residuals,
                float sigma, WeightsVector& weights)
@@ -104,385 +94,436 @@ ComputeWeights(LossFunctionType loss_func, const ResidualsVector& residuals,
 
 #if defined(WITH_SIMD)
 
-#if defined(__AVX__)
-static const __m256 SIGN_MASK_PS = _mm256_set1_ps(-0.f);
-
-static FORCE_INLINE __m256 abs_ps(__m256 x) {
-  return _mm256_andnot_ps(SIGN_MASK_PS, x);
-}
+//
+// The weights are computed 8 (SSE) or 16 (AVX) at a time. The AVX versions are
+// compiled regardless of the compiler flags and used if the CPU supports them
+//
 
-static FORCE_INLINE __m256 set1_ps(float v)
+static inline int huber_sse(const float* r_ptr, float* w_ptr, int N,
+                            float sigma_inv, float huber_k)
 {
-  return _mm256_set1_ps(v);
-}
+  const __m128 s_inv = _mm_set1_ps(sigma_inv), h_k = _mm_set1_ps(huber_k),
+        sign_mask = _mm_set1_ps(-0.0f);
 
-static FORCE_INLINE __m256 load_ps(const float* ptr)
-{
-  return _mm256_load_ps(ptr);
-}
+  int i = 0;
+  for( ; i <= N - 8; i += 8) {
+    auto x0 = _mm_andnot_ps(sign_mask, _mm_mul_ps(_mm_loadu_ps(r_ptr + i + 0), s_inv));
+    auto x1 = _mm_andnot_ps(sign_mask, _mm_mul_ps(_mm_loadu_ps(r_ptr + i + 4), s_inv));
+    _mm_storeu_ps(w_ptr + i + 0, _mm_div_ps(h_k, _mm_max_ps(x0, h_k)));
+    _mm_storeu_ps(w_ptr + i + 4, _mm_div_ps(h_k, _mm_max_ps(x1, h_k)));
+  }
 
-static FORCE_INLINE __m256 loadu_ps(const float* ptr)
-{
-  return _mm256_loadu_ps(ptr);
+  return i;
 }
 
-static FORCE_INLINE __m256 sub_ps(__m256 a, __m256 b)
+TARGET_ISA("avx") static inline
+int huber_avx(const float* r_ptr, float* w_ptr, int N, float sigma_inv, float huber_k)
 {
-  return _mm256_sub_ps(a, b);
-}
+  const __m256 s_inv = _mm256_set1_ps(sigma_inv), h_k = _mm256_set1_ps(huber_k),
+        sign_mask = _mm256_set1_ps(-0.0f);
 
-static FORCE_INLINE __m256 cmplt_ps(__m256 a, __m256 b)
-{
-  return _mm256_cmp_ps(a, b, _CMP_LT_OQ);
+  int i = 0;
+  for( ; i <= N - 16; i += 16) {
+    auto x0 = _mm256_andnot_ps(sign_mask, _mm256_mul_ps(_mm256_loadu_ps(r_ptr + i + 0), s_inv));
+    auto x1 = _mm256_andnot_ps(sign_mask, _mm256_mul_ps(_mm256_loadu_ps(r_ptr + i + 8), s_inv));
+    _mm256_storeu_ps(w_ptr + i + 0, _mm256_div_ps(h_k, _mm256_max_ps(x0, h_k)));
+    _mm256_storeu_ps(w_ptr + i + 8, _mm256_div_ps(h_k, _mm256_max_ps(x1, h_k)));
+  }
+
+  _mm256_zeroupper();
+  return i;
 }
 
-static FORCE_INLINE __m256 mul_ps(__m256 a, __m256 b)
+static inline int tukey_sse(const float* r_ptr, float* w_ptr, int N,
+                            float sigma_inv, float tukey_t)
 {
-  return _mm256_mul_ps(a, b);
+  const __m128 s_inv = _mm_set1_ps(sigma_inv), ones = _mm_set1_ps(1.0f),
+        t = _mm_set1_ps(tukey_t), t_i = _mm_set1_ps(1.0f / tukey_t),
+        sign_mask = _mm_set1_ps(-0.0f);
+
+  int i = 0;
+  for( ; i <= N - 8; i += 8) {
+    for(int j = 0; j < 8; j += 4) {
+      auto x = _mm_mul_ps(_mm_loadu_ps(r_ptr + i + j), s_inv);
+      auto r = _mm_mul_ps(x, t_i);
+      r = _mm_sub_ps(ones, _mm_mul_ps(r, r));
+      r = _mm_mul_ps(r, r);
+      auto m = _mm_cmplt_ps(_mm_andnot_ps(sign_mask, x), t);
+      _mm_storeu_ps(w_ptr + i + j, _mm_and_ps(m, r));
+    }
+  }
+
+  return i;
 }
 
-static FORCE_INLINE __m256 div_ps(__m256 a, __m256 b)
+TARGET_ISA("avx") static inline
+int tukey_avx(const float* r_ptr, float* w_ptr, int N, float sigma_inv, float tukey_t)
 {
-  return _mm256_div_ps(a, b);
+  const __m256 s_inv = _mm256_set1_ps(sigma_inv), ones = _mm256_set1_ps(1.0f),
+        t = _mm256_set1_ps(tukey_t), t_i = _mm256_set1_ps(1.0f / tukey_t),
+        sign_mask = _mm256_set1_ps(-0.0f);
+
+  int i = 0;
+  for( ; i <= N - 16; i += 16) {
+    for(int j = 0; j < 16; j += 8) {
+      auto x = _mm256_mul_ps(_mm256_loadu_ps(r_ptr + i + j), s_inv);
+      auto r = _mm256_mul_ps(x, t_i);
+      r = _mm256_sub_ps(ones, _mm256_mul_ps(r, r));
+      r = _mm256_mul_ps(r, r);
+      auto m = _mm256_cmp_ps(_mm256_andnot_ps(sign_mask, x), t, _CMP_LT_OQ);
+      _mm256_storeu_ps(w_ptr + i + j, _mm256_and_ps(m, r));
+    }
+  }
+
+  _mm256_zeroupper();
+  return i;
 }
 
-static FORCE_INLINE __m256 and_ps(__m256 a, __m256 b)
+static inline int huber_simd(const float* r_ptr, float* w_ptr, int N,
+                             float sigma_inv, float huber_k)
 {
-  return _mm256_and_ps(a, b);
+  return HasSimdLevel(kSimdAVX) ? huber_avx(r_ptr, w_ptr, N, sigma_inv, huber_k) :
+      huber_sse(r_ptr, w_ptr, N, sigma_inv, huber_k);
 }
 
-static FORCE_INLINE void store_ps(float* ptr, __m256 a)
+static inline int tukey_simd(const float* r_ptr, float* w_ptr, int N,
+                             float sigma_inv, float tukey_t)
 {
-  _mm256_store_ps(ptr, a);
+  return HasSimdLevel(kSimdAVX) ? tukey_avx(r_ptr, w_ptr, N, sigma_inv, tukey_t) :
+      tukey_sse(r_ptr, w_ptr, N, sigma_inv, tukey_t);
 }
 
+#endif // WITH_SIMD
 
-static FORCE_INLINE void storeu_ps(float* ptr, __m256 a)
+void MEstimator::
+ComputeWeights(LossFunctionType loss_func, const ResidualsVector& residuals,
+               const ValidVector& valid, float sigma, WeightsVector& weights)
 {
-  _mm256_storeu_ps(ptr, a);
+  assert( !valid.empty() && residuals.size() % valid.size() == 0 );
+  weights.resize(residuals.size());
+
+  // the valid flags are per point and shared by all channels
+  const int n = static_cast<int>(valid.size());
+  for(size_t off = 0; off < residuals.size(); off += n)
+  {
+    auto* w_ptr = weights.data() + off;
+    ComputeWeights(loss_func, residuals.data() + off, n, sigma, w_ptr);
+    for(int i = 0; i < n; ++i)
+      w_ptr[i] *= static_cast<float>(valid[i]);
+  }
 }
 
-static FORCE_INLINE __m256 max_ps(__m256 a, __m256 b)
+void MEstimator::
+ComputeWeights(LossFunctionType loss_func, const float* residuals, int n,
+               float sigma, float* weights)
 {
-  return _mm256_max_ps(a, b);
+  const float sigma_inv = 1.0f / sigma;
+  int i = 0;
+
+  switch(loss_func) {
+    case LossFunctionType::kL2:
+      {
+        std::fill_n(weights, n, 1.0f);
+        i = n;
+      } break;
+    case LossFunctionType::kHuber:
+      {
+#if defined(WITH_SIMD)
+        i = huber_simd(residuals, weights, n, sigma_inv, 1.345f);
+#endif
+        HuberOp<float> func(1.345f);
+        for( ; i < n; ++i)
+          weights[i] = func(sigma_inv * residuals[i]);
+      } break;
+    case LossFunctionType::kTukey:
+      {
+#if defined(WITH_SIMD)
+        i = tukey_simd(residuals, weights, n, sigma_inv, 4.685f);
+#endif
+        TukeyOp<float> func(4.685f);
+        for( ; i < n; ++i)
+          weights[i] = func(sigma_inv * residuals[i]);
+      } break;
+    default: THROW_ERROR("unknown RobustFunction");
+  }
 }
 
-static const int SIMD_VECTOR_UNIT_SIZE = 8;
+namespace {
 
-#else
-//
-// SSE instructions
-//
-static const __m128 SIGN_MASK_PS = _mm_set1_ps(-0.0f);
+/*
+ * bins of the approximate median. The key of a positive float is its exponent
+ * followed by the first HistMantissaBits of its mantissa, hence there are
+ * 2^HistMantissaBits bins per octave, each 1.6% wide relative to its value.
+ * Values below 2^HistMinExponent go to the first bin, values above
+ * 2^HistMaxExponent go to the last
+ */
+constexpr int HistMantissaBits = 6;
+constexpr int HistShift = 23 - HistMantissaBits;
+constexpr int HistMinExponent = -12;
+constexpr int HistMaxExponent = 12;
+constexpr int HistFirstKey = (127 + HistMinExponent) << HistMantissaBits;
+constexpr int HistNumBins = (HistMaxExponent - HistMinExponent) << HistMantissaBits;
 
-static FORCE_INLINE __m128 abs_ps(__m128 x) {
-  return _mm_andnot_ps(SIGN_MASK_PS, x);
-}
+// the bin of the invalid points, it is not used for the median
+constexpr int HistInvalidBin = HistNumBins;
 
-static FORCE_INLINE __m128 load_ps(const float* ptr)
-{
-  return _mm_load_ps(ptr);
-}
+// consecutive samples are counted in different copies of the histogram, such
+// that the increments do not depend on each other
+constexpr int HistNumCopies = 4;
+constexpr int HistStride = HistNumBins + 1;
 
-static FORCE_INLINE __m128 loadu_ps(const float* ptr)
-{
-  return _mm_loadu_ps(ptr);
-}
+// number of bins computed at once, kept on the stack
+constexpr int HistChunkSize = 256;
 
-static FORCE_INLINE __m128 mul_ps(__m128 a, __m128 b)
-{
-  return _mm_mul_ps(a, b);
-}
+// with subsampling, the channels are used in turns over blocks of points
+constexpr int SubsampleBlockSize = 64;
+
+typedef ValidVector::value_type ValidType;
 
-static FORCE_INLINE void store_ps(float* ptr, __m128 a)
+static inline int HistBin(float r)
 {
-  _mm_store_ps(ptr, a);
+  uint32_t u;
+  memcpy(&u, &r, sizeof(u));
+  const int k = static_cast<int>((u & 0x7fffffff) >> HistShift) - HistFirstKey;
+  return std::max(0, std::min(k, HistNumBins - 1));
 }
 
-static FORCE_INLINE void storeu_ps(float* ptr, __m128 a)
+static inline float HistBinEdge(int b)
 {
-  _mm_storeu_ps(ptr, a);
+  const uint32_t u = static_cast<uint32_t>(b + HistFirstKey) << HistShift;
+  float ret;
+  memcpy(&ret, &u, sizeof(ret));
+  return ret;
 }
 
-static FORCE_INLINE __m128 max_ps(__m128 a, __m128 b)
+#if defined(WITH_SIMD)
+
+// SSE2 only, the valid flags are widened to 32 bits by unpacking with zeros
+
+static inline __m128i LoadValid4(const uint16_t* p)
 {
-  return _mm_max_ps(a, b);
+  return _mm_unpacklo_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)),
+                            _mm_setzero_si128());
 }
 
-static FORCE_INLINE __m128 set1_ps(float v)
+static inline __m128i LoadValid4(const uint8_t* p)
 {
-  return _mm_set1_ps(v);
+  int v;
+  memcpy(&v, p, sizeof(v));
+  const __m128i zero = _mm_setzero_si128();
+  return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(v), zero), zero);
 }
 
-static FORCE_INLINE __m128 div_ps(__m128 a, __m128 b)
+/**
+ * \return a where mask is set, b otherwise
+ */
+static inline __m128i Select(__m128i mask, __m128i a, __m128i b)
 {
-  return _mm_div_ps(a, b);
+  return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
 }
 
-static FORCE_INLINE __m128 sub_ps(__m128 a, __m128 b)
+static inline int hist_bins_sse(const float* r, const ValidType* valid, int n, int* bins)
 {
-  return _mm_sub_ps(a, b);
+  const __m128i abs_mask = _mm_set1_epi32(0x7fffffff),
+        first_key = _mm_set1_epi32(HistFirstKey),
+        last_bin = _mm_set1_epi32(HistNumBins - 1),
+        invalid_bin = _mm_set1_epi32(HistInvalidBin),
+        zero = _mm_setzero_si128();
+
+  int i = 0;
+  for( ; i <= n - 4; i += 4) {
+    auto k = _mm_and_si128(_mm_castps_si128(_mm_loadu_ps(r + i)), abs_mask);
+    k = _mm_sub_epi32(_mm_srli_epi32(k, HistShift), first_key);
+    k = _mm_and_si128(k, _mm_cmpgt_epi32(k, zero));
+    k = Select(_mm_cmpgt_epi32(k, last_bin), last_bin, k);
+    k = Select(_mm_cmpeq_epi32(LoadValid4(valid + i), zero), invalid_bin, k);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(bins + i), k);
+  }
+
+  return i;
 }
 
-static FORCE_INLINE __m128 and_ps(__m128 a, __m128 b)
+TARGET_ISA("avx2") static inline __m256i LoadValid8(const uint16_t* p)
 {
-  return _mm_and_ps(a, b);
+  return _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
 }
 
-static FORCE_INLINE __m128 cmplt_ps(__m128 a, __m128 b)
+TARGET_ISA("avx2") static inline __m256i LoadValid8(const uint8_t* p)
 {
-  return _mm_cmplt_ps(a, b);
+  return _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)));
 }
 
-
-static const int SIMD_VECTOR_UNIT_SIZE = 4;
-
-#endif // __AVX__
-
-static inline
-size_t huber_simd(const typename ResidualsVector::value_type* r_ptr,
-                  const typename  ValidVector::value_type* /* v_ptr */,
-                  typename WeightsVector::value_type* w_ptr,
-                  size_t N, float sigma_inv, float huber_k)
+TARGET_ISA("avx2") static inline
+int hist_bins_avx2(const float* r, const ValidType* valid, int n, int* bins)
 {
-  constexpr int S = 2 * SIMD_VECTOR_UNIT_SIZE;
-  auto n = N & ~(S-1);
-  const auto s_inv = set1_ps(sigma_inv), h_k = set1_ps(huber_k);
-
-  size_t i = 0;
-  bool is_aligned = false;
-
-  is_aligned = IsAligned<DefaultAlignment>(r_ptr) && IsAligned<DefaultAlignment>(w_ptr);
-
-  if(is_aligned) {
-    for(i=0; i < n; i += S) {
-      auto x0 = abs_ps( mul_ps(load_ps(r_ptr + i + 0*SIMD_VECTOR_UNIT_SIZE), s_inv) );
-      auto x1 = abs_ps( mul_ps(load_ps(r_ptr + i + 1*SIMD_VECTOR_UNIT_SIZE), s_inv) );
-      auto r0 = div_ps(h_k, max_ps(x0, h_k));
-      auto r1 = div_ps(h_k, max_ps(x1, h_k));
-      store_ps(w_ptr + i + 0*SIMD_VECTOR_UNIT_SIZE, r0);
-      store_ps(w_ptr + i + 1*SIMD_VECTOR_UNIT_SIZE, r1);
-    }
-  } else {
-    for(i=0; i < n; i += S) {
-      auto x0 = abs_ps( mul_ps(loadu_ps(r_ptr + i + 0*SIMD_VECTOR_UNIT_SIZE), s_inv) );
-      auto x1 = abs_ps( mul_ps(loadu_ps(r_ptr + i + 1*SIMD_VECTOR_UNIT_SIZE), s_inv) );
-      auto r0 = div_ps(h_k, max_ps(x0, h_k));
-      auto r1 = div_ps(h_k, max_ps(x1, h_k));
-      storeu_ps(w_ptr + i + 0*SIMD_VECTOR_UNIT_SIZE, r0);
-      storeu_ps(w_ptr + i + 1*SIMD_VECTOR_UNIT_SIZE, r1);
-    }
+  const __m256i abs_mask = _mm256_set1_epi32(0x7fffffff),
+        first_key = _mm256_set1_epi32(HistFirstKey),
+        last_bin = _mm256_set1_epi32(HistNumBins - 1),
+        invalid_bin = _mm256_set1_epi32(HistInvalidBin),
+        zero = _mm256_setzero_si256();
+
+  int i = 0;
+  for( ; i <= n - 8; i += 8) {
+    auto k = _mm256_and_si256(_mm256_castps_si256(_mm256_loadu_ps(r + i)), abs_mask);
+    k = _mm256_sub_epi32(_mm256_srli_epi32(k, HistShift), first_key);
+    k = _mm256_min_epi32(_mm256_max_epi32(k, zero), last_bin);
+    k = _mm256_blendv_epi8(k, invalid_bin, _mm256_cmpeq_epi32(LoadValid8(valid + i), zero));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(bins + i), k);
   }
 
-#if defined(__AVX__)
   _mm256_zeroupper();
-#endif
-
   return i;
 }
 
-static inline
-void computeWeightsHuberSimd(const ResidualsVector& residuals, const ValidVector& valid,
-                             float sigma, WeightsVector& weights, float huber_k = 1.345f)
-{
-  assert( valid.size() == residuals.size() );
-  weights.resize(residuals.size());
+#endif // WITH_SIMD
 
-  float sigma_inv = 1.0f / sigma;
-  size_t i = huber_simd(residuals.data(), valid.data(), weights.data(),
-                        residuals.size(), sigma_inv, huber_k);
+/**
+ * adds the absolute values of the valid residuals to the histogram
+ */
+static inline void AddToHistogram(const float* r, const ValidType* valid, int n,
+                                  bool use_avx2, uint32_t* counts)
+{
+  int bins[HistChunkSize];
+  for(int i0 = 0; i0 < n; i0 += HistChunkSize)
+  {
+    const int m = std::min(HistChunkSize, n - i0);
 
-  if(i < residuals.size()) {
-    HuberOp<float> func(huber_k);
-    for( ; i < residuals.size(); ++i) {
-      weights[i] = static_cast<float>(valid[i]) * func(sigma_inv * residuals[i]);
+    int i = 0;
+#if defined(WITH_SIMD)
+    i = use_avx2 ? hist_bins_avx2(r + i0, valid + i0, m, bins) :
+        hist_bins_sse(r + i0, valid + i0, m, bins);
+#else
+    UNUSED(use_avx2);
+#endif
+    for( ; i < m; ++i)
+      bins[i] = valid[i0 + i] ? HistBin(r[i0 + i]) : HistInvalidBin;
+
+    for(i = 0; i <= m - HistNumCopies; i += HistNumCopies) {
+      ++counts[0*HistStride + bins[i + 0]];
+      ++counts[1*HistStride + bins[i + 1]];
+      ++counts[2*HistStride + bins[i + 2]];
+      ++counts[3*HistStride + bins[i + 3]];
     }
+
+    for( ; i < m; ++i)
+      ++counts[bins[i]];
   }
 }
 
-static inline
-size_t tukey_simd(const typename ResidualsVector::value_type* r_ptr,
-                  const typename ValidVector::value_type* /* v_ptr */,
-                  typename ResidualsVector::value_type* w_ptr,
-                  size_t N, float sigma_inv, float tukey_t)
+/**
+ * calls f(residuals, valid, n) on the residuals to use for the scale. valid
+ * has one flag per point, shared by all channels
+ */
+template <class Func> static inline
+void ForEachScaleSample(const ResidualsVector& residuals, const ValidVector& valid,
+                        bool subsample, Func f)
 {
-  size_t i = 0;
-
-  constexpr int S = 2 * SIMD_VECTOR_UNIT_SIZE;
-  auto n = N & ~(S-1);
-  const auto s_inv = set1_ps(sigma_inv), ones = set1_ps(1.0f),
-        t = set1_ps(tukey_t), t_i = set1_ps(1.0 / tukey_t);
-
-  bool is_aligned = false;
-  is_aligned = IsAligned<DefaultAlignment>(r_ptr) && IsAligned<DefaultAlignment>(w_ptr);
-
-  if(is_aligned) {
-    for(i = 0; i < n; i += S) {
-      {
-        auto x = mul_ps(load_ps(r_ptr + i + 0*SIMD_VECTOR_UNIT_SIZE), s_inv);
-        auto r = mul_ps(x, t_i);
-        r = sub_ps(ones, mul_ps(r,r));
-        r = mul_ps(r, r);
-        auto m = cmplt_ps(abs_ps(x), t);
-        store_ps(w_ptr + i + 0*SIMD_VECTOR_UNIT_SIZE, and_ps(m, r));
-      }
+  const int n = valid.size();
+  if(!n)
+    return;
 
-      {
-        auto x = mul_ps(load_ps(r_ptr + i + 1*SIMD_VECTOR_UNIT_SIZE), s_inv);
-        auto r = mul_ps(x, t_i);
-        r = sub_ps(ones, mul_ps(r,r));
-        r = mul_ps(r, r);
-        auto m = cmplt_ps(abs_ps(x), t);
-        store_ps(w_ptr + i + 1*SIMD_VECTOR_UNIT_SIZE, and_ps(m, r));
-      }
-    }
+  const int num_channels = residuals.size() / n;
+  if(!subsample) {
+    for(int c = 0; c < num_channels; ++c)
+      f(residuals.data() + c*n, valid.data(), n);
   } else {
-    for(i = 0; i < n; i += S) {
-      {
-        auto x = mul_ps(loadu_ps(r_ptr + i + 0*SIMD_VECTOR_UNIT_SIZE), s_inv);
-        auto r = mul_ps(x, t_i);
-        r = sub_ps(ones, mul_ps(r,r));
-        r = mul_ps(r, r);
-        auto m = cmplt_ps(abs_ps(x), t);
-        storeu_ps(w_ptr + i + 0*SIMD_VECTOR_UNIT_SIZE, and_ps(m, r));
-      }
-
-      {
-        auto x = mul_ps(loadu_ps(r_ptr + i + 1*SIMD_VECTOR_UNIT_SIZE), s_inv);
-        auto r = mul_ps(x, t_i);
-        r = sub_ps(ones, mul_ps(r,r));
-        r = mul_ps(r, r);
-        auto m = cmplt_ps(abs_ps(x), t);
-        storeu_ps(w_ptr + i + 1*SIMD_VECTOR_UNIT_SIZE, and_ps(m, r));
-      }
-    }
+    for(int i = 0, b = 0; i < n; i += SubsampleBlockSize, ++b)
+      f(residuals.data() + (b % num_channels)*n + i, valid.data() + i,
+        std::min(SubsampleBlockSize, n - i));
   }
+}
 
-#if defined(__AVX__)
-  _mm256_zeroupper();
-#endif
-
-  return i;
+static inline float ScaleFromMedian(float median, size_t num_samples)
+{
+  return (1.4826f * (1.0f + 5.0f / (num_samples-6) )) * median;
 }
 
 static inline
-void computeWeightsTukeySimd(const ResidualsVector& residuals,
-                             const ValidVector& valid,
-                             float sigma, WeightsVector& weights)
-{
-  assert( valid.size() == residuals.size() );
-  weights.resize(valid.size());
+float ScaleEstimator(const ResidualsVector& residuals, const ValidVector& valid_flags,
+                     bool subsample, std::vector<uint32_t>& counts)
+{
+  counts.assign(HistNumCopies * HistStride, 0);
+
+  const bool use_avx2 = HasSimdLevel(kSimdAVX2);
+  ForEachScaleSample(residuals, valid_flags, subsample,
+                     [&](const float* r, const ValidType* v, int n) {
+                       AddToHistogram(r, v, n, use_avx2, counts.data());
+                     });
+
+  size_t num_samples = 0;
+  for(int b = 0; b < HistNumBins; ++b) {
+    for(int k = 1; k < HistNumCopies; ++k)
+      counts[b] += counts[k*HistStride + b];
+    num_samples += counts[b];
+  }
 
-  float sigma_inv = 1.0f / sigma;
-  size_t i = tukey_simd(residuals.data(), valid.data(), weights.data(),
-                        residuals.size(), sigma_inv, 4.685f);
+  if(num_samples == 0)
+    return std::numeric_limits<float>::quiet_NaN();
 
-  if(i < residuals.size()) {
-    TukeyOp<float> func(4.685f);
-    for( ; i < residuals.size(); ++i)
-      weights[i] = static_cast<float>(valid[i]) * func(sigma_inv * residuals[i]);
-  }
-}
+  // rank of the median, in between the two middle samples if the number of
+  // samples is even. The samples are assumed uniform within a bin
+  const float rank = 0.5f * (num_samples - 1);
+  size_t n = 0;
+  int b = 0;
+  for( ; b < HistNumBins - 1 && n + counts[b] <= rank; ++b)
+    n += counts[b];
 
+  const float lo = b > 0 ? HistBinEdge(b) : 0.0f, hi = HistBinEdge(b + 1);
+  const float median = lo + (hi - lo) * ((rank - n + 0.5f) / counts[b]);
 
-#endif // WITH_SIMD
+  return ScaleFromMedian(median, num_samples);
+}
 
-void MEstimator::
-ComputeWeights(LossFunctionType loss_func, const ResidualsVector& residuals,
-               const ValidVector& valid, float sigma, WeightsVector& weights)
+static inline
+float ScaleEstimator(const ResidualsVector& residuals, const ValidVector& valid_flags,
+                     bool subsample, WeightsVector& buffer)
 {
-  assert( residuals.size() == valid.size() );
-  weights.resize(valid.size());
+  buffer.resize(0);
+  buffer.reserve(residuals.size());
 
-  if(loss_func == LossFunctionType::kL2) {
-    std::fill(weights.begin(), weights.end(), 1.0f);
-    return;
-  }
+  ForEachScaleSample(residuals, valid_flags, subsample,
+                     [&](const float* r, const ValidType* v, int n) {
+                       for(int i = 0; i < n; ++i)
+                         if(v[i] != 0)
+                           buffer.push_back( std::fabs(r[i]) );
+                     });
 
-#if defined(WITH_SIMD)
-  switch(loss_func) {
-    case LossFunctionType::kHuber: computeWeightsHuberSimd(residuals, valid, sigma, weights); break;
-    case LossFunctionType::kTukey: computeWeightsTukeySimd(residuals, valid, sigma, weights); break;
-    default: THROW_ERROR("unknown RobustFunction");
-  }
-#else
-  switch(loss_func) {
-    case LossFunctionType::kHuber: computeWeights<HuberOp<float>>(residuals, valid, sigma, weights); break;
-    case LossFunctionType::kTukey: computeWeights<TukeyOp<float>>(residuals, valid, sigma, weights); break;
-    default: THROW_ERROR("unkonwn RobustFunction");
-  }
-#endif
+  if(buffer.empty())
+    return std::numeric_limits<float>::quiet_NaN();
+
+  return ScaleFromMedian(median(buffer), buffer.size());
 }
 
-#if DO_APPROX_MEDIAN
-AutoScaleEstimator::AutoScaleEstimator(float t)
-  : _scale(1.0), _delta_scale(1e10), _tol(t), _hist(0.0f, 255.0f, 0.05f) {}
-#else
+}; // namespace
+
 AutoScaleEstimator::AutoScaleEstimator(float t)
   : _scale(1.0), _delta_scale(1e10), _tol(t) {}
-#endif
 
 void AutoScaleEstimator::reset()
 {
   _delta_scale = 1e10;
   _scale = 1.0;
-
-#if DO_APPROX_MEDIAN
-  _hist.clear();
-#endif
-
 }
 
 float AutoScaleEstimator::getScale() const { return _scale; }
 
-static inline
-float ScaleEstimator(const ResidualsVector& residuals,
-                     const ValidVector& valid_flags,
-                     Histogram<float>& hist)
+void AutoScaleEstimator::setEstimatorType(ScaleEstimatorType t, bool subsample)
 {
-  hist.clear();
-
-  for(size_t i = 0; i < residuals.size(); ++i)
-    if(valid_flags[i] != 0)
-      hist.add(std::fabs(residuals[i]));
-
-  if(hist.numSamples() == 0)
-    return std::numeric_limits<float>::quiet_NaN();
-
-  return (1.4826f * (1.0f + 5.0f / (hist.numSamples()-6) )) * hist.median();
-}
-
-static inline
-float ScaleEstimator(const ResidualsVector& residuals,
-                     const ValidVector& valid_flags,
-                     WeightsVector& buffer)
-{
-  buffer.resize(0);
-  buffer.reserve(residuals.size());
-
-  for(size_t i = 0; i < residuals.size(); ++i)
-    if(valid_flags[i] != 0)
-      buffer.push_back( std::fabs(residuals[i]) );
-
-  if(buffer.empty())
-    return std::numeric_limits<float>::quiet_NaN();
-
-  return (1.4826f * (1.0f + 5.0f / (buffer.size()-6) )) * median(buffer);
+  _type = t;
+  _subsample = subsample;
 }
 
 float AutoScaleEstimator::estimateScale(const ResidualsVector& residuals,
                                         const ValidVector& valid)
 {
-  assert( residuals.size() == valid.size() );
+  assert( !valid.size() || residuals.size() % valid.size() == 0 );
   if( residuals.empty() ) { return std::numeric_limits<float>::quiet_NaN(); }
 
   if(_delta_scale > _tol)
   {
-#if DO_APPROX_MEDIAN
-    auto scale = ScaleEstimator(residuals, valid, _hist);
-#else
-    auto scale = ScaleEstimator(residuals, valid, _buffer);
-#endif
+    auto scale = _type == kApproximateMedian ?
+        ScaleEstimator(residuals, valid, _subsample, _counts) :
+        ScaleEstimator(residuals, valid, _subsample, _buffer);
 
     if(scale < 1e-6)
       scale = 1.0; // for the case of zero error
@@ -498,4 +539,3 @@ float AutoScaleEstimator::estimateScale(const ResidualsVector& residuals,
 
 }; // bpvo
 
-
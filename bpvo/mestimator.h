@@ -23,13 +23,6 @@
 #define BPVO_MESTIMATOR_H
 
 #include <bpvo/types.h>
-
-#define DO_APPROX_MEDIAN 0
-
-#if DO_APPROX_MEDIAN
-#include <bpvo/histogram.h>
-#endif
-
 #include <vector>
 
 
@@ -45,17 +38,30 @@ class MEstimator
 
   /**
    * computes the weights for valid points only, invalid points are assigned
-   * zero weight
+   * zero weight. valid has one flag per point, shared by all channels of the
+   * residuals
    */
   static void ComputeWeights(LossFunctionType, const ResidualsVector& residuals,
                              const ValidVector& valid, float sigma,
                              WeightsVector& weights);
+
+  /**
+   * computes the weights of n residuals. Used on small blocks of residuals
+   * that are still in cache
+   */
+  static void ComputeWeights(LossFunctionType, const float* residuals, int n,
+                             float sigma, float* weights);
 }; // MEstimator
 
 /**
  * Estimates the scale of the data using robust standard deviation. We also keep
  * the change in the estimated scale across iterations so that time is not
  * wasted if the scale is stable
+ *
+ * With kApproximateMedian, the absolute residuals are binned into a histogram
+ * whose bins are spaced on a log scale (the exponent and the leading bits of
+ * the mantissa of the float), hence the error is relative to the median and
+ * bounded by the bin width. The bin of each residual is computed with SIMD
  */
 class AutoScaleEstimator
 {
@@ -65,22 +71,41 @@ class AutoScaleEstimator
   void reset();
   float getScale() const;
 
+  /**
+   * sets the estimator, see ScaleEstimatorType. If subsample is true, a single
+   * channel is used per point
+   */
+  void setEstimatorType(ScaleEstimatorType, bool subsample = false);
+
   /**
    * Estimate the scale/stdandard deviation of errors. Returns NaN if residuals is empty.
    *
    * \param residuals the vector of residuals
-   * \param valid indicates which points are valid
+   * \param valid indicates which points are valid, one flag per point shared
+   * by all channels of the residuals
    */
   float estimateScale(const ResidualsVector& residuals, const ValidVector& valid);
 
+  /**
+   * \return true if the scale changed by less than the tolerance on the last
+   * call to estimateScale. The scale will not be estimated again, and the
+   * residuals are not needed to call estimateScale
+   */
+  inline bool isScaleStable() const { return _delta_scale <= _tol; }
+
+  /**
+   * keeps the current scale until the next reset(), as if it were stable
+   */
+  inline void freezeScale() { _delta_scale = 0.0f; }
+
  private:
   float _scale = 1.0, _delta_scale = 1e10, _tol = 1e-6;
 
-#if DO_APPROX_MEDIAN
-  Histogram<float> _hist;
-#else
+  ScaleEstimatorType _type = kExactMedian;
+  bool _subsample = false;
+
   WeightsVector _buffer;
-#endif
+  std::vector<uint32_t> _counts;
 }; // AutoScaleEstimator
 
 }; // bpvo
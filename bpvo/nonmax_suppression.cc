@@ -0,0 +1,348 @@
+/*
+   This file is part of bpvo.
+
+   bpvo is free software: you can redistribute it and/or modify
+   it under the terms of the Lesser GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   bpvo is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   Lesser GNU General Public License for more details.
+
+   You should have received a copy of the Lesser GNU General Public License
+   along with bpvo.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/*
+ * Contributor: halismai@cs.cmu.edu
+ */
+
+#include "bpvo/nonmax_suppression.h"
+#include "bpvo/cpu_features.h"
+#include "bpvo/parallel.h"
+#include "bpvo/utils.h"
+
+#include <algorithm>
+#include <limits>
+
+#if defined(WITH_SIMD)
+#include <immintrin.h>
+#endif
+
+namespace bpvo {
+
+namespace {
+
+constexpr int BandRows = 32;
+
+/*
+ * The SIMD kernels process [x0, x0 + k*N) and return where they stopped, the
+ * rest is done by the scalar code
+ */
+
+#if defined(WITH_SIMD)
+
+/** h[x] = max(s[x-r], ..., s[x+r]) */
+static inline int hmax_sse(const float* s, int x0, int x1, int r, float* h)
+{
+  int x = x0;
+  for( ; x <= x1 - 4; x += 4) {
+    auto m = _mm_loadu_ps(s + x - r);
+    for(int j = -r + 1; j <= r; ++j)
+      m = _mm_max_ps(m, _mm_loadu_ps(s + x + j));
+    _mm_storeu_ps(h + x, m);
+  }
+
+  return x;
+}
+
+/** dst[x] = max(dst[x], src[x]) */
+static inline int vmax_sse(const float* src, int x0, int x1, float* dst)
+{
+  int x = x0;
+  for( ; x <= x1 - 4; x += 4)
+    _mm_storeu_ps(dst + x, _mm_max_ps(_mm_loadu_ps(dst + x), _mm_loadu_ps(src + x)));
+
+  return x;
+}
+
+/**
+ * writes the columns where s[x] >= t and s[x] is larger than v[x] and the r
+ * neighbors on each side
+ */
+static inline int select_sse(const float* s, const float* v, int x0, int x1,
+                             int r, float t, int* cols, int& n)
+{
+  const __m128 t4 = _mm_set1_ps(t);
+
+  int x = x0;
+  for( ; x <= x1 - 4; x += 4) {
+    const auto c = _mm_loadu_ps(s + x);
+    auto m = _mm_loadu_ps(v + x);
+    for(int j = 1; j <= r; ++j)
+      m = _mm_max_ps(m, _mm_max_ps(_mm_loadu_ps(s + x - j), _mm_loadu_ps(s + x + j)));
+
+    int mask = _mm_movemask_ps(_mm_and_ps(_mm_cmpgt_ps(c, m), _mm_cmpge_ps(c, t4)));
+    for( ; mask; mask &= mask - 1)
+      cols[n++] = x + __builtin_ctz(mask);
+  }
+
+  return x;
+}
+
+TARGET_ISA("avx") static inline
+int hmax_avx(const float* s, int x0, int x1, int r, float* h)
+{
+  int x = x0;
+  for( ; x <= x1 - 8; x += 8) {
+    auto m = _mm256_loadu_ps(s + x - r);
+    for(int j = -r + 1; j <= r; ++j)
+      m = _mm256_max_ps(m, _mm256_loadu_ps(s + x + j));
+    _mm256_storeu_ps(h + x, m);
+  }
+
+  _mm256_zeroupper();
+  return x;
+}
+
+TARGET_ISA("avx") static inline
+int vmax_avx(const float* src, int x0, int x1, float* dst)
+{
+  int x = x0;
+  for( ; x <= x1 - 8; x += 8)
+    _mm256_storeu_ps(dst + x, _mm256_max_ps(_mm256_loadu_ps(dst + x),
+                                            _mm256_loadu_ps(src + x)));
+
+  _mm256_zeroupper();
+  return x;
+}
+
+TARGET_ISA("avx") static inline
+int select_avx(const float* s, const float* v, int x0, int x1, int r, float t,
+               int* cols, int& n)
+{
+  const __m256 t8 = _mm256_set1_ps(t);
+
+  int x = x0;
+  for( ; x <= x1 - 8; x += 8) {
+    const auto c = _mm256_loadu_ps(s + x);
+    auto m = _mm256_loadu_ps(v + x);
+    for(int j = 1; j <= r; ++j)
+      m = _mm256_max_ps(m, _mm256_max_ps(_mm256_loadu_ps(s + x - j),
+                                         _mm256_loadu_ps(s + x + j)));
+
+    int mask = _mm256_movemask_ps(_mm256_and_ps(_mm256_cmp_ps(c, m, _CMP_GT_OQ),
+                                                _mm256_cmp_ps(c, t8, _CMP_GE_OQ)));
+    for( ; mask; mask &= mask - 1)
+      cols[n++] = x + __builtin_ctz(mask);
+  }
+
+  _mm256_zeroupper();
+  return x;
+}
+
+#endif // WITH_SIMD
+
+static inline void hmaxRow(const float* s, int x0, int x1, int r, float* h, bool use_avx)
+{
+  int x = x0;
+#if defined(WITH_SIMD)
+  x = use_avx ? hmax_avx(s, x, x1, r, h) : hmax_sse(s, x, x1, r, h);
+#else
+  UNUSED(use_avx);
+#endif
+
+  for( ; x < x1; ++x) {
+    float m = s[x - r];
+    for(int j = -r + 1; j <= r; ++j)
+      m = std::max(m, s[x + j]);
+    h[x] = m;
+  }
+}
+
+static inline void vmaxRow(const float* src, int x0, int x1, float* dst, bool use_avx)
+{
+  int x = x0;
+#if defined(WITH_SIMD)
+  x = use_avx ? vmax_avx(src, x, x1, dst) : vmax_sse(src, x, x1, dst);
+#else
+  UNUSED(use_avx);
+#endif
+
+  for( ; x < x1; ++x)
+    dst[x] = std::max(dst[x], src[x]);
+}
+
+static inline int selectRow(const float* s, const float* v, int x0, int x1, int r,
+                            float t, int* cols, bool use_avx)
+{
+  int n = 0, x = x0;
+#if defined(WITH_SIMD)
+  x = use_avx ? select_avx(s, v, x, x1, r, t, cols, n) :
+      select_sse(s, v, x, x1, r, t, cols, n);
+#else
+  UNUSED(use_avx);
+#endif
+
+  for( ; x < x1; ++x) {
+    const float c = s[x];
+    float m = v[x];
+    for(int j = 1; j <= r; ++j)
+      m = std::max(m, std::max(s[x - j], s[x + j]));
+    if(c > m && c >= t)
+      cols[n++] = x;
+  }
+
+  return n;
+}
+
+}; // namespace
+
+class NonMaxSuppressionBody : public ParallelForBody
+{
+ public:
+  NonMaxSuppressionBody(const cv::Mat& S, int radius, float min_saliency, int border,
+                        const NonMaxSuppression::Disparity* D,
+                        std::vector<NonMaxSuppression::Band>& bands, cv::Mat& buffer)
+      : _S(S), _radius(std::max(0, radius)), _min_saliency(min_saliency)
+      , _border(border), _D(D), _bands(bands), _buffer(buffer)
+      , _use_avx(HasSimdLevel(kSimdAVX)) {}
+
+  /** each band has a ring of 2*radius+1 row maxima and the window maxima */
+  static inline int BufferRows(int radius) { return 2*std::max(0, radius) + 2; }
+
+  void operator()(const Range& range) const
+  {
+    const int r = _radius, ring_size = 2*r + 1;
+    const int x0 = _border, x1 = _S.cols - _border - 1;
+
+    for(int b = range.begin(); b != range.end(); ++b)
+    {
+      const int y0 = _border + b*BandRows,
+            y1 = std::min(y0 + BandRows, _S.rows - _border - 1);
+
+      auto& band = _bands[b];
+      band.inds.resize(0);
+      band.disparities.resize(0);
+      band.cols.resize(_S.cols);
+
+      const int buffer_row = b * BufferRows(r);
+      auto ring = [=](int y) { return _buffer.ptr<float>(buffer_row + y % ring_size); };
+      float* vmax = _buffer.ptr<float>(buffer_row + ring_size);
+
+      for(int y = y0 - r; y < y0 + r; ++y)
+        hmaxRow(_S.ptr<const float>(y), x0, x1, r, ring(y), _use_avx);
+
+      if(!r)
+        std::fill_n(vmax, _S.cols, -std::numeric_limits<float>::infinity());
+
+      for(int y = y0; y < y1; ++y)
+      {
+        const float* srow = _S.ptr<const float>(y);
+
+        if(r) {
+          hmaxRow(_S.ptr<const float>(y + r), x0, x1, r, ring(y + r), _use_avx);
+
+          // maximum of the window without the center row, which is done by
+          // selectRow without the center pixel
+          std::copy(ring(y - r) + x0, ring(y - r) + x1, vmax + x0);
+          for(int k = y - r + 1; k <= y + r; ++k)
+            if(k != y)
+              vmaxRow(ring(k), x0, x1, vmax, _use_avx);
+        }
+
+        const int n = selectRow(srow, vmax, x0, x1, r, _min_saliency,
+                                band.cols.data(), _use_avx);
+        for(int i = 0; i < n; ++i)
+        {
+          const int x = band.cols[i];
+          if(_D) {
+            const float d = _D->map->ptr<const float>(_D->scale * y)[_D->scale * x];
+            if(!(d >= _D->minValue && d <= _D->maxValue))
+              continue;
+            band.disparities.push_back(d);
+          }
+
+          band.inds.push_back(y);
+          band.inds.push_back(x);
+        }
+      }
+    }
+  }
+
+ private:
+  const cv::Mat& _S;
+  int _radius;
+  float _min_saliency;
+  int _border;
+  const NonMaxSuppression::Disparity* _D;
+  std::vector<NonMaxSuppression::Band>& _bands;
+  cv::Mat& _buffer;
+  bool _use_avx;
+}; // NonMaxSuppressionBody
+
+NonMaxSuppression::NonMaxSuppression(int radius, float min_saliency, int border)
+  : _radius(radius), _min_saliency(min_saliency), _border(border) {}
+
+int NonMaxSuppression::run(const cv::Mat& S, std::vector<uint16_t>& inds)
+{
+  return run(S, nullptr, inds, nullptr);
+}
+
+int NonMaxSuppression::run(const cv::Mat& S, const Disparity& D,
+                           std::vector<uint16_t>& inds, std::vector<float>& disparities)
+{
+  THROW_ERROR_IF( D.map->type() != CV_32FC1, "disparity must be CV_32FC1" );
+  THROW_ERROR_IF( (S.rows - _border - 2) * D.scale >= D.map->rows ||
+                  (S.cols - _border - 2) * D.scale >= D.map->cols,
+                  "disparity map is too small" );
+
+  return run(S, &D, inds, &disparities);
+}
+
+int NonMaxSuppression::run(const cv::Mat& S, const Disparity* D,
+                           std::vector<uint16_t>& inds, std::vector<float>* disparities)
+{
+  THROW_ERROR_IF( S.type() != CV_32FC1, "saliency map must be CV_32FC1" );
+  THROW_ERROR_IF( _border < std::max(0, _radius), "border must be >= radius" );
+
+  inds.resize(0);
+  if(disparities)
+    disparities->resize(0);
+
+  const int num_rows = S.rows - 2*_border - 1;
+  if(num_rows <= 0 || S.cols - 2*_border - 1 <= 0)
+    return 0;
+
+  const int num_bands = (num_rows + BandRows - 1) / BandRows;
+  if((int) _bands.size() < num_bands)
+    _bands.resize(num_bands);
+  _buffer.create(num_bands * NonMaxSuppressionBody::BufferRows(_radius), S.cols, CV_32FC1);
+
+  NonMaxSuppressionBody func(S, _radius, _min_saliency, _border, D, _bands, _buffer);
+  parallel_for(Range(0, num_bands), func, num_bands);
+
+  size_t n = 0;
+  for(int b = 0; b < num_bands; ++b)
+    n += _bands[b].inds.size();
+
+  inds.resize(n);
+  if(disparities)
+    disparities->resize(n / 2);
+
+  size_t i = 0;
+  for(int b = 0; b < num_bands; ++b) {
+    const auto& band = _bands[b];
+    std::copy(band.inds.begin(), band.inds.end(), inds.begin() + i);
+    if(disparities)
+      std::copy(band.disparities.begin(), band.disparities.end(), disparities->begin() + i/2);
+    i += band.inds.size();
+  }
+
+  return (int) n / 2;
+}
+
+}; // bpvo
@@ -0,0 +1,116 @@
+/*
+   This file is part of bpvo.
+
+   bpvo is free software: you can redistribute it and/or modify
+   it under the terms of the Lesser GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   bpvo is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   Lesser GNU General Public License for more details.
+
+   You should have received a copy of the Lesser GNU General Public License
+   along with bpvo.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/*
+ * Contributor: halismai@cs.cmu.edu
+ */
+
+#ifndef BPVO_NONMAX_SUPPRESSION_H
+#define BPVO_NONMAX_SUPPRESSION_H
+
+#include <opencv2/core/core.hpp>
+#include <cstdint>
+#include <vector>
+
+namespace bpvo {
+
+/**
+ * Selects the pixels of a saliency map that are above a threshold and are
+ * strict local maxima within a (2*radius+1)^2 window, i.e. larger than all of
+ * their neighbors.
+ *
+ * The window maximum is decomposed into a row maximum followed by a column
+ * maximum, so the cost per pixel is linear in the radius. Rows are processed
+ * with SIMD comparisons whose masks are compacted into column indices, and the
+ * image is split into bands of rows that run in parallel. The output is in
+ * raster order.
+ *
+ * The buffers are kept between calls, there are no memory allocations once
+ * the largest image has been seen.
+ */
+class NonMaxSuppression
+{
+ public:
+  /**
+   * Optional disparity lookup done in the same pass
+   */
+  struct Disparity
+  {
+    /** the disparity map, CV_32FC1, possibly at a higher resolution */
+    const cv::Mat* map;
+
+    /** the disparity at (y,x) is read from map at (scale*y, scale*x) */
+    int scale;
+
+    /** pixels with a disparity outside [minValue, maxValue] are dropped */
+    float minValue, maxValue;
+  }; // Disparity
+
+ public:
+  /**
+   * \param radius the radius of the window, if <= 0 all pixels above the
+   * threshold are selected
+   * \param min_saliency the threshold
+   * \param border pixels within border of the top/left and border+1 of the
+   * bottom/right of the image are skipped. Must be >= radius
+   */
+  NonMaxSuppression(int radius = 1, float min_saliency = 0.0f, int border = 1);
+
+  inline void setRadius(int r) { _radius = r; }
+  inline void setMinSaliency(float v) { _min_saliency = v; }
+  inline void setBorder(int b) { _border = b; }
+
+  /**
+   * \param saliency CV_32FC1 saliency map
+   * \param inds the selected pixels as [y0, x0, y1, x1, ...]
+   * \return the number of selected pixels
+   */
+  int run(const cv::Mat& saliency, std::vector<uint16_t>& inds);
+
+  /**
+   * Same as above and also reads the disparity at the selected pixels. Pixels
+   * with an invalid disparity are not selected
+   *
+   * \param disparities the disparity at each of the selected pixels
+   */
+  int run(const cv::Mat& saliency, const Disparity& D,
+          std::vector<uint16_t>& inds, std::vector<float>& disparities);
+
+ private:
+  struct Band
+  {
+    std::vector<uint16_t> inds;
+    std::vector<float> disparities;
+    std::vector<int> cols;
+  }; // Band
+
+  friend class NonMaxSuppressionBody;
+
+  int run(const cv::Mat&, const Disparity*, std::vector<uint16_t>&, std::vector<float>*);
+
+  int _radius;
+  float _min_saliency;
+  int _border;
+
+  std::vector<Band> _bands;
+  cv::Mat _buffer;
+}; // NonMaxSuppression
+
+}; // bpvo
+
+#endif // BPVO_NONMAX_SUPPRESSION_H
@@ -20,6 +20,7 @@
  */
 
 #include "bpvo/parallel.h"
+#include "bpvo/task_scheduler.h"
 
 // based on opencv's parallel_for below is their notice
 
@@ -73,6 +74,10 @@
 #include <tbb/tbb.h>
 #elif defined(WITH_OPENMP)
 #include <omp.h>
+#elif defined(WITH_THREADS)
+#include <atomic>
+#include <exception>
+#include <mutex>
 #endif
 
 #include <algorithm>
@@ -99,6 +104,8 @@ int getNumThreads()
   return s_taskScheduler.is_active() ? s_numThreads : tbb::task_scheduler_init::default_num_threads();
 #elif defined(WITH_OPENMP)
   return omp_get_max_threads();
+#elif defined(WITH_THREADS)
+  return TaskScheduler::Instance().numThreads();
 #else
   return 1;
 #endif
@@ -113,6 +120,11 @@ void setNumThreads(int n)
 {
   s_numThreads = n;
 
+#if !defined(WITH_TBB)
+  // the scheduler is also used by ParallelTasks and the reductions
+  TaskScheduler::Instance().setNumThreads(n == 0 ? 1 : n);
+#endif
+
 #if defined(WITH_TBB)
   if(s_taskScheduler.is_active())
     s_taskScheduler.terminate();
@@ -137,6 +149,8 @@ int getThreadNum()
 
 #elif defined(WITH_OPENMP)
   return omp_get_thread_num();
+#elif defined(WITH_THREADS)
+  return TaskScheduler::Instance().threadIndex();
 #else
   return 0;
 #endif
@@ -197,6 +211,61 @@ class ParallelLoopProxy : public ParallelForWrapper
 typedef ParallelForWrapper ParallelLoopProxy;
 #endif
 
+#if !defined(WITH_TBB) && !defined(WITH_OPENMP) && defined(WITH_THREADS)
+/**
+ * std::thread backend. Similar to OpenCV's pthreads backend, one task per
+ * thread is started on the TaskScheduler and the tasks (including the calling
+ * thread) take the next stripe from a shared counter until all are done. This
+ * balances the load when the stripes have different costs
+ *
+ * Without TBB or OpenMP, parallel_for was already running on the TaskScheduler
+ * with one task per stripe, this only changes the scheduling of the stripes.
+ * WITH_THREADS=OFF is the serial fallback
+ */
+class ParallelLoopTasks
+{
+ public:
+  ParallelLoopTasks(const ParallelLoopProxy& body, const Range& srange)
+      : _body(body), _srange(srange), _next_stripe(srange.begin()) {}
+
+  void run()
+  {
+    const int n_tasks = std::min(TaskScheduler::Instance().numThreads(), _srange.size());
+
+    TaskGroup group;
+    for(int i = 1; i < n_tasks; ++i)
+      group.run(&ParallelLoopTasks::RunStripes, this, i);
+
+    RunStripes(this, 0);
+    group.wait();
+
+    if(_error)
+      std::rethrow_exception(_error);
+  }
+
+ private:
+  static void RunStripes(void* self_, int)
+  {
+    auto self = static_cast<ParallelLoopTasks*>(self_);
+    try {
+      for(int i = self->_next_stripe++; i < self->_srange.end(); i = self->_next_stripe++)
+        self->_body(Range(i, i + 1));
+    } catch(...) {
+      std::lock_guard<std::mutex> lock(self->_mutex);
+      if(!self->_error)
+        self->_error = std::current_exception();
+      self->_next_stripe = self->_srange.end(); // stop the other tasks
+    }
+  }
+
+  const ParallelLoopProxy& _body;
+  Range _srange;
+  std::atomic<int> _next_stripe;
+  std::exception_ptr _error;
+  std::mutex _mutex;
+}; // ParallelLoopTasks
+#endif
+
 } // namespace
 
 void parallel_for(const Range& range, const ParallelForBody& body, double nstripes)
@@ -213,11 +282,13 @@ void parallel_for(const Range& range, const ParallelForBody& body, double nstrip
 
 #if defined(WITH_TBB)
     tbb::parallel_for(tbb::blocked_range<int>(srange.begin(), srange.end()), pbody);
-#else
-#if defined(WITH_OPENMP)
+#elif defined(WITH_OPENMP)
 #pragma omp parallel for schedule(dynamic)
+    for(int i = srange.begin(); i < srange.end(); ++i)
+      pbody(Range(i, i + 1));
+#elif defined(WITH_THREADS)
+    ParallelLoopTasks(pbody, srange).run();
 #else
-#endif
     for(int i = srange.begin(); i < srange.end(); ++i)
       pbody(Range(i, i + 1));
 #endif
@@ -25,9 +25,10 @@
 #if defined(WITH_TBB)
 #include <tbb/task_group.h>
 #else
-#include <externals/ThreadPool.h>
-#include <vector>
-#include <future>
+#include <bpvo/task_scheduler.h>
+#include <deque>
+#include <exception>
+#include <functional>
 #endif
 
 #include <bpvo/types.h>
@@ -35,18 +36,29 @@
 
 namespace bpvo {
 
+/**
+ * Runs a set of tasks in parallel. Without TBB, the tasks run on the shared
+ * TaskScheduler, there are no threads created per instance
+ */
 class ParallelTasks
 {
  public:
   /**
+   * n_tasks is a hint and is not used, the number of threads is set globally
+   * with setNumThreads
    */
-  inline ParallelTasks(int n_tasks)
+  inline ParallelTasks(int n_tasks = -1)
   {
+    UNUSED(n_tasks);
 #if defined(WITH_TBB)
     _pool = make_unique<tbb::task_group>();
-    UNUSED(n_tasks);
-#else
-    _pool = make_unique<ThreadPool>(n_tasks);
+#endif
+  }
+
+  inline ~ParallelTasks()
+  {
+#if !defined(WITH_TBB)
+    _group.wait();
 #endif
   }
 
@@ -58,19 +70,25 @@ class ParallelTasks
 #if defined(WITH_TBB)
     _pool->run(f);
 #else
-    _results.emplace_back( _pool->enqueue(f) );
+    // deque does not move its elements on push_back, the running tasks keep
+    // a pointer to their entry
+    _tasks.emplace_back();
+    _tasks.back().func = f;
+    _group.run(&ParallelTasks::RunTask, &_tasks.back(), 0);
 #endif
   }
 
   /**
+   * waits for all tasks. Rethrows the first exception thrown by a task
    */
   void wait()
   {
 #if defined(WITH_TBB)
     _pool->wait();
 #else
-    for(auto&& r : _results)
-      r.get();
+    _group.wait();
+    for(auto& t : _tasks)
+      if(t.error) std::rethrow_exception(t.error);
 #endif
   }
 
@@ -78,8 +96,24 @@ class ParallelTasks
 #if defined(WITH_TBB)
   UniquePointer<tbb::task_group> _pool;
 #else
-  UniquePointer<ThreadPool> _pool;
-  std::vector< std::future<void> > _results;
+  struct Entry
+  {
+    std::function<void()> func;
+    std::exception_ptr error;
+  }; // Entry
+
+  static void RunTask(void* entry, int)
+  {
+    auto t = static_cast<Entry*>(entry);
+    try {
+      t->func();
+    } catch(...) {
+      t->error = std::current_exception();
+    }
+  }
+
+  std::deque<Entry> _tasks;
+  TaskGroup _group;
 #endif
 }; // ParallelTasks
 
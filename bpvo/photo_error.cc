@@ -1,6 +1,7 @@
 #include "bpvo/photo_error.h"
 #include "bpvo/imwarp.h"
 #include "bpvo/project_points.h"
+#include "bpvo/interp_avx2.h"
 #include "bpvo/simd.h"
 #include "bpvo/eigen.h"
 #include "bpvo/utils.h"
@@ -64,12 +65,38 @@ struct PhotoError::Impl
       r_ptr[i] = I1_ptr[i] - I0_ptr[i];
   }
 
+  void run(const float*, const float*, float*, int, int) const
+  {
+    THROW_ERROR("not supported");
+  }
+
+  void run(const float* const*, int, const float*, int, float*, int, int, int) const
+  {
+    THROW_ERROR("not supported");
+  }
+
+  void run(const float*, int, int, const float*, int, float*, int, int, int) const
+  {
+    THROW_ERROR("not supported");
+  }
+
+  void run(const int16_t*, float, int, int, const float*, int, float*, int, int, int) const
+  {
+    THROW_ERROR("not supported");
+  }
+
   void resize(size_t n)
   {
     _x.resize(n);
     _y.resize(n);
   }
 
+  void reserve(size_t n)
+  {
+    _x.reserve(n);
+    _y.reserve(n);
+  }
+
   std::vector<float> _x;
   std::vector<float> _y;
   cv::Mat _map1, _map2;
@@ -196,12 +223,41 @@ struct PhotoError::Impl
 
   }
 
+  void run(const float* I0_ptr, const float* I1_ptr, float* r_ptr, int begin, int end) const
+  {
+    for(int i = begin; i < end; ++i)
+      r_ptr[i - begin] = this->operator()(I1_ptr, i) - I0_ptr[i - begin];
+  }
+
+  void run(const float* const* I1_ptrs, int num_channels, const float* I0_ptr,
+           int I0_stride, float* r_ptr, int r_stride, int begin, int end) const
+  {
+    for(int c = 0; c < num_channels; ++c)
+      run(I0_ptr + c*I0_stride, I1_ptrs[c], r_ptr + c*r_stride, begin, end);
+  }
+
+  void run(const float*, int, int, const float*, int, float*, int, int, int) const
+  {
+    THROW_ERROR("not supported");
+  }
+
+  void run(const int16_t*, float, int, int, const float*, int, float*, int, int, int) const
+  {
+    THROW_ERROR("not supported");
+  }
+
   void resize(size_t N)
   {
     _interp_coeffs.resize(N);
     _inds.resize(N);
   }
 
+  void reserve(size_t N)
+  {
+    _interp_coeffs.reserve(N);
+    _inds.reserve(N);
+  }
+
   inline Vector4 load_data(const float* ptr, int i) const
   {
     auto p = ptr + _inds[i];
@@ -339,7 +395,18 @@ struct PhotoError::Impl
   typedef typename EigenAlignedContainer<Point2>::type Point2Vector;
 
   Impl(InterpolationType t)
-      : _interp_type(t) {}
+      : _interp_type(t), _use_avx2(t == kLinear && HasBilinearAvx2()) {}
+
+  inline void reserve(size_t n)
+  {
+    _x.reserve(n);
+    if(_use_avx2)
+    {
+      _inds.reserve(n);
+      _xf.reserve(n);
+      _yf.reserve(n);
+    }
+  }
 
   inline void init(const Matrix34& P_, const PointVector& X, ValidVector& valid,
                    int rows, int cols)
@@ -349,6 +416,13 @@ struct PhotoError::Impl
 
     _x.resize(X.size());
     valid.resize(X.size());
+    if(_use_avx2)
+    {
+      // tap indices and interpolation coefficients in SoA for the AVX2 kernel
+      _inds.resize(X.size());
+      _xf.resize(X.size());
+      _yf.resize(X.size());
+    }
     const Eigen::Matrix<double,3,4> P = P_.cast<double>();
     for(size_t i = 0; i < X.size(); ++i)
     {
@@ -356,6 +430,13 @@ struct PhotoError::Impl
       int xi = Floor(_x[i].x());
       int yi = Floor(_x[i].y());
       valid[i] = xi >= border_lo && xi < cols-border_hi && yi >= border_lo && yi < rows-1;
+
+      if(_use_avx2)
+      {
+        _inds[i] = valid[i] ? yi*cols + xi : 0;
+        _xf[i] = static_cast<float>(_x[i].x() - xi);
+        _yf[i] = static_cast<float>(_x[i].y() - yi);
+      }
     }
 
     _valid_ptr = valid.data();
@@ -364,7 +445,151 @@ struct PhotoError::Impl
 
   inline void run(const float* I0_ptr, const float* I1_ptr, float* r_ptr) const
   {
-    for(size_t i = 0; i < _x.size(); ++i)
+    run(I0_ptr, I1_ptr, r_ptr, 0, _x.size());
+  }
+
+  inline void run(const float* I0_ptr, const float* I1_ptr, float* r_ptr,
+                  int begin, int end) const
+  {
+    // I0_ptr and r_ptr start at point 'begin'
+    int n = 0;
+    if(_use_avx2)
+      n = BilinearResidualsAvx2(I1_ptr, _stride, _inds.data() + begin, _xf.data() + begin,
+                                _yf.data() + begin, _valid_ptr + begin, I0_ptr, r_ptr, end - begin);
+
+    runScalar(I0_ptr + n, I1_ptr, r_ptr + n, begin + n, end);
+  }
+
+  inline void run(const float* const* I1_ptrs, int num_channels, const float* I0_ptr,
+                  int I0_stride, float* r_ptr, int r_stride, int begin, int end) const
+  {
+    int n = 0;
+    if(_use_avx2)
+      n = BilinearResidualsAvx2(I1_ptrs, num_channels, _stride, _inds.data() + begin,
+                                _xf.data() + begin, _yf.data() + begin, _valid_ptr + begin,
+                                I0_ptr, I0_stride, r_ptr, r_stride, end - begin);
+
+    if(_interp_type == kLinear)
+    {
+      runLinear(I1_ptrs, num_channels, I0_ptr + n, I0_stride, r_ptr + n, r_stride,
+                begin + n, end);
+    } else
+    {
+      for(int c = 0; c < num_channels; ++c)
+        runScalar(I0_ptr + c*I0_stride + n, I1_ptrs[c], r_ptr + c*r_stride + n,
+                  begin + n, end);
+    }
+  }
+
+  inline void run(const float* I1_packed, int packed_stride, int num_channels,
+                  const float* I0_ptr, int I0_stride, float* r_ptr, int r_stride,
+                  int begin, int end) const
+  {
+    THROW_ERROR_IF( _interp_type != kLinear, "packed channels require linear interpolation" );
+
+    int n = 0;
+    if(_use_avx2)
+      n = BilinearResidualsPackedAvx2(I1_packed, packed_stride, num_channels, _stride,
+                                      _inds.data() + begin, _xf.data() + begin, _yf.data() + begin,
+                                      _valid_ptr + begin, I0_ptr, I0_stride, r_ptr, r_stride,
+                                      end - begin);
+
+    runPacked(I1_packed, 1.0f, packed_stride, num_channels, I0_ptr + n, I0_stride,
+              r_ptr + n, r_stride, begin + n, end);
+  }
+
+  inline void run(const int16_t* I1_packed, float inv_scale, int packed_stride, int num_channels,
+                  const float* I0_ptr, int I0_stride, float* r_ptr, int r_stride,
+                  int begin, int end) const
+  {
+    THROW_ERROR_IF( _interp_type != kLinear, "packed channels require linear interpolation" );
+
+    int n = 0;
+    if(_use_avx2)
+      n = BilinearResidualsPackedInt16Avx2(I1_packed, inv_scale, packed_stride, num_channels,
+                                           _stride, _inds.data() + begin, _xf.data() + begin,
+                                           _yf.data() + begin, _valid_ptr + begin, I0_ptr,
+                                           I0_stride, r_ptr, r_stride, end - begin);
+
+    runPacked(I1_packed, inv_scale, packed_stride, num_channels, I0_ptr + n, I0_stride,
+              r_ptr + n, r_stride, begin + n, end);
+  }
+
+ protected:
+  template <typename T> inline
+  void runPacked(const T* I1_packed, float scale, int packed_stride, int num_channels,
+                 const float* I0_ptr, int I0_stride, float* r_ptr, int r_stride,
+                 int begin, int end) const
+  {
+    for(int i = begin; i < end; ++i)
+    {
+      const int k = i - begin;
+      if(_valid_ptr[i])
+      {
+        double xf = _x[i].x();
+        double yf = _x[i].y();
+
+        int xi = Floor(xf);
+        int yi = Floor(yf);
+
+        xf -= (double) xi;
+        yf -= (double) yi;
+
+        const T* p0 = I1_packed + (yi*_stride + xi)*packed_stride;
+        const T* p1 = p0 + _stride*packed_stride;
+        const double wx = (1.0 - xf);
+        for(int c = 0; c < num_channels; ++c)
+        {
+          double Iw = (1.0 - yf) * (p0[c]*wx + p0[c + packed_stride]*xf) +
+              yf  * (p1[c]*wx + p1[c + packed_stride]*xf);
+          r_ptr[c*r_stride + k] = float( scale*Iw - (double) I0_ptr[c*I0_stride + k] );
+        }
+      } else
+      {
+        for(int c = 0; c < num_channels; ++c)
+          r_ptr[c*r_stride + k] = 0.0f;
+      }
+    }
+  }
+
+  inline void runLinear(const float* const* I1_ptrs, int num_channels, const float* I0_ptr,
+                        int I0_stride, float* r_ptr, int r_stride, int begin, int end) const
+  {
+    for(int i = begin; i < end; ++i)
+    {
+      const int k = i - begin;
+      if(_valid_ptr[i])
+      {
+        double xf = _x[i].x();
+        double yf = _x[i].y();
+
+        int xi = Floor(xf);
+        int yi = Floor(yf);
+
+        xf -= (double) xi;
+        yf -= (double) yi;
+
+        const int ii = yi*_stride + xi;
+        const double wx = (1.0 - xf);
+        for(int c = 0; c < num_channels; ++c)
+        {
+          const float* I1_ptr = I1_ptrs[c];
+          double Iw = (1.0 - yf) * (I1_ptr[ii        ]*wx + I1_ptr[ii+1]*xf) +
+              yf  * (I1_ptr[ii+_stride]*wx + I1_ptr[ii+_stride+1]*xf);
+          r_ptr[c*r_stride + k] = float( Iw - (double) I0_ptr[c*I0_stride + k] );
+        }
+      } else
+      {
+        for(int c = 0; c < num_channels; ++c)
+          r_ptr[c*r_stride + k] = 0.0f;
+      }
+    }
+  }
+
+  inline void runScalar(const float* I0_ptr, const float* I1_ptr, float* r_ptr,
+                        int begin, int end) const
+  {
+    for(int i = begin; i < end; ++i)
     {
       if(_valid_ptr[i])
       {
@@ -385,7 +610,7 @@ struct PhotoError::Impl
               double wx = (1.0 - xf);
               double Iw = (1.0 - yf) * (I1_ptr[ii        ]*wx + I1_ptr[ii+1]*xf) +
                   yf  * (I1_ptr[ii+_stride]*wx + I1_ptr[ii+_stride+1]*xf);
-              r_ptr[i] = float( Iw - (double) I0_ptr[i] );
+              r_ptr[i - begin] = float( Iw - (double) I0_ptr[i - begin] );
             } break;
 
           case kCosine:
@@ -402,7 +627,7 @@ struct PhotoError::Impl
               float Iw = Cy.dot(Eigen::Matrix<float,2,1>(
                       MapType(p1).dot(Cx),
                       MapType(p2).dot(Cx)));
-              r_ptr[i] = Iw - I0_ptr[i];
+              r_ptr[i - begin] = Iw - I0_ptr[i - begin];
             } break;
 
           case kCubic:
@@ -423,7 +648,7 @@ struct PhotoError::Impl
                       MapType(p2).dot(Cx),
                       MapType(p3).dot(Cx),
                       MapType(p4).dot(Cx)));
-              r_ptr[i] = Iw - I0_ptr[i];
+              r_ptr[i - begin] = Iw - I0_ptr[i - begin];
             } break;
 
           case kCubicHermite:
@@ -440,22 +665,25 @@ struct PhotoError::Impl
               V[3] = interpolateCubicHermite(p4, (float) xf);
 
               float Iw = interpolateCubicHermite(V.data(), (float) yf);
-              r_ptr[i] = Iw - I0_ptr[i];
+              r_ptr[i - begin] = Iw - I0_ptr[i - begin];
             } break;
         }
       } else
       {
-        r_ptr[i] = 0.0f;
+        r_ptr[i - begin] = 0.0f;
       }
     }
   }
 
- protected:
   int _stride;
   const typename ValidVector::value_type* _valid_ptr = NULL;
   Point2Vector _x;
 
   InterpolationType _interp_type;
+
+  bool _use_avx2;
+  std::vector<int> _inds;
+  typename AlignedVector<float>::type _xf, _yf;
 }; // PhotoError::Impl
 
 #endif
@@ -470,11 +698,44 @@ void PhotoError::init(const Matrix34& P, const PointVector& X, ValidVector& vali
   _impl->init(P, X, valid, rows, cols);
 }
 
+void PhotoError::reserve(int n)
+{
+  _impl->reserve(n);
+}
+
 void PhotoError::run(const float* I0_ptr, const float* I1_ptr, float* r_ptr) const
 {
   _impl->run(I0_ptr, I1_ptr, r_ptr);
 }
 
+void PhotoError::run(const float* I0_ptr, const float* I1_ptr, float* r_ptr,
+                     int begin, int end) const
+{
+  _impl->run(I0_ptr, I1_ptr, r_ptr, begin, end);
+}
+
+void PhotoError::run(const float* const* I1_ptrs, int num_channels, const float* I0_ptr,
+                     int I0_stride, float* r_ptr, int r_stride, int begin, int end) const
+{
+  _impl->run(I1_ptrs, num_channels, I0_ptr, I0_stride, r_ptr, r_stride, begin, end);
+}
+
+void PhotoError::run(const float* I1_packed, int packed_stride, int num_channels,
+                     const float* I0_ptr, int I0_stride, float* r_ptr, int r_stride,
+                     int begin, int end) const
+{
+  _impl->run(I1_packed, packed_stride, num_channels, I0_ptr, I0_stride, r_ptr, r_stride,
+             begin, end);
+}
+
+void PhotoError::run(const int16_t* I1_packed, float inv_scale, int packed_stride,
+                     int num_channels, const float* I0_ptr, int I0_stride, float* r_ptr,
+                     int r_stride, int begin, int end) const
+{
+  _impl->run(I1_packed, inv_scale, packed_stride, num_channels, I0_ptr, I0_stride,
+             r_ptr, r_stride, begin, end);
+}
+
 #undef PHOTO_ERROR_WITH_OPENCV
 #undef PHOTO_ERROR_OPT
 
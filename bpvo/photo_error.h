@@ -43,6 +43,11 @@ class PhotoError
    */
   void init(const Matrix34& pose, const PointVector& points, ValidVector& valid, int rows, int cols);
 
+  /**
+   * reserves the buffers of init for n points
+   */
+  void reserve(int n);
+
   /**
    * compute the vector of residuals by interpolating values from the current
    * image
@@ -55,6 +60,51 @@ class PhotoError
    */
   void run(const float* I0_ptr, const float* I1_ptr, float* r_ptr) const;
 
+  /**
+   * same as above for the points in [begin, end) only. I0_ptr and r_ptr point
+   * to the data of the point 'begin'
+   */
+  void run(const float* I0_ptr, const float* I1_ptr, float* r_ptr,
+           int begin, int end) const;
+
+  /**
+   * computes the residuals of several channels for the points [begin, end) in
+   * one pass. The warped location and interpolation coefficients of each point
+   * are computed once and used for all channels
+   *
+   * \param I1_ptrs      the channels of the input image
+   * \param num_channels the number of channels
+   * \param I0_ptr       template values of the point 'begin', channel c is at
+   *                     I0_ptr + c*I0_stride
+   * \param r_ptr        residuals of the point 'begin', channel c is stored at
+   *                     r_ptr + c*r_stride
+   */
+  void run(const float* const* I1_ptrs, int num_channels, const float* I0_ptr,
+           int I0_stride, float* r_ptr, int r_stride, int begin, int end) const;
+
+  /**
+   * same as above with the channels interleaved per pixel, as given by
+   * DenseDescriptor::getPackedChannels()
+   *
+   * \param I1_packed     the packed channels, offset to the first channel
+   * \param packed_stride number of floats per pixel
+   * \param num_channels  number of channels to use, at most 8
+   */
+  void run(const float* I1_packed, int packed_stride, int num_channels,
+           const float* I0_ptr, int I0_stride, float* r_ptr, int r_stride,
+           int begin, int end) const;
+
+  /**
+   * same as above with the packed channels in 16-bit fixed point, as given by
+   * DenseDescriptor::getPackedChannelsInt16()
+   *
+   * \param inv_scale converts the fixed point values to float, i.e.
+   *                  1 / DenseDescriptor::packedScale()
+   */
+  void run(const int16_t* I1_packed, float inv_scale, int packed_stride, int num_channels,
+           const float* I0_ptr, int I0_stride, float* r_ptr, int r_stride,
+           int begin, int end) const;
+
  protected:
   struct Impl;
   UniquePointer<Impl> _impl;
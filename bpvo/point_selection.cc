@@ -0,0 +1,132 @@
+/*
+   This file is part of bpvo.
+
+   bpvo is free software: you can redistribute it and/or modify
+   it under the terms of the Lesser GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   bpvo is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   Lesser GNU General Public License for more details.
+
+   You should have received a copy of the Lesser GNU General Public License
+   along with bpvo.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/*
+ * Contributor: halismai@cs.cmu.edu
+ */
+
+#include "bpvo/point_selection.h"
+#include <opencv2/core/core.hpp>
+#include <algorithm>
+
+namespace bpvo {
+
+int BucketedPointSelector::select(const cv::Mat& saliency, int bucket_size,
+                                  int max_points, std::vector<uint16_t>& inds,
+                                  std::vector<float>* values)
+{
+  const int n = (int) inds.size() / 2;
+  if(max_points <= 0 || n <= max_points)
+    return n;
+
+  if(bucket_size <= 0)
+    bucket_size = std::max(saliency.rows, saliency.cols);
+
+  const int bx = (saliency.cols + bucket_size - 1) / bucket_size,
+        by = (saliency.rows + bucket_size - 1) / bucket_size,
+        nb = bx * by;
+
+  auto bucket_of = [&](int i) {
+    return (inds[2*i + 0] / bucket_size) * bx + inds[2*i + 1] / bucket_size;
+  };
+
+  // counting sort of the candidates by bucket
+  _bucket_start.assign(nb + 1, 0);
+  for(int i = 0; i < n; ++i)
+    ++_bucket_start[ bucket_of(i) + 1 ];
+  for(int b = 0; b < nb; ++b)
+    _bucket_start[b + 1] += _bucket_start[b];
+
+  _bucket_fill.assign(_bucket_start.begin(), _bucket_start.end() - 1);
+  _order.resize(n);
+  for(int i = 0; i < n; ++i)
+    _order[ _bucket_fill[bucket_of(i)]++ ] = i;
+
+  auto count = [&](int b) { return _bucket_start[b + 1] - _bucket_start[b]; };
+
+  // distribute the budget, starting from the sparsest buckets so that what
+  // they do not use goes to the denser ones
+  _non_empty.resize(0);
+  for(int b = 0; b < nb; ++b)
+    if(count(b))
+      _non_empty.push_back(b);
+
+  std::sort(_non_empty.begin(), _non_empty.end(),
+            [&](int a, int b) { return count(a) < count(b); });
+
+  _bucket_quota.assign(nb, 0);
+  int remaining = max_points;
+  const int m = (int) _non_empty.size();
+  for(int k = 0; k < m; ++k)
+  {
+    const int b = _non_empty[k];
+    const int q = std::min(count(b), remaining / (m - k));
+    _bucket_quota[b] = q;
+    remaining -= q;
+  }
+
+  // left over from rounding
+  for(int k = m - 1; k >= 0 && remaining > 0; --k)
+  {
+    const int b = _non_empty[k];
+    if(_bucket_quota[b] < count(b)) {
+      ++_bucket_quota[b];
+      --remaining;
+    }
+  }
+
+  auto score = [&](int i) {
+    return saliency.ptr<const float>(inds[2*i + 0])[inds[2*i + 1]];
+  };
+
+  _keep.assign(n, 0);
+  for(int b = 0; b < nb; ++b)
+  {
+    const int q = _bucket_quota[b];
+    if(!q)
+      continue;
+
+    auto first = _order.begin() + _bucket_start[b],
+         last = _order.begin() + _bucket_start[b + 1];
+    if(q < count(b))
+      std::nth_element(first, first + (q - 1), last,
+                       [&](int i, int j) { return score(i) > score(j); });
+
+    for(auto it = first; it != first + q; ++it)
+      _keep[*it] = 1;
+  }
+
+  int num_kept = 0;
+  for(int i = 0; i < n; ++i)
+  {
+    if(_keep[i]) {
+      inds[2*num_kept + 0] = inds[2*i + 0];
+      inds[2*num_kept + 1] = inds[2*i + 1];
+      if(values)
+        (*values)[num_kept] = (*values)[i];
+      ++num_kept;
+    }
+  }
+
+  inds.resize(2*num_kept);
+  if(values)
+    values->resize(num_kept);
+  return num_kept;
+}
+
+}; // bpvo
@@ -0,0 +1,75 @@
+/*
+   This file is part of bpvo.
+
+   bpvo is free software: you can redistribute it and/or modify
+   it under the terms of the Lesser GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   bpvo is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   Lesser GNU General Public License for more details.
+
+   You should have received a copy of the Lesser GNU General Public License
+   along with bpvo.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/*
+ * Contributor: halismai@cs.cmu.edu
+ */
+
+#ifndef BPVO_POINT_SELECTION_H
+#define BPVO_POINT_SELECTION_H
+
+#include <cstdint>
+#include <vector>
+
+namespace cv {
+class Mat;
+}; // cv
+
+namespace bpvo {
+
+/**
+ * Selects at most a given number of points out of a list of candidates, while
+ * keeping them spread over the image.
+ *
+ * The image is split into square buckets. Each non-empty bucket gets a share of
+ * the budget (buckets with fewer candidates than their share give the rest to
+ * the others), and the candidates with the largest saliency are kept within
+ * each bucket. The work is linear in the number of candidates.
+ *
+ * The buffers are kept between calls, so the selector does not allocate once
+ * it has seen the largest input.
+ */
+class BucketedPointSelector
+{
+ public:
+  /**
+   * \param saliency the saliency map (float)
+   * \param bucket_size size of the buckets in pixels
+   * \param max_points the maximum number of points to keep
+   * \param inds interleaved (y,x) coordinates of the candidates. On return it
+   * contains the selected points, in the same order as the input
+   * \param values optional values per candidate (e.g. the disparity), kept
+   * for the selected points
+   *
+   * \return the number of selected points
+   */
+  int select(const cv::Mat& saliency, int bucket_size, int max_points,
+             std::vector<uint16_t>& inds, std::vector<float>* values = nullptr);
+
+ private:
+  std::vector<int> _bucket_start;
+  std::vector<int> _bucket_fill;
+  std::vector<int> _bucket_quota;
+  std::vector<int> _non_empty;
+  std::vector<int> _order;
+  std::vector<uint8_t> _keep;
+}; // BucketedPointSelector
+
+}; // bpvo
+
+#endif // BPVO_POINT_SELECTION_H
@@ -28,6 +28,8 @@
 #include <bpvo/mestimator.h>
 #include <bpvo/dense_descriptor.h>
 
+#include <algorithm>
+#include <chrono>
 #include <cmath>
 #include <limits>
 #include <vector>
@@ -180,7 +182,11 @@ class PoseEstimatorBase
   /**
    * set the parameters (options) for optimizer
    */
-  inline void setParameters(const PoseEstimatorParameters& p) { _params = p; }
+  inline void setParameters(const PoseEstimatorParameters& p)
+  {
+    _params = p;
+    _scale_estimator.setEstimatorType(p.scaleEstimator, p.scaleEstimatorSubsample);
+  }
 
   /**
    * \return the options for the optimizer
@@ -193,10 +199,40 @@ class PoseEstimatorBase
   inline const WeightsVector& getWeights() const { return _weights; }
 
   /**
-   * \return the most recently determined 'valid' pixels
+   * \return the most recently determined 'valid' pixels, one flag per point
+   * shared by all channels
    */
   inline const ValidVector& getValidFlags() const { return _valid; }
 
+  /**
+   * If false, the weights are not stored while optimizing and getWeights()
+   * will be stale. Use it when the weights are not needed after run()
+   */
+  inline void setStoreWeights(bool v) { _store_weights = v; }
+
+  typedef std::chrono::steady_clock Clock;
+
+  /**
+   * The following calls to run() stop iterating once the deadline has passed,
+   * with the status kTimeBudgetReached. The initial evaluation is always done
+   */
+  inline void setDeadline(const Clock::time_point& t)
+  {
+    _deadline = t;
+    _has_deadline = true;
+  }
+
+  inline void clearDeadline() { _has_deadline = false; }
+
+  /**
+   * \return true if the weights must be stored while optimizing. The active set
+   * needs them to find the points with zero weight
+   */
+  inline bool storeWeights() const
+  {
+    return _store_weights || _params.activeSetIterations > 0;
+  }
+
  protected:
   PoseEstimatorParameters _params;
   AutoScaleEstimator _scale_estimator;
@@ -205,6 +241,17 @@ class PoseEstimatorBase
   WeightsVector _weights;
   ValidVector _valid;
 
+  bool _store_weights = true;
+
+  Clock::time_point _deadline;
+  bool _has_deadline = false;
+
+  // subset of the template used by the iterations, see
+  // PoseEstimatorParameters::pointSubsampleStride and activeSetIterations
+  UniquePointer<TemplateData> _active_tdata;
+  std::vector<int> _active_inds;
+  std::vector<uint8_t> _num_invalid; //< consecutive evaluations a point was invalid
+
   float _f_norm_prev = 0.0f; //< previous value of the cost (to test convergence)
   float _g_tol = 0.0f;       //< tolrance to determine 1st-order convergence
   int _num_fun_evals = 0;    //< number of function evaluations
@@ -292,31 +339,117 @@ class PoseEstimatorBase
     _num_fun_evals = 0;
   }
 
-  inline void printResult(const OptimizerStatistics& s) const
+  /**
+   * allocates the subsets of 'tdata' upfront (subsampling and active set), they
+   * would otherwise grow on the first uses
+   */
+  inline void reserveActiveSet(const TemplateData* tdata)
   {
-    fprintf(stdout, "PoseEstimator: %d iters |F|=%g |G|=%g term reason: %s\n",
-            s.numIterations, s.finalError, s.firstOrderOptimality, ToString(s.status).c_str());
+    if(!_active_tdata || _active_tdata->parameters().interp != tdata->parameters().interp)
+      _active_tdata = make_unique<TemplateData>(tdata->pyramidLevel(), tdata->warp().K(),
+                                                tdata->warp().baseline(), tdata->parameters());
+
+    _active_tdata->reserveSubset(*tdata);
+    _active_inds.reserve(tdata->numPoints());
   }
 
   /**
-   * rpelicate the valid flags vector across all channels of the dense
-   * descriptor
+   * adds the residuals of the function evaluations made since num_fun_evals to
+   * the statistics
+   */
+  inline void countResiduals(const TemplateData* t, int num_fun_evals,
+                             OptimizerStatistics& s) const
+  {
+    s.numResidualEvaluations += (_num_fun_evals - num_fun_evals) * t->numPixels();
+  }
+
+  /**
+   * strided subset of the points of tdata, every 'stride' point
    *
-   * We need to this to simplify the work for the LinearSystemBuilder
+   * \return the template to use, which is tdata if stride is 1 or if there
+   * are too few points
    */
-  inline void replicateValidFlags()
+  const TemplateData* subsampleTemplate(const TemplateData* tdata, int stride)
   {
-    if(_residuals.size() != _valid.size()) {
-      int m = _residuals.size() / _valid.size(); // additional channels to replicate
-      decltype(_valid) tmp(_residuals.size());
-      auto* ptr = tmp.data();
+    const int n = stride > 1 ? (tdata->numPoints() / stride) & ~15 : 0;
+    if(n == 0)
+      return tdata;
 
-      for(int i = 0; i < m; ++i, ptr += _valid.size()) {
-        memcpy(ptr, _valid.data(), _valid.size() * sizeof(_valid[0]));
-      }
+    _active_inds.resize(n);
+    for(int i = 0; i < n; ++i)
+      _active_inds[i] = i * stride;
+
+    _active_tdata->setSubset(*tdata, _active_inds);
+    return _active_tdata.get();
+  }
 
-      _valid.swap(tmp);
+  /**
+   * counts the consecutive evaluations where each point was invalid. Called
+   * after evaluating all the points of the template
+   */
+  inline void updateInvalidCounts(int num_points)
+  {
+    for(int i = 0; i < num_points; ++i)
+      _num_invalid[i] = _valid[i] ? 0 : std::min(_num_invalid[i] + 1, 255);
+  }
+
+  /**
+   * drops the points with a zero weight in all channels, or that were invalid
+   * in the last two evaluations
+   *
+   * \return the template to use for the next iterations, which is 'tdata' if
+   * too few points can be dropped
+   */
+  const TemplateData* compactActiveSet(const TemplateData* tdata)
+  {
+    const int num_points = tdata->numPoints();
+    const int num_channels = tdata->numPixels() / num_points;
+    const float* w = _weights.data();
+
+    auto is_active = [=](int i) {
+      if(_num_invalid[i] >= 2)
+        return false;
+      if(!_valid[i])
+        return true;
+      for(int c = 0; c < num_channels; ++c)
+        if(w[c*num_points + i] > 0.0f)
+          return true;
+      return false;
+    };
+
+    int num_active = 0;
+    for(int i = 0; i < num_points; ++i)
+      num_active += is_active(i);
+
+    // copying the template is not worth it for a few points
+    if(num_active == 0 || num_active > num_points - num_points/8)
+      return tdata;
+
+    // some of the dropped points are kept to have a multiple of 16
+    int num_pad = (16 - num_active % 16) % 16;
+    _active_inds.resize(0);
+    for(int i = 0; i < num_points; ++i) {
+      if(is_active(i))
+        _active_inds.push_back(i);
+      else if(num_pad > 0) {
+        _active_inds.push_back(i);
+        --num_pad;
+      }
     }
+
+    _active_tdata->setSubset(*tdata, _active_inds);
+
+    // the scale is estimated with all the points only, it would shrink with
+    // the outliers removed
+    _scale_estimator.freezeScale();
+
+    return _active_tdata.get();
+  }
+
+  inline void printResult(const OptimizerStatistics& s) const
+  {
+    fprintf(stdout, "PoseEstimator: %d iters |F|=%g |G|=%g term reason: %s\n",
+            s.numIterations, s.finalError, s.firstOrderOptimality, ToString(s.status).c_str());
   }
 }; // PoseEstimatorBase
 
@@ -333,17 +466,44 @@ run(const TemplateData* tdata, const DenseDescriptor* desc, Matrix44& T)
   ret.status = PoseEstimationStatus::kMaxIterations;
   ret.numPixels = tdata->numPixels();
 
+  // the points used by the iterations. It is a strided subset of tdata for the
+  // first iterations if subsampling, and the active set after
+  // _params.activeSetIterations iterations over all the points
+  const TemplateData* active = tdata;
+  int stride = _params.pointSubsampleStride, num_stage_iterations = 0;
+  int num_full_iterations = 0;
+  if(stride > 1 || _params.activeSetIterations > 0) {
+    reserveActiveSet(tdata);
+    active = subsampleTemplate(tdata, stride);
+  }
+
+  if(active == tdata)
+    stride = 1;
+
   PoseEstimatorData data;
   data.T = T;
 
-  float f_norm = derived()->linearize(tdata, desc, data),
+  float f_norm = derived()->linearize(active, desc, data),
         g_norm = data.gradientNorm();
+  countResiduals(active, 0, ret);
 
+  // the gradient grows with the number of points, the tolerance is that of
+  // the whole template
+  const float g_scale = float(tdata->numPoints()) / active->numPoints();
   this->_g_tol = _params.gradientTolerance *
-      std::max(g_norm, std::sqrt(std::numeric_limits<float>::epsilon())),
+      std::max(g_scale * g_norm, std::sqrt(std::numeric_limits<float>::epsilon())),
 
   this->printHeader(f_norm, g_norm);
 
+  if(g_norm < _g_tol && active != tdata)
+  {
+    // the subset may look converged when all the points are not, check again
+    // with all of them
+    f_norm = derived()->linearize(tdata, desc, data);
+    g_norm = data.gradientNorm();
+    countResiduals(tdata, _num_fun_evals - 1, ret);
+  }
+
   if(g_norm < _g_tol)
   {
     ret.status = PoseEstimationStatus::kGradientTolReached;
@@ -369,6 +529,12 @@ run(const TemplateData* tdata, const DenseDescriptor* desc, Matrix44& T)
   float dp_norm_prev = 0.0f;
   bool has_converged = false;
 
+  if(_params.activeSetIterations > 0) {
+    _num_invalid.assign(tdata->numPoints(), 0);
+    if(active == tdata)
+      updateInvalidCounts(tdata->numPoints());
+  }
+
   data.T *= tdata->warp().paramsToPose(-data.dp);
 
   do {
@@ -379,19 +545,68 @@ run(const TemplateData* tdata, const DenseDescriptor* desc, Matrix44& T)
 
     has_converged = testConvergence(dp_norm, dp_norm_prev, g_norm, f_norm, ret.status);
 
+    if(stride > 1) {
+      // the convergence tests run with all the points only. The set grows
+      // after a few iterations, or sooner if the step is already small
+      if(has_converged || ++num_stage_iterations >= _params.pointSubsampleIterations) {
+        stride /= 2;
+        num_stage_iterations = 0;
+        active = subsampleTemplate(tdata, stride);
+        if(active == tdata)
+          stride = 1;
+      }
+
+      has_converged = false;
+    } else if(has_converged && active != tdata) {
+      // the dropped points may contribute again, convergence is declared with
+      // all of them
+      has_converged = false;
+      active = tdata;
+      num_full_iterations = 0;
+      std::fill(_num_invalid.begin(), _num_invalid.end(), 0);
+    }
+
     dp_norm_prev = dp_norm;
     _f_norm_prev = f_norm;
 
     if(!has_converged) {
-      if(!derived()->runIteration(tdata, desc, data, f_norm, ret.status)) {
+      if(_params.activeSetIterations > 0 && active == tdata &&
+         num_full_iterations >= _params.activeSetIterations)
+        active = compactActiveSet(tdata);
+
+      const int num_fun_evals = _num_fun_evals;
+      const bool ok = derived()->runIteration(active, desc, data, f_norm, ret.status);
+      countResiduals(active, num_fun_evals, ret);
+      if(!ok) {
         break;
       }
+
+      if(stride > 1)
+        ++ret.numSubsampledIterations;
+
+      if(_params.activeSetIterations > 0 && active == tdata) {
+        updateInvalidCounts(tdata->numPoints());
+        ++num_full_iterations;
+      }
     }
 
     data.T *= tdata->warp().paramsToPose(-data.dp);
 
   } while( ret.numIterations++ < _params.maxIterations && !has_converged &&
-          _num_fun_evals < _params.maxFuncEvals );
+          _num_fun_evals < _params.maxFuncEvals &&
+          !(_has_deadline && Clock::now() >= _deadline) );
+
+  if(!has_converged && ret.status == PoseEstimationStatus::kMaxIterations &&
+     _has_deadline && Clock::now() >= _deadline)
+    ret.status = PoseEstimationStatus::kTimeBudgetReached;
+
+  if(active != tdata && ret.status != PoseEstimationStatus::kSolverError) {
+    // stopped on a subset, evaluate all the points such that the error, the
+    // weights and the valid flags refer to the whole template
+    f_norm = derived()->linearize(tdata, desc, data);
+    g_norm = data.gradientNorm();
+    countResiduals(tdata, _num_fun_evals - 1, ret);
+  }
 
   if(ret.status != PoseEstimationStatus::kSolverError)
     T = data.T;
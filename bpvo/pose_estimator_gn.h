@@ -69,17 +69,23 @@ class PoseEstimatorGN : public PoseEstimatorBase< PoseEstimatorGN<TDataT> >
    */
   inline float linearize(const TemplateData* tdata, const DenseDescriptor* channels, PoseEstimatorData& data)
   {
-    tdata->computeResiduals(channels, data.T, Base::residuals(), Base::valid());
-    this->replicateValidFlags();
-    auto sigma = this->_scale_estimator.estimateScale(Base::residuals(), Base::valid());
-	if(std::isnan(sigma)) { return sigma; }
-
-    MEstimator::ComputeWeights(this->_params.lossFunction, Base::residuals(),
-                               Base::valid(), sigma, Base::weights());
+    // the residuals are stored only if the scale must be estimated again.
+    // Otherwise, everything is done in a single pass in TemplateData
+    const ResidualsVector* residuals = nullptr;
+    float sigma = this->_scale_estimator.getScale();
+    if(!this->_scale_estimator.isScaleStable())
+    {
+      tdata->computeResiduals(channels, data.T, Base::residuals(), Base::valid());
+      sigma = this->_scale_estimator.estimateScale(Base::residuals(), Base::valid());
+      if(std::isnan(sigma)) { return sigma; }
+
+      residuals = &Base::residuals();
+    }
 
     this->_num_fun_evals += 1;
-    return LinearSystemBuilder::Run(
-        tdata->jacobians(), Base::residuals(), Base::weights(), Base::valid(), &data.H, &data.G);
+    return tdata->linearize(channels, data.T, residuals, this->_params.lossFunction,
+                            sigma, Base::valid(), &data.H, &data.G,
+                            this->storeWeights() ? &Base::weights() : nullptr);
   }
 
   inline bool runIteration(const TemplateData* tdata, const DenseDescriptor* channels,
@@ -56,7 +56,6 @@ class PoseEstimatorLM : public PoseEstimatorBase< PoseEstimatorLM<TDataT> >
                          PoseEstimatorData& data, bool with_hessian = true)
   {
     tdata->computeResiduals(channels, data.T, Base::residuals(), Base::valid());
-    this->replicateValidFlags();
     auto sigma = this->_scale_estimator.estimateScale(Base::residuals(), Base::valid());
 	if(std::isnan(sigma)) { return sigma; }
 	
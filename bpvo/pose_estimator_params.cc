@@ -30,6 +30,11 @@ PoseEstimatorParameters::PoseEstimatorParameters(const AlgorithmParameters& p)
         , parameterTolerance(p.parameterTolerance)
         , gradientTolerance(p.gradientTolerance)
         , lossFunction(p.lossFunction)
+        , scaleEstimator(p.scaleEstimator)
+        , scaleEstimatorSubsample(p.scaleEstimatorSubsample)
+        , activeSetIterations(p.activeSetIterations)
+        , pointSubsampleStride(p.pointSubsampleStride)
+        , pointSubsampleIterations(p.pointSubsampleIterations)
         , verbosity(p.verbosity) {}
 
 
@@ -53,6 +58,11 @@ std::ostream& operator<<(std::ostream& os, const PoseEstimatorParameters& p)
   os << "parameterTolerance: " << p.parameterTolerance << "\n";
   os << "gradientTolerance: " << p.gradientTolerance << "\n";
   os << "lossFunction: " << ToString(p.lossFunction) << "\n";
+  os << "scaleEstimator: " << ToString(p.scaleEstimator) << "\n";
+  os << "scaleEstimatorSubsample: " << p.scaleEstimatorSubsample << "\n";
+  os << "activeSetIterations: " << p.activeSetIterations << "\n";
+  os << "pointSubsampleStride: " << p.pointSubsampleStride << "\n";
+  os << "pointSubsampleIterations: " << p.pointSubsampleIterations << "\n";
   os << "verbosity: " << ToString(p.verbosity);
   return os;
 }
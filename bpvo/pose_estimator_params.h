@@ -35,6 +35,11 @@ struct PoseEstimatorParameters
   float parameterTolerance  = 1e-6;
   float gradientTolerance   = 1e-6;
   LossFunctionType lossFunction = LossFunctionType::kHuber;
+  ScaleEstimatorType scaleEstimator = ScaleEstimatorType::kExactMedian;
+  bool scaleEstimatorSubsample = false;
+  int activeSetIterations = 0;
+  int pointSubsampleStride = 1;
+  int pointSubsampleIterations = 2;
 
   VerbosityType verbosity = VerbosityType::kSilent;
 
@@ -0,0 +1,173 @@
+/*
+   This file is part of bpvo.
+
+   bpvo is free software: you can redistribute it and/or modify
+   it under the terms of the Lesser GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   bpvo is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   Lesser GNU General Public License for more details.
+
+   You should have received a copy of the Lesser GNU General Public License
+   along with bpvo.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Contributor: halismai@cs.cmu.edu
+ */
+
+#include "bpvo/rank_update_avx2.h"
+#include "bpvo/cpu_features.h"
+#include "bpvo/vector6.h"
+#include "bpvo/debug.h"
+
+#include <immintrin.h>
+
+namespace bpvo {
+
+bool HasRankUpdateAvx2() { return HasSimdLevel(kSimdAVX2); }
+
+#if defined(__x86_64__) || defined(__i386__)
+
+namespace {
+
+struct Accumulators
+{
+  __m256 H[21];
+  __m256 G[6];
+  __m256 e;
+}; // Accumulators
+
+TARGET_ISA("avx2,fma") static inline
+void SetZero(Accumulators& a)
+{
+  for(int i = 0; i < 21; ++i) a.H[i] = _mm256_setzero_ps();
+  for(int i = 0; i < 6; ++i) a.G[i] = _mm256_setzero_ps();
+  a.e = _mm256_setzero_ps();
+}
+
+TARGET_ISA("avx2,fma") static inline
+void Accumulate(Accumulators& a, const __m256* J, __m256 w, __m256 r)
+{
+  const __m256 wr = _mm256_mul_ps(w, r);
+  for(int i = 0, k = 0; i < 6; ++i)
+  {
+    const __m256 wj = _mm256_mul_ps(w, J[i]);
+    for(int j = i; j < 6; ++j, ++k)
+      a.H[k] = _mm256_fmadd_ps(wj, J[j], a.H[k]);
+
+    a.G[i] = _mm256_fmadd_ps(wr, J[i], a.G[i]);
+  }
+
+  a.e = _mm256_fmadd_ps(wr, r, a.e);
+}
+
+TARGET_ISA("avx2,fma") static inline
+float HorizontalSum(__m256 v)
+{
+  __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+  s = _mm_add_ss(s, _mm_movehdup_ps(s));
+  return _mm_cvtss_f32(s);
+}
+
+TARGET_ISA("avx2,fma") static inline
+void Store(const Accumulators& a, float* H, float* G, float* res_sq_norm)
+{
+  for(int i = 0; i < 21; ++i) H[i] += HorizontalSum(a.H[i]);
+  for(int i = 0; i < 6; ++i) G[i] += HorizontalSum(a.G[i]);
+  *res_sq_norm += HorizontalSum(a.e);
+}
+
+/**
+ * transposes 8 rows of 8 floats, only the first 6 columns are returned
+ */
+TARGET_ISA("avx2,fma") static inline
+void Transpose8x6(const float* p, __m256* J)
+{
+  const __m256 r0 = _mm256_load_ps(p + 0*8), r1 = _mm256_load_ps(p + 1*8),
+        r2 = _mm256_load_ps(p + 2*8), r3 = _mm256_load_ps(p + 3*8),
+        r4 = _mm256_load_ps(p + 4*8), r5 = _mm256_load_ps(p + 5*8),
+        r6 = _mm256_load_ps(p + 6*8), r7 = _mm256_load_ps(p + 7*8);
+
+  const __m256 t0 = _mm256_unpacklo_ps(r0, r1), t1 = _mm256_unpackhi_ps(r0, r1),
+        t2 = _mm256_unpacklo_ps(r2, r3), t3 = _mm256_unpackhi_ps(r2, r3),
+        t4 = _mm256_unpacklo_ps(r4, r5), t5 = _mm256_unpackhi_ps(r4, r5),
+        t6 = _mm256_unpacklo_ps(r6, r7), t7 = _mm256_unpackhi_ps(r6, r7);
+
+  const __m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1,0,1,0)),
+        s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3,2,3,2)),
+        s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1,0,1,0)),
+        s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3,2,3,2)),
+        s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1,0,1,0)),
+        s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3,2,3,2)),
+        s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1,0,1,0)),
+        s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3,2,3,2));
+
+  J[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+  J[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+  J[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+  J[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+  J[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+  J[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+}
+
+} // namespace
+
+TARGET_ISA("avx2,fma")
+int RankUpdateAvx2(const float* const* J, const float* r, const float* w, int n,
+                   float* H, float* G, float* res_sq_norm)
+{
+  Accumulators acc;
+  SetZero(acc);
+
+  const int n8 = n & ~7;
+  for(int i = 0; i < n8; i += 8)
+  {
+    const __m256 J_i[6] = {
+      _mm256_loadu_ps(J[0] + i), _mm256_loadu_ps(J[1] + i),
+      _mm256_loadu_ps(J[2] + i), _mm256_loadu_ps(J[3] + i),
+      _mm256_loadu_ps(J[4] + i), _mm256_loadu_ps(J[5] + i) };
+
+    Accumulate(acc, J_i, _mm256_loadu_ps(w + i), _mm256_loadu_ps(r + i));
+  }
+
+  Store(acc, H, G, res_sq_norm);
+  return n8;
+}
+
+TARGET_ISA("avx2,fma")
+int RankUpdateAvx2(const Vector6* J, const float* r, const float* w, int n,
+                   float* H, float* G, float* res_sq_norm)
+{
+  static_assert(sizeof(Vector6) == 8*sizeof(float), "Vector6 must be padded to 8 floats");
+
+  Accumulators acc;
+  SetZero(acc);
+
+  const int n8 = n & ~7;
+  for(int i = 0; i < n8; i += 8)
+  {
+    __m256 J_i[6];
+    Transpose8x6(J[i].data(), J_i);
+    Accumulate(acc, J_i, _mm256_loadu_ps(w + i), _mm256_loadu_ps(r + i));
+  }
+
+  Store(acc, H, G, res_sq_norm);
+  return n8;
+}
+
+#else
+
+int RankUpdateAvx2(const float* const*, const float*, const float*, int,
+                   float*, float*, float*) { return 0; }
+
+int RankUpdateAvx2(const Vector6*, const float*, const float*, int,
+                   float*, float*, float*) { return 0; }
+
+#endif
+
+}; // bpvo
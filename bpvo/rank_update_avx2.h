@@ -0,0 +1,64 @@
+/*
+   This file is part of bpvo.
+
+   bpvo is free software: you can redistribute it and/or modify
+   it under the terms of the Lesser GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   bpvo is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   Lesser GNU General Public License for more details.
+
+   You should have received a copy of the Lesser GNU General Public License
+   along with bpvo.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Contributor: halismai@cs.cmu.edu
+ */
+
+#ifndef BPVO_RANK_UPDATE_AVX2_H
+#define BPVO_RANK_UPDATE_AVX2_H
+
+namespace bpvo {
+
+class Vector6;
+
+/**
+ * Adds points to the normal equations H += J'*W*J, G += J'*W*r 8 points at a
+ * time using AVX2 and FMA. Each step updates 21 accumulators for the upper
+ * triangle of H, 6 for G and one for the squared norm.
+ *
+ * The kernels are compiled for AVX2/FMA regardless of the compiler flags, the
+ * caller must check HasRankUpdateAvx2() first.
+ *
+ * \param J the 6 components of the Jacobians (SoA) of the n points
+ * \param r the residuals
+ * \param w the weights
+ * \param n number of points
+ * \param H the upper triangle of the hessian, row major [21]
+ * \param G the gradient [6]
+ * \param res_sq_norm the weighted sum of squared residuals
+ *
+ * \return the number of points processed, n rounded down to a multiple of 8
+ */
+int RankUpdateAvx2(const float* const* J, const float* r, const float* w, int n,
+                   float* H, float* G, float* res_sq_norm);
+
+/**
+ * Same as above with the Jacobians stored as Vector6 (AoS). Groups of 8
+ * Vector6 are transposed in registers
+ */
+int RankUpdateAvx2(const Vector6* J, const float* r, const float* w, int n,
+                   float* H, float* G, float* res_sq_norm);
+
+/**
+ * \return true if the CPU supports the kernels above
+ */
+bool HasRankUpdateAvx2();
+
+}; // bpvo
+
+#endif // BPVO_RANK_UPDATE_AVX2_H
@@ -106,6 +106,7 @@ class RigidBodyWarp : public WarpBase<RigidBodyWarp>
   }
 
   inline const Matrix33& K() const { return _K; }
+  inline float baseline() const { return _b; }
   inline const Matrix34& P() const { return _P; }
 
   inline void setPose(const Matrix44& T)
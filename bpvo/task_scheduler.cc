@@ -0,0 +1,285 @@
+/*
+   This file is part of bpvo.
+
+   bpvo is free software: you can redistribute it and/or modify
+   it under the terms of the Lesser GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   bpvo is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   Lesser GNU General Public License for more details.
+
+   You should have received a copy of the Lesser GNU General Public License
+   along with bpvo.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Contributor: halismai@cs.cmu.edu
+ */
+
+#include "bpvo/task_scheduler.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace bpvo {
+
+namespace {
+
+struct Task
+{
+  TaskScheduler::TaskFunction func;
+  void* context;
+  int index;
+  TaskGroup* group;
+}; // Task
+
+/**
+ * bounded deque of tasks. The owner pushes and pops at the back, thieves take
+ * from the front. When full, the caller runs the task itself
+ */
+class WorkQueue
+{
+ public:
+  static constexpr int Capacity = 256;
+
+  inline WorkQueue() : _head(0), _size(0) {}
+
+  inline bool push(const Task& t)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if(_size == Capacity)
+      return false;
+
+    _tasks[(_head + _size++) % Capacity] = t;
+    return true;
+  }
+
+  inline bool pop(Task& t)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if(_size == 0)
+      return false;
+
+    t = _tasks[(_head + --_size) % Capacity];
+    return true;
+  }
+
+  inline bool steal(Task& t)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    if(_size == 0)
+      return false;
+
+    t = _tasks[_head];
+    _head = (_head + 1) % Capacity;
+    --_size;
+    return true;
+  }
+
+ private:
+  std::mutex _mutex;
+  Task _tasks[Capacity];
+  int _head, _size;
+}; // WorkQueue
+
+// index of the worker in the queue array, 0 for threads outside the pool
+static thread_local int t_thread_index = 0;
+
+// number of times a thread waiting on a group looks for a task to run before
+// going to sleep
+static constexpr int MaxWaitSpins = 64;
+
+} // namespace
+
+struct TaskScheduler::Impl
+{
+  inline Impl() : _num_queued(0), _num_sleeping_waiters(0), _stop(false) {}
+
+  inline ~Impl() { stop(); }
+
+  void start(int num_threads)
+  {
+    // queue 0 is shared by the threads outside the pool
+    _queues.resize(num_threads);
+    for(auto& q : _queues)
+      q = make_unique<WorkQueue>();
+
+    _stop = false;
+    for(int i = 1; i < num_threads; ++i)
+      _workers.emplace_back([=]() { t_thread_index = i; workerLoop(i); });
+  }
+
+  void stop()
+  {
+    {
+      std::lock_guard<std::mutex> lock(_sleep_mutex);
+      _stop = true;
+    }
+    _sleep_cv.notify_all();
+
+    for(auto& w : _workers)
+      w.join();
+
+    _workers.clear();
+    _queues.clear();
+  }
+
+  inline int numThreads() const { return static_cast<int>(_queues.size()); }
+
+  inline void spawn(const Task& t)
+  {
+    const int i = t_thread_index < numThreads() ? t_thread_index : 0;
+    if(numThreads() == 1 || !_queues[i]->push(t)) {
+      run(t);
+      return;
+    }
+
+    _num_queued.fetch_add(1, std::memory_order_release);
+    {
+      // makes sure a worker about to sleep sees the new task
+      std::lock_guard<std::mutex> lock(_sleep_mutex);
+    }
+    _sleep_cv.notify_one();
+  }
+
+  /**
+   * takes a task from our own queue, otherwise steals from the others
+   */
+  inline bool getTask(int i, Task& t)
+  {
+    if(_num_queued.load(std::memory_order_acquire) == 0)
+      return false;
+
+    const int n = numThreads();
+    if(i < n && _queues[i]->pop(t)) {
+      _num_queued.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+    }
+
+    for(int k = 1; k <= n; ++k) {
+      if(_queues[(i + k) % n]->steal(t)) {
+        _num_queued.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  inline void run(const Task& t)
+  {
+    try {
+      t.func(t.context, t.index);
+    } catch(...) {
+      t.group->setException(std::current_exception());
+    }
+
+    // the group may be destroyed as soon as the count is zero, it must not be
+    // used after this
+    if(t.group->_num_pending.fetch_sub(1) == 1 && _num_sleeping_waiters.load() > 0) {
+      {
+        std::lock_guard<std::mutex> lock(_sleep_mutex);
+      }
+      _sleep_cv.notify_all();
+    }
+  }
+
+  void workerLoop(int i)
+  {
+    Task t;
+    for(;;)
+    {
+      if(getTask(i, t)) {
+        run(t);
+        continue;
+      }
+
+      std::unique_lock<std::mutex> lock(_sleep_mutex);
+      _sleep_cv.wait(lock, [=]() {
+                     return _stop || _num_queued.load(std::memory_order_acquire) > 0; });
+      if(_stop)
+        return;
+    }
+  }
+
+  void wait(TaskGroup* g)
+  {
+    Task t;
+    int num_spins = 0;
+    while(g->_num_pending.load(std::memory_order_acquire) > 0)
+    {
+      if(getTask(t_thread_index, t)) {
+        run(t);
+        num_spins = 0;
+      } else if(++num_spins < MaxWaitSpins) {
+        std::this_thread::yield();
+      } else {
+        // the remaining tasks of the group are running on other threads. Sleep
+        // until the last one is done or there are new tasks to help with
+        std::unique_lock<std::mutex> lock(_sleep_mutex);
+        _num_sleeping_waiters.fetch_add(1);
+        _sleep_cv.wait(lock, [=]() {
+                       return g->_num_pending.load() == 0 || _num_queued.load() > 0; });
+        _num_sleeping_waiters.fetch_sub(1);
+        num_spins = 0;
+      }
+    }
+  }
+
+  std::vector<UniquePointer<WorkQueue>> _queues;
+  std::vector<std::thread> _workers;
+
+  std::atomic<int> _num_queued;
+  std::atomic<int> _num_sleeping_waiters;
+  std::mutex _sleep_mutex;
+  std::condition_variable _sleep_cv;
+  bool _stop;
+}; // TaskScheduler::Impl
+
+static inline int DefaultNumThreads()
+{
+  int n = std::thread::hardware_concurrency();
+  return n > 0 ? n : 1;
+}
+
+TaskScheduler& TaskScheduler::Instance()
+{
+  static TaskScheduler scheduler;
+  return scheduler;
+}
+
+TaskScheduler::TaskScheduler()
+  : _impl(make_unique<Impl>())
+{
+  _impl->start(DefaultNumThreads());
+}
+
+TaskScheduler::~TaskScheduler() {}
+
+void TaskScheduler::setNumThreads(int n)
+{
+  n = n > 0 ? n : DefaultNumThreads();
+  if(n != _impl->numThreads()) {
+    _impl->stop();
+    _impl->start(n);
+  }
+}
+
+int TaskScheduler::numThreads() const { return _impl->numThreads(); }
+
+int TaskScheduler::threadIndex() const { return t_thread_index; }
+
+void TaskScheduler::spawn(TaskGroup* g, TaskFunction f, void* context, int index)
+{
+  g->_num_pending.fetch_add(1, std::memory_order_relaxed);
+  _impl->spawn(Task{f, context, index, g});
+}
+
+void TaskScheduler::wait(TaskGroup* g) { _impl->wait(g); }
+
+}; // bpvo
@@ -0,0 +1,161 @@
+/*
+   This file is part of bpvo.
+
+   bpvo is free software: you can redistribute it and/or modify
+   it under the terms of the Lesser GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   bpvo is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   Lesser GNU General Public License for more details.
+
+   You should have received a copy of the Lesser GNU General Public License
+   along with bpvo.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Contributor: halismai@cs.cmu.edu
+ */
+
+#ifndef BPVO_TASK_SCHEDULER_H
+#define BPVO_TASK_SCHEDULER_H
+
+#include <bpvo/types.h>
+#include <atomic>
+#include <exception>
+
+namespace bpvo {
+
+class TaskGroup;
+
+/**
+ * A persistent work-stealing scheduler shared by the library.
+ *
+ * Each worker owns a bounded deque of tasks. Workers pop from the back of their
+ * own deque and steal from the front of the others. Tasks spawned from outside
+ * the pool go to a shared queue that all workers steal from.
+ *
+ * Tasks are a function pointer, a context and an index, so spawning a task
+ * does not allocate memory. Threads waiting on a TaskGroup run pending tasks
+ * until the group is done, hence groups may be nested. When there is nothing
+ * left to run, they sleep until the group is done.
+ */
+class TaskScheduler
+{
+ public:
+  typedef void (*TaskFunction)(void* context, int index);
+
+ public:
+  /**
+   * \return the scheduler used by the library. The workers are started on the
+   * first call
+   */
+  static TaskScheduler& Instance();
+
+  ~TaskScheduler();
+
+  /**
+   * Sets the number of threads, including the calling thread. If n <= 0 the
+   * number of CPUs will be used, if n == 1 tasks run on the calling thread.
+   *
+   * This stops and restarts the workers, it must not be called while there
+   * are tasks in flight
+   */
+  void setNumThreads(int n);
+
+  /**
+   * \return the number of threads, including the calling thread
+   */
+  int numThreads() const;
+
+  /**
+   * \return the index of the calling thread, 0 for threads outside the pool
+   * and [1, numThreads()) for the workers
+   */
+  int threadIndex() const;
+
+ private:
+  TaskScheduler();
+  TaskScheduler(const TaskScheduler&) = delete;
+  TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+  friend class TaskGroup;
+
+  void spawn(TaskGroup*, TaskFunction, void*, int);
+  void wait(TaskGroup*);
+
+  struct Impl;
+  UniquePointer<Impl> _impl;
+}; // TaskScheduler
+
+/**
+ * A set of tasks that can be waited on. An exception thrown by a task is
+ * caught and rethrown by wait()
+ */
+class TaskGroup
+{
+ public:
+  inline TaskGroup() : _num_pending(0), _has_exception(false) {}
+
+  /**
+   * waits for the remaining tasks. An exception that was not rethrown by wait()
+   * is dropped
+   */
+  inline ~TaskGroup()
+  {
+    if(_num_pending.load(std::memory_order_acquire) > 0)
+      TaskScheduler::Instance().wait(this);
+  }
+
+  /**
+   * runs f(context, index) on the scheduler
+   */
+  inline void run(TaskScheduler::TaskFunction f, void* context, int index)
+  {
+    TaskScheduler::Instance().spawn(this, f, context, index);
+  }
+
+  /**
+   * waits for all tasks in the group to finish. The calling thread runs
+   * pending tasks in the meantime.
+   *
+   * Rethrows the first exception thrown by a task of the group
+   */
+  inline void wait()
+  {
+    if(_num_pending.load(std::memory_order_acquire) > 0)
+      TaskScheduler::Instance().wait(this);
+
+    if(_has_exception.load(std::memory_order_acquire)) {
+      std::exception_ptr e;
+      std::swap(e, _exception);
+      _has_exception.store(false, std::memory_order_relaxed);
+      std::rethrow_exception(e);
+    }
+  }
+
+ private:
+  TaskGroup(const TaskGroup&) = delete;
+  TaskGroup& operator=(const TaskGroup&) = delete;
+
+  /**
+   * keeps the first exception only. Called before the task is counted as done
+   */
+  inline void setException(std::exception_ptr e)
+  {
+    bool expected = false;
+    if(_has_exception.compare_exchange_strong(expected, true))
+      _exception = e;
+  }
+
+  friend class TaskScheduler;
+  std::atomic<int> _num_pending;
+  std::atomic<bool> _has_exception;
+  std::exception_ptr _exception;
+}; // TaskGroup
+
+}; // bpvo
+
+#endif // BPVO_TASK_SCHEDULER_H
@@ -22,7 +22,10 @@
 #include "bpvo/template_data.h"
 #include "bpvo/dense_descriptor.h"
 #include "bpvo/imgproc.h"
+#include "bpvo/linear_system_builder.h"
+#include "bpvo/mestimator.h"
 #include "bpvo/parallel.h"
+#include "bpvo/task_scheduler.h"
 #include "bpvo/utils.h"
 
 namespace bpvo {
@@ -34,47 +37,149 @@ TemplateData::TemplateData(int pyr_level, const Matrix33& K, float b,
   THROW_ERROR_IF( _pyr_level < 0, "pyramid level must be >= 0" );
 }
 
-void TemplateData::setData(const DenseDescriptor* desc, const cv::Mat& D)
+int TemplateData::selectPixels(const DenseDescriptor* desc)
 {
-  cv::Mat saliency_map;
+  return selectPixels(desc, nullptr);
+}
+
+int TemplateData::selectPixels(const DenseDescriptor* desc, const cv::Mat* D)
+{
+  auto& saliency_map = _saliency_map;
   desc->computeSaliencyMap(saliency_map);
 
-  int rows = desc->rows(), cols = desc->cols();
-  IsLocalMax<float> is_local_max(nullptr, cols, -1);
-  if(rows*cols >= _params.minNumPixelsForNonMaximaSuppression)
-  {
-    is_local_max.setPointer( saliency_map.ptr<const float>() );
-    is_local_max.setStride( saliency_map.cols );
-    is_local_max.setRadius( _params.nonMaxSuppRadius );
+  const int rows = desc->rows(), cols = desc->cols();
+  const bool do_nms = rows*cols >= _params.minNumPixelsForNonMaximaSuppression;
+  _nms.setRadius( do_nms ? _params.nonMaxSuppRadius : 0 );
+  _nms.setMinSaliency( _params.minSaliency );
+  _nms.setBorder( std::max(_params.nonMaxSuppRadius, 3) );
+
+  auto& inds = _selected_pixels;
+  if(D) {
+    // D is at full resolution and may be a borrowed view with padded rows
+    const NonMaxSuppression::Disparity disparity{
+      D, 1 << _pyr_level, _params.minValidDisparity, _params.maxValidDisparity};
+    _nms.run(saliency_map, disparity, inds, _selected_disparities);
+  } else {
+    _nms.run(saliency_map, inds);
   }
 
-  const int border = std::max(_params.nonMaxSuppRadius, 3);
+  if(_params.maxPointsPerLevel > 0)
+    _point_selector.select(saliency_map, _params.pointSelectionBucketSize,
+                           _params.maxPointsPerLevel, inds,
+                           D ? &_selected_disparities : nullptr);
+
+  return (int) inds.size() / 2;
+}
+
+void TemplateData::setData(const DenseDescriptor* desc, const cv::Mat& D)
+{
+  selectPixels(desc, &D);
+
+  const auto& disparities = _selected_disparities;
+  setTemplateData(desc, [&disparities](int i, int /*y*/, int /*x*/)
+                  {
+                    return disparities[i];
+                  });
+}
+
+void TemplateData::setData(const DenseDescriptor* desc, const float* disparities)
+{
+  setTemplateData(desc, [=](int i, int /*y*/, int /*x*/) { return disparities[i]; });
+}
+
+namespace {
 
-  std::vector<uint16_t> inds;
-  inds.reserve( saliency_map.rows * saliency_map.cols * 0.5 );
-  for(int y = border; y < saliency_map.rows - border - 1; ++y)
+/**
+ * copies the pixels and computes the Jacobians of one channel of the template
+ */
+class TemplateChannelsBody
+{
+ public:
+  typedef TemplateData::Warp Warp;
+  typedef TemplateData::PointVector PointVector;
+  typedef TemplateData::Jacobian Jacobian;
+
+ public:
+  TemplateChannelsBody(const DenseDescriptor* desc, const Warp& warp,
+                       GradientEstimationType gradient_estimation,
+                       const PointVector& points, const int* inds, float* pixels,
+                       float* IxIy, Jacobian* jacobians)
+      : _desc(desc), _warp(warp), _gradient_estimation(gradient_estimation)
+      , _points(points), _inds(inds), _pixels(pixels), _IxIy(IxIy)
+      , _jacobians(jacobians) {}
+
+  static void Run(void* body, int c)
+  {
+    static_cast<const TemplateChannelsBody*>(body)->run(c);
+  }
+
+  void run(int c) const
   {
-    auto srow = saliency_map.ptr<const float>(y);
-    for(int x = border; x < saliency_map.cols - border - 1; ++x)
+    constexpr float NN = 1.0f / 18.0f;
+
+    const int num_points = _points.size(), cols = _desc->cols();
+    auto c_ptr = _desc->getChannel(c).ptr<const float>();
+    auto P_ptr = _pixels + c*num_points;
+    auto IxIy = _IxIy + 2*c*num_points;
+
+    for(int i = 0; i < num_points; ++i)
     {
-      if(srow[x] >= _params.minSaliency && is_local_max(y,x))
+      auto ii = _inds[i];
+      P_ptr[i] = c_ptr[ii];
+
+      auto* cc = c_ptr + ii;
+
+      switch(_gradient_estimation)
       {
-        inds.push_back(y);
-        inds.push_back(x);
+        case kCentralDifference_3:
+          {
+            IxIy[2*i+0] = 0.5f * ( *(cc+1) - *(cc-1) );
+            IxIy[2*i+1] = 0.5f * ( *(cc+cols) - *(cc-cols) );
+          } break;
+
+        case kCentralDifference_5:
+          {
+            IxIy[2*i+0] = NN * (1.0f*cc[-2] - 8.0f*cc[-1] + 8.0f*cc[1] - 1.0f*cc[2]);
+            IxIy[2*i+1] = NN * (1.0f*cc[-2*cols] - 8.0f*cc[-1*cols] + 8.0f*cc[+1*cols] - 1.0f*cc[2*cols]);
+          } break;
       }
     }
+
+    auto J_ptr = _jacobians + c*num_points;
+    int i = _warp.computeJacobian(_points, IxIy, J_ptr->data());
+    for( ; i < num_points; ++i)
+      _warp.jacobian(_points[i], IxIy[2*i+0], IxIy[2*i+1], J_ptr[i].data());
   }
 
-  std::vector<int> valid_inds;
+ private:
+  const DenseDescriptor* _desc;
+  const Warp& _warp;
+  GradientEstimationType _gradient_estimation;
+  const PointVector& _points;
+  const int* _inds;
+  float* _pixels;
+  float* _IxIy;
+  Jacobian* _jacobians;
+}; // TemplateChannelsBody
+
+}; // namespace
+
+template <class DisparityFunc>
+void TemplateData::setTemplateData(const DenseDescriptor* desc, DisparityFunc disparity)
+{
+  const auto& inds = _selected_pixels;
+  const int cols = desc->cols();
+
+  auto& valid_inds = _valid_inds;
+  valid_inds.resize(0);
   valid_inds.reserve(inds.size()/2);
 
   _points.resize(0);
   _points.reserve(inds.size()/2);
-  auto D_ptr = D.ptr<const float>();
   for(size_t i = 0; i < inds.size(); i += 2)
   {
     int y = inds[i + 0], x = inds[i + 1];
-    auto d = D_ptr[ (1 << _pyr_level) * (y*D.cols + x) ];
+    auto d = disparity(i/2, y, x);
     if(d >= _params.minValidDisparity && d <= _params.maxValidDisparity)
     {
       _points.push_back( _warp.makePoint(x, y, d) );
@@ -99,70 +204,167 @@ void TemplateData::setData(const DenseDescriptor* desc, const cv::Mat& D)
   dprintf("\nnum_points %d (%d) [level %d] %f\n",
          num_points, (int) inds.size()/2, _pyr_level, _params.minSaliency);
 
-  constexpr float NN = 1.0f / 18.0f;
+  // each channel has its own slice of the gradients, they are independent
+  _IxIy.resize(2 * num_channels * num_points);
+  TemplateChannelsBody body(desc, _warp, _params.gradientEstimation, _points,
+                            valid_inds.data(), _pixels.data(), _IxIy.data(),
+                            _jacobians.data());
+  {
+    TaskGroup group;
+    for(int c = 1; c < num_channels; ++c)
+      group.run(&TemplateChannelsBody::Run, &body, c);
+
+    body.run(0);
+    group.wait();
+  }
+
+  // NOTE: we push an empty Jacobian at the end because of SSE code loading
+  // We won't need to this when switching to Vector6
+  _jacobians.push_back(Jacobian::Zero());
+
+  if(NormalEquationsAccumulator::SupportsSoA())
+    _jacobians_soa.assign(_jacobians.data(), num_channels * num_points);
+  else
+    _jacobians_soa.clear();
+}
+
+void TemplateData::reserveSubset(const TemplateData& src)
+{
+  _points.reserve(src.numPoints());
+  _pixels.reserve(src.numPixels());
+  _jacobians.reserve(src.numPixels() + 1);
+  _jacobians_soa.reserve(src.numPixels());
+  _photo_error.reserve(src.numPoints());
+}
+
+void TemplateData::setSubset(const TemplateData& src, const std::vector<int>& inds)
+{
+  THROW_ERROR_IF( inds.size() % 16, "number of points must be a multiple of 16" );
+
+  _pyr_level = src._pyr_level;
+  _params = src._params;
+  _warp = src._warp;
+
+  const int num_points = inds.size(), src_num_points = src.numPoints();
+  const int num_channels = src_num_points ? src.numPixels() / src_num_points : 0;
+
+  reserveSubset(src);
+
+  _points.resize(num_points);
+  _pixels.resize(num_channels * num_points);
+  _jacobians.resize(num_channels * num_points + 1);
+
+  for(int i = 0; i < num_points; ++i)
+    _points[i] = src._points[inds[i]];
 
-  typename AlignedVector<float>::type IxIy(2*num_points);
   for(int c = 0; c < num_channels; ++c)
   {
-    auto c_ptr = desc->getChannel(c).ptr<const float>();
-    auto P_ptr = _pixels.data() + c*num_points;
+    const float* I0 = src._pixels.data() + c*src_num_points;
+    const Jacobian* J0 = src._jacobians.data() + c*src_num_points;
+    float* I = _pixels.data() + c*num_points;
+    Jacobian* J = _jacobians.data() + c*num_points;
+    for(int i = 0; i < num_points; ++i) {
+      I[i] = I0[inds[i]];
+      J[i] = J0[inds[i]];
+    }
+  }
 
-    for(int i = 0; i < num_points; ++i)
-    {
-      auto ii = valid_inds[i];
-      P_ptr[i] = c_ptr[ii];
+  _jacobians.back() = Jacobian::Zero();
 
-      auto* cc = c_ptr + ii;
+  if(!src._jacobians_soa.empty())
+  {
+    _jacobians_soa.resize(num_channels * num_points);
+    float J[6];
+    for(int c = 0; c < num_channels; ++c)
+      for(int i = 0; i < num_points; ++i) {
+        src._jacobians_soa.get(c*src_num_points + inds[i], J);
+        _jacobians_soa.set(c*num_points + i, J);
+      }
+  } else
+    _jacobians_soa.clear();
+}
 
-      switch(_params.gradientEstimation)
-      {
-        case kCentralDifference_3:
-          {
-            IxIy[2*i+0] = 0.5f * ( *(cc+1) - *(cc-1) );
-            IxIy[2*i+1] = 0.5f * ( *(cc+cols) - *(cc-cols) );
-          } break;
+namespace {
 
-        case kCentralDifference_5:
-          {
-            IxIy[2*i+0] = NN * (1.0f*cc[-2] - 8.0f*cc[-1] + 8.0f*cc[1] - 1.0f*cc[2]);
-            IxIy[2*i+1] = NN * (1.0f*cc[-2*cols] - 8.0f*cc[-1*cols] + 8.0f*cc[+1*cols] - 1.0f*cc[2*cols]);
-          } break;
-      }
-    }
+static constexpr int FusedBlockSize = 64;
+static constexpr int FusedChannels = 8;
+static constexpr int MaxFusedChunks = 64;
+static constexpr int MinResidualsPerFusedChunk = 4096;
 
-    auto J_ptr = _jacobians.data() + c*num_points;
-    int i = _warp.computeJacobian(_points, IxIy.data(), J_ptr->data());
-    for( ; i < num_points; ++i)
-      _warp.jacobian(_points[i], IxIy[2*i+0], IxIy[2*i+1], J_ptr[i].data());
+/**
+ * \return true if we can use the packed channels of the descriptor
+ */
+static inline bool UsePackedChannels(const DenseDescriptor* desc, InterpolationType interp)
+{
+  return interp == kLinear &&
+      (desc->getPackedChannels() || desc->getPackedChannelsInt16());
+}
+
+/**
+ * interpolates up to FusedChannels channels of the points [begin, end) in one
+ * pass, such that the warped location of a point is used for all of them.
+ * Residuals of channel c are stored at r_ptr + (c - c0)*r_stride
+ *
+ * If 'packed' is true, the channels are read from the packed layout
+ */
+static inline void ComputeChannelResiduals(const DenseDescriptor* desc, bool packed,
+                                           const PhotoError& photo_error, int num_points,
+                                           const float* pixels, int c0, int num_channels,
+                                           float* r_ptr, int r_stride, int begin, int end)
+{
+  if(packed) {
+    const float* I0_ptr = pixels + c0*num_points + begin;
+    if(desc->getPackedChannelsInt16())
+      photo_error.run(desc->getPackedChannelsInt16() + c0, 1.0f / desc->packedScale(),
+                      desc->packedStride(), num_channels, I0_ptr, num_points,
+                      r_ptr, r_stride, begin, end);
+    else
+      photo_error.run(desc->getPackedChannels() + c0, desc->packedStride(), num_channels,
+                      I0_ptr, num_points, r_ptr, r_stride, begin, end);
+    return;
   }
 
-  // NOTE: we push an empty Jacobian at the end because of SSE code loading
-  // We won't need to this when switching to Vector6
-  _jacobians.push_back(Jacobian::Zero());
+  const float* I1_ptrs[FusedChannels];
+  for(int c = 0; c < num_channels; ++c)
+    I1_ptrs[c] = desc->getChannel(c0 + c).ptr<const float>();
+
+  photo_error.run(I1_ptrs, num_channels, pixels + c0*num_points + begin, num_points,
+                  r_ptr, r_stride, begin, end);
 }
 
-namespace {
+/**
+ * number of tasks for n residuals
+ */
+static inline int NumFusedChunks(int n)
+{
+  return std::max(1, std::min(std::min(TaskScheduler::Instance().numThreads(), MaxFusedChunks),
+                              n / MinResidualsPerFusedChunk));
+}
 
 struct ComputeResidualsBody : public ParallelForBody
 {
  public:
-  ComputeResidualsBody(const DenseDescriptor* desc, const PhotoError& photo_error,
-                       int num_points, const float* pixels, float* residuals)
-      : ParallelForBody(), _desc(desc), _photo_error(photo_error)
+  ComputeResidualsBody(const DenseDescriptor* desc, bool packed,
+                       const PhotoError& photo_error, int num_points,
+                       const float* pixels, float* residuals)
+      : ParallelForBody(), _desc(desc), _packed(packed), _photo_error(photo_error)
       , _num_points(num_points), _pixels(pixels), _residuals(residuals) {}
 
   inline void operator()(const Range& range) const
   {
-    for(int c = range.begin(); c != range.end(); ++c)
+    const int num_channels = _desc->numChannels();
+    for(int c0 = 0; c0 < num_channels; c0 += FusedChannels)
     {
-      int off = c*_num_points;
-      const float* I1_ptr = _desc->getChannel(c).ptr<const float>();
-      _photo_error.run(_pixels + off, I1_ptr, _residuals + off);
+      ComputeChannelResiduals(_desc, _packed, _photo_error, _num_points, _pixels, c0,
+                              std::min(FusedChannels, num_channels - c0),
+                              _residuals + c0*_num_points + range.begin(), _num_points,
+                              range.begin(), range.end());
     }
   }
 
  protected:
   const DenseDescriptor* _desc;
+  const bool _packed;
   const PhotoError& _photo_error;
   const int _num_points;
   const float* _pixels;
@@ -182,10 +384,148 @@ void TemplateData::computeResiduals(const DenseDescriptor* desc, const Matrix44&
 
   _photo_error.init(_warp.P(), _points, valid, desc->rows(), desc->cols());
 
-  ComputeResidualsBody func(desc, _photo_error, _points.size(),
-                            _pixels.data(), residuals.data());
+  ComputeResidualsBody func(desc, UsePackedChannels(desc, _params.interp), _photo_error,
+                            _points.size(), _pixels.data(), residuals.data());
+
+  // the points are split, each task does all the channels
+  parallel_for(Range(0, numPoints()), func, NumFusedChunks(_pixels.size()));
+}
+
+namespace {
+
+/**
+ * Does the work of TemplateData::linearize over the points [begin, end) of
+ * all channels. Residual k is point k % num_points of channel k / num_points
+ */
+class FusedLinearizeBody
+{
+ public:
+  typedef TemplateData::Jacobian Jacobian;
+
+  struct Chunk
+  {
+    NormalEquationsAccumulator acc;
+    int begin = 0, end = 0;
+  }; // Chunk
+
+ public:
+  FusedLinearizeBody(const DenseDescriptor* desc, bool packed,
+                     const PhotoError& photo_error, int num_points, const float* pixels,
+                     const Jacobian* J, const TemplateData::JacobianSoAType* J_soa,
+                     const float* residuals, const ValidVector& valid,
+                     LossFunctionType loss, float sigma, float* weights, Chunk* chunks)
+      : _desc(desc), _packed(packed), _photo_error(photo_error), _num_points(num_points)
+      , _num_channels(desc->numChannels()), _pixels(pixels), _J(J), _J_soa(J_soa)
+      , _residuals(residuals), _valid(valid.data()), _loss(loss), _sigma(sigma)
+      , _weights(weights), _chunks(chunks) {}
+
+  static void Run(void* self, int i)
+  {
+    auto body = static_cast<const FusedLinearizeBody*>(self);
+    body->run(body->_chunks[i]);
+  }
+
+  void run(Chunk& chunk) const
+  {
+    alignas(32) float r_buf[FusedChannels * FusedBlockSize];
+    alignas(32) float w_buf[FusedBlockSize];
+
+    for(int i = chunk.begin; i < chunk.end; i += FusedBlockSize)
+    {
+      const int n = std::min(FusedBlockSize, chunk.end - i);
+      for(int c0 = 0; c0 < _num_channels; c0 += FusedChannels)
+      {
+        const int nc = std::min(FusedChannels, _num_channels - c0);
+        if(!_residuals) {
+          ComputeChannelResiduals(_desc, _packed, _photo_error, _num_points, _pixels, c0, nc,
+                                  r_buf, FusedBlockSize, i, i + n);
+        }
+
+        for(int c = c0; c < c0 + nc; ++c)
+        {
+          const int k = c*_num_points + i;
+          const float* r = _residuals ? _residuals + k : r_buf + (c - c0)*FusedBlockSize;
+
+          MEstimator::ComputeWeights(_loss, r, n, _sigma, w_buf);
+          for(int j = 0; j < n; ++j)
+            w_buf[j] *= static_cast<float>(_valid[i + j]);
+
+          if(_weights)
+            memcpy(_weights + k, w_buf, n * sizeof(float));
+
+          if(_J_soa)
+            chunk.acc.add(*_J_soa, k, r, w_buf, n);
+          else
+            chunk.acc.add(_J + k, r, w_buf, n);
+        }
+      }
+    }
+  }
+
+ private:
+  const DenseDescriptor* _desc;
+  const bool _packed;
+  const PhotoError& _photo_error;
+  const int _num_points;
+  const int _num_channels;
+  const float* _pixels;
+  const Jacobian* _J;
+  const TemplateData::JacobianSoAType* _J_soa; // null if not used
+  const float* _residuals;
+  const ValidVector::value_type* _valid;
+  LossFunctionType _loss;
+  float _sigma;
+  float* _weights;
+  Chunk* _chunks;
+}; // FusedLinearizeBody
+
+}; // namespace
+
+float TemplateData::linearize(const DenseDescriptor* desc, const Matrix44& pose,
+                              const ResidualsVector* residuals, LossFunctionType loss,
+                              float sigma, ValidVector& valid, Hessian* H, Gradient* G,
+                              WeightsVector* weights) const
+{
+  THROW_ERROR_IF( numPoints() == 0, "you should call setData before calling linearize" );
+
+  if(!residuals) {
+    _warp.setPose(pose);
+    _photo_error.init(_warp.P(), _points, valid, desc->rows(), desc->cols());
+  } else {
+    THROW_ERROR_IF( residuals->size() != _pixels.size(), "residuals size mismatch" );
+  }
+
+  const int n = static_cast<int>(_pixels.size());
+  if(weights)
+    weights->resize(n);
+
+  const int n_chunks = NumFusedChunks(n);
+  const int num_points = numPoints();
+
+  FusedLinearizeBody::Chunk chunks[MaxFusedChunks];
+  FusedLinearizeBody body(desc, UsePackedChannels(desc, _params.interp), _photo_error,
+                          num_points, _pixels.data(),
+                          _jacobians.data(), _jacobians_soa.empty() ? nullptr : &_jacobians_soa,
+                          residuals ? residuals->data() : nullptr,
+                          valid, loss, sigma, weights ? weights->data() : nullptr, chunks);
+  {
+    TaskGroup group;
+    for(int c = 0; c < n_chunks; ++c)
+    {
+      chunks[c].begin = (c*num_points) / n_chunks;
+      chunks[c].end = ((c+1)*num_points) / n_chunks;
+      if(c > 0)
+        group.run(&FusedLinearizeBody::Run, &body, c);
+    }
+
+    body.run(chunks[0]);
+    group.wait();
+  }
+
+  for(int c = 1; c < n_chunks; ++c)
+    chunks[0].acc.add(chunks[c].acc);
 
-  parallel_for(Range(0, desc->numChannels()), func);
+  return std::sqrt(chunks[0].acc.get(H, G));
 }
 
 }; // bpvo
@@ -24,6 +24,9 @@
 
 #include <bpvo/rigid_body_warp.h>
 #include <bpvo/photo_error.h>
+#include <bpvo/jacobian_soa.h>
+#include <bpvo/nonmax_suppression.h>
+#include <bpvo/point_selection.h>
 #include <bpvo/types.h>
 
 namespace cv {
@@ -45,9 +48,13 @@ class TemplateData
   typedef typename WarpType::Jacobian Jacobian;
   typedef typename WarpType::PointVector PointVector;
   typedef typename WarpType::JacobianVector JacobianVector;
+  typedef JacobianSoA<6> JacobianSoAType;
 
   typedef ResidualsVector PixelVector;
 
+  typedef Eigen::Matrix<float, 6, 6> Hessian;
+  typedef Eigen::Matrix<float, 6, 1> Gradient;
+
  public:
   /**
    * \param K the intrinsics matrix
@@ -62,9 +69,66 @@ class TemplateData
    */
   void setData(const DenseDescriptor*, const cv::Mat& disparity);
 
+  /**
+   * First step of a two step alternative to setData(desc, disparity).
+   *
+   * Selects the candidate pixels from the saliency map of the descriptor. The
+   * disparity is then needed only at the selected pixels, see
+   * selectedPixels()
+   *
+   * \return the number of selected pixels
+   */
+  int selectPixels(const DenseDescriptor*);
+
+  /**
+   * \return the pixels chosen by selectPixels() at the resolution of this
+   * pyramid level, stored as [y0, x0, y1, x1, ...]
+   */
+  inline const std::vector<uint16_t>& selectedPixels() const { return _selected_pixels; }
+
+  /**
+   * Second step. Sets the template data from the selected pixels
+   *
+   * \param disparities the disparity (in full resolution units) at each of
+   * the pixels returned by selectedPixels()
+   */
+  void setData(const DenseDescriptor*, const float* disparities);
+
   void computeResiduals(const DenseDescriptor*, const Matrix44& pose,
                         ResidualsVector&, ValidVector&) const;
 
+  /**
+   * Computes the residuals, their robust weights given the scale and the
+   * linear system in a single pass. The work is done on small blocks of points
+   * that stay in cache, nothing is stored per residual.
+   *
+   * \param residuals if not null, the residuals computed by computeResiduals at
+   * the same pose. They are used instead of interpolating again
+   * \param valid     the per point valid flags, computed here if residuals is null
+   * \param weights   if not null, the weights are stored here
+   *
+   * \return the norm of the weighted residuals
+   */
+  float linearize(const DenseDescriptor*, const Matrix44& pose,
+                  const ResidualsVector* residuals, LossFunctionType, float sigma,
+                  ValidVector& valid, Hessian* H, Gradient* G,
+                  WeightsVector* weights = nullptr) const;
+
+  /**
+   * Sets this template to the points 'inds' of 'src', with all their channels.
+   * Used by the optimizer to drop the points that do not contribute anymore.
+   * The buffers are reused between calls
+   *
+   * \param inds sorted indices of the points, their number must be a multiple
+   * of 16
+   */
+  void setSubset(const TemplateData& src, const std::vector<int>& inds);
+
+  /**
+   * reserves the buffers of setSubset for any subset of 'src'
+   */
+  void reserveSubset(const TemplateData& src);
+
   inline int numPixels() const { return (int) _pixels.size(); }
   inline int numPoints() const { return (int) _points.size(); }
 
@@ -72,18 +136,52 @@ class TemplateData
   inline const PixelVector& pixels() const { return _pixels; }
   inline const JacobianVector& jacobians() const { return _jacobians; }
 
+  /**
+   * \return the Jacobians in SoA, used by linearize with the AVX2 reduction.
+   * Empty if the CPU does not support it
+   */
+  inline const JacobianSoAType& jacobiansSoA() const { return _jacobians_soa; }
+
   inline const Warp& warp() const { return _warp; }
 
+  inline int pyramidLevel() const { return _pyr_level; }
+  inline const AlgorithmParameters& parameters() const { return _params; }
+
+ private:
+  template <class DisparityFunc>
+  void setTemplateData(const DenseDescriptor*, DisparityFunc);
+
+  /**
+   * selects the pixels, if the disparity map is given it is read in the same
+   * pass and pixels with invalid disparities are dropped
+   */
+  int selectPixels(const DenseDescriptor*, const cv::Mat* disparity);
+
  private:
   int _pyr_level;
   AlgorithmParameters _params;
   mutable RigidBodyWarp _warp; // should take the warp outside of this class
 
+  std::vector<uint16_t> _selected_pixels;
+  std::vector<float> _selected_disparities;
+
+  // buffers reused between calls to setData
+  cv::Mat _saliency_map;
+  NonMaxSuppression _nms;
+  BucketedPointSelector _point_selector;
+  std::vector<int> _valid_inds;
+  AlignedVector<float>::type _IxIy;
+
   JacobianVector _jacobians;
+  JacobianSoAType _jacobians_soa;
   PointVector _points;
   PixelVector _pixels;
 
   mutable PhotoError _photo_error;
+
+ public:
+  // the warp holds fixed-size Eigen members, make_unique needs the alignment
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW;
 }; // TemplateData
 
 }; // bpvo
@@ -42,6 +42,8 @@ AlgorithmParameters::AlgorithmParameters()
     , centralDifferenceSigmaBefore(0.75)
     , centralDifferenceSigmaAfter(1.75)
     , laplacianKernelSize(1)
+    , packDescriptorChannels(false)
+    , packDescriptorChannelsInt16(false)
     , maxIterations(50)
     , parameterTolerance(1e-7)
     , functionTolerance(1e-6)
@@ -50,6 +52,11 @@ AlgorithmParameters::AlgorithmParameters()
     , gradientEstimation(GradientEstimationType::kCentralDifference_3)
     , interp(InterpolationType::kLinear)
     , lossFunction(LossFunctionType::kTukey)
+    , scaleEstimator(ScaleEstimatorType::kExactMedian)
+    , scaleEstimatorSubsample(false)
+    , activeSetIterations(0)
+    , pointSubsampleStride(1)
+    , pointSubsampleIterations(2)
     , descriptor(DescriptorType::kIntensity)
     , verbosity(VerbosityType::kIteration)
     , minTranslationMagToKeyFrame(0.15)
@@ -61,9 +68,17 @@ AlgorithmParameters::AlgorithmParameters()
     , nonMaxSuppRadius(1)
     , minRatioPixelsToWork(256)
     , minSaliency(0.1)
+    , maxPointsPerLevel(0)
+    , pointSelectionBucketSize(32)
     , minValidDisparity(0.001)
     , maxValidDisparity(512.0f)
     , maxTestLevel(0)
+    , timeBudgetMs(0.0f)
+    , adaptiveFinestLevel(false)
+    , adaptiveLevelMaxError(0.005f)
+    , adaptiveLevelMaxTranslation(0.05f)
+    , adaptiveLevelMaxRotation(1.0f)
+    , adaptiveLevelFullResInterval(5)
     , withNormalization(true) {}
 
 AlgorithmParameters::AlgorithmParameters(std::string filename)
@@ -83,6 +98,8 @@ AlgorithmParameters::AlgorithmParameters(std::string filename)
   centralDifferenceSigmaBefore = cf.get<float>("centralDifferenceSigmaBefore", 0.75);
   centralDifferenceSigmaAfter = cf.get<float>("CenteralDifferenceSigmaAfter", 1.75);
   laplacianKernelSize = cf.get<int>("laplacianKernelSize", 1);
+  packDescriptorChannels = cf.get<int>("packDescriptorChannels", 0);
+  packDescriptorChannelsInt16 = cf.get<int>("packDescriptorChannelsInt16", 0);
   maxIterations = cf.get<int>("maxIterations", 50);
   parameterTolerance = cf.get<float>("parameterTolerance", 1e-7);
   functionTolerance = cf.get<float>("functionTolerance", 1e-6);
@@ -91,6 +108,11 @@ AlgorithmParameters::AlgorithmParameters(std::string filename)
   gradientEstimation = GradientEstimationTypeFromString(cf.get<std::string>("GradientEstimation", "CD5"));
   interp = InterpolationTypeFromString(cf.get<std::string>("Interpolation", "Linear"));
   lossFunction = LossFunctionTypeFromString(cf.get<std::string>("lossFunction", "Huber"));
+  scaleEstimator = ScaleEstimatorTypeFromString(cf.get<std::string>("scaleEstimator", "Median"));
+  scaleEstimatorSubsample = cf.get<int>("scaleEstimatorSubsample", false);
+  activeSetIterations = cf.get<int>("activeSetIterations", 0);
+  pointSubsampleStride = cf.get<int>("pointSubsampleStride", 1);
+  pointSubsampleIterations = cf.get<int>("pointSubsampleIterations", 2);
   descriptor = DescriptorTypeFromString(cf.get<std::string>("descriptor", "Intensity"));
   verbosity = VerbosityTypeFromString(cf.get<std::string>("Verbosity", "Iteration"));
   minTranslationMagToKeyFrame = cf.get<float>("minTranslationMagToKeyFrame", 0.1);
@@ -102,9 +124,17 @@ AlgorithmParameters::AlgorithmParameters(std::string filename)
   nonMaxSuppRadius = cf.get<int>("nonMaxSuppRadius", 1);
   minRatioPixelsToWork = cf.get<int>("minRatioPixelsToWork", 256);
   minSaliency = cf.get<float>("minSaliency", 0.1f);
+  maxPointsPerLevel = cf.get<int>("maxPointsPerLevel", 0);
+  pointSelectionBucketSize = cf.get<int>("pointSelectionBucketSize", 32);
   minValidDisparity = cf.get<float>("minValidDisparity", 1.0f);
   maxValidDisparity = cf.get<float>("maxValidDisparity", 512.0f);
   maxTestLevel = cf.get<int>("maxTestLevel", 0);
+  timeBudgetMs = cf.get<float>("timeBudgetMs", 0.0f);
+  adaptiveFinestLevel = cf.get<int>("adaptiveFinestLevel", false);
+  adaptiveLevelMaxError = cf.get<float>("adaptiveLevelMaxError", 0.005f);
+  adaptiveLevelMaxTranslation = cf.get<float>("adaptiveLevelMaxTranslation", 0.05f);
+  adaptiveLevelMaxRotation = cf.get<float>("adaptiveLevelMaxRotation", 1.0f);
+  adaptiveLevelFullResInterval = cf.get<int>("adaptiveLevelFullResInterval", 5);
   withNormalization = cf.get<int>("withNormalization", true);
 }
 
@@ -165,6 +195,16 @@ DescriptorType DescriptorTypeFromString(std::string s)
     THROW_ERROR(Format("unknown DescriptorType %s", s.c_str()).c_str());
 }
 
+ScaleEstimatorType ScaleEstimatorTypeFromString(std::string s)
+{
+  if(icompare("Median", s))
+    return kExactMedian;
+  else if(icompare("ApproximateMedian", s))
+    return kApproximateMedian;
+  else
+    THROW_ERROR("unknown ScaleEstimatorType");
+}
+
 std::string ToString(VerbosityType v)
 {
   switch(v) {
@@ -209,6 +249,7 @@ std::string ToString(PoseEstimationStatus s)
     case kGradientTolReached: return "GradientTolReached";
     case kMaxIterations: return "MaxIterations";
     case kSolverError: return "SolverError";
+    case kTimeBudgetReached: return "TimeBudgetReached";
   }
 
   return "Unknown";
@@ -266,6 +307,28 @@ std::string ToString(InterpolationType t)
   return "Unknown";
 }
 
+std::string ToString(ScaleEstimatorType t)
+{
+  switch(t) {
+    case kExactMedian: return "Median";
+    case kApproximateMedian: return "ApproximateMedian";
+  }
+
+  return "Unknown";
+}
+
+std::string ToString(PyramidStopReason r)
+{
+  switch(r) {
+    case kReachedMaxTestLevel: return "ReachedMaxTestLevel";
+    case kTimeBudgetExceeded: return "TimeBudgetExceeded";
+    case kTooFewPixels: return "TooFewPixels";
+    case kCoarseSolutionGood: return "CoarseSolutionGood";
+  }
+
+  return "Unknown";
+}
+
 
 std::ostream& operator<<(std::ostream& os, const AlgorithmParameters& p)
 {
@@ -282,6 +345,8 @@ std::ostream& operator<<(std::ostream& os, const AlgorithmParameters& p)
   os << "centralDifferenceSigmaBefore = " << p.centralDifferenceSigmaBefore << "\n";
   os << "centralDifferenceSigmaAfter = " << p.centralDifferenceSigmaAfter << "\n";
   os << "laplacianKernelSize = " << p.laplacianKernelSize << "\n";
+  os << "packDescriptorChannels = " << p.packDescriptorChannels << "\n";
+  os << "packDescriptorChannelsInt16 = " << p.packDescriptorChannelsInt16 << "\n";
   os << "maxIterations = " << p.maxIterations << "\n";
   os << "parameterTolerance = " << p.parameterTolerance << "\n";
   os << "functionTolerance = " << p.functionTolerance << "\n";
@@ -290,6 +355,11 @@ std::ostream& operator<<(std::ostream& os, const AlgorithmParameters& p)
   os << "gradienEstimation: " << ToString(p.gradientEstimation) << "\n";
   os << "InterpolationType: " << ToString(p.interp) << "\n";
   os << "lossFunction = " << ToString(p.lossFunction) << "\n";
+  os << "scaleEstimator = " << ToString(p.scaleEstimator) << "\n";
+  os << "scaleEstimatorSubsample = " << p.scaleEstimatorSubsample << "\n";
+  os << "activeSetIterations = " << p.activeSetIterations << "\n";
+  os << "pointSubsampleStride = " << p.pointSubsampleStride << "\n";
+  os << "pointSubsampleIterations = " << p.pointSubsampleIterations << "\n";
   os << "verbosity = " << ToString(p.verbosity) << "\n";
   os << "minTranslationMagToKeyFrame = " << p.minTranslationMagToKeyFrame << "\n";
   os << "minRotationMagToKeyFrame = " << p.minRotationMagToKeyFrame << "\n";
@@ -299,10 +369,18 @@ std::ostream& operator<<(std::ostream& os, const AlgorithmParameters& p)
   os << "minNumPixelsForNonMaximaSuppression = " << p.minNumPixelsForNonMaximaSuppression << "\n";
   os << "minRatioPixelsToWork = " << p.minRatioPixelsToWork << "\n";
   os << "minSaliency = " << p.minSaliency << "\n";
+  os << "maxPointsPerLevel = " << p.maxPointsPerLevel << "\n";
+  os << "pointSelectionBucketSize = " << p.pointSelectionBucketSize << "\n";
   os << "minValidDisparity = " << p.minValidDisparity << "\n";
   os << "maxValidDisparity = " << p.maxValidDisparity << "\n";
   os << "withNormalization = " << p.withNormalization << "\n";
-  os << "maxTestLevel = " << p.maxTestLevel;
+  os << "maxTestLevel = " << p.maxTestLevel << "\n";
+  os << "timeBudgetMs = " << p.timeBudgetMs << "\n";
+  os << "adaptiveFinestLevel = " << p.adaptiveFinestLevel << "\n";
+  os << "adaptiveLevelMaxError = " << p.adaptiveLevelMaxError << "\n";
+  os << "adaptiveLevelMaxTranslation = " << p.adaptiveLevelMaxTranslation << "\n";
+  os << "adaptiveLevelMaxRotation = " << p.adaptiveLevelMaxRotation << "\n";
+  os << "adaptiveLevelFullResInterval = " << p.adaptiveLevelFullResInterval;
 
   return os;
 }
@@ -310,6 +388,9 @@ std::ostream& operator<<(std::ostream& os, const AlgorithmParameters& p)
 OptimizerStatistics::OptimizerStatistics()
   : numIterations(0)
   , finalError(-1.0f)
+  , numPixels(0)
+  , numSubsampledIterations(0)
+  , numResidualEvaluations(0)
   , firstOrderOptimality(-1.0f)
   , status(PoseEstimationStatus::kSolverError) {}
 
@@ -318,6 +399,8 @@ std::ostream& operator<<(std::ostream& os, const OptimizerStatistics& s)
   os << "numIterations: " << s.numIterations << "\n"
      << "finalError: " << s.finalError << "\n"
      << "firstOrderOptimality: " << s.firstOrderOptimality << "\n"
+     << "numSubsampledIterations: " << s.numSubsampledIterations << "\n"
+     << "numResidualEvaluations: " << s.numResidualEvaluations << "\n"
      << "status: " << ToString(s.status);
 
   return os;
@@ -327,6 +410,8 @@ Result::Result()
   : success(false)
   , displacement(Pose::Identity())
   , covariance(PoseCovariance::Identity())
+  , finestLevel(-1)
+  , pyramidStopReason(kReachedMaxTestLevel)
   , isKeyFrame(false)
   , keyFramingReason(kNoKeyFraming) {}
 
@@ -335,6 +420,8 @@ Result::Result(Result&& other) noexcept
   , displacement(other.displacement)
   , covariance(other.covariance)
   , optimizerStatistics(std::move(other.optimizerStatistics))
+  , finestLevel(other.finestLevel)
+  , pyramidStopReason(other.pyramidStopReason)
   , isKeyFrame(other.isKeyFrame)
   , keyFramingReason(other.keyFramingReason)
   , pointCloud(std::move(other.pointCloud)) {}
@@ -347,6 +434,8 @@ Result& Result::operator=(Result&& r) noexcept
   displacement = r.displacement;
   covariance = r.covariance;
   optimizerStatistics = std::move(r.optimizerStatistics);
+  finestLevel = r.finestLevel;
+  pyramidStopReason = r.pyramidStopReason;
   isKeyFrame = r.isKeyFrame;
   keyFramingReason = r.keyFramingReason;
   pointCloud = std::move(r.pointCloud);
@@ -357,6 +446,7 @@ std::ostream& operator<<(std::ostream& os, const Result& r)
 {
   os << r.displacement << "\n";
   os << "isKeyFrame: " << std::boolalpha << r.isKeyFrame << std::noboolalpha << "\n";
+  os << "finestLevel: " << r.finestLevel << " (" << ToString(r.pyramidStopReason) << ")\n";
   if(!r.optimizerStatistics.empty())
     os << r.optimizerStatistics.front();
 
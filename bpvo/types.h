@@ -28,6 +28,7 @@
 #include <vector>
 #include <iosfwd>
 #include <string>
+#include <functional>
 
 #include <opencv2/core/core.hpp>
 
@@ -55,11 +56,9 @@ SharedPointer<_T> make_shared(Args&& ... args) {
   return std::make_shared<_T>(std::forward<Args>(args)...);
 }
 
-#if defined(__AVX__)
+// AVX kernels are selected at runtime, so buffers are aligned for them
+// regardless of the compiler flags
 static constexpr int DefaultAlignment = 32;
-#else
-static constexpr int DefaultAlignment = 16;
-#endif
 
 template <typename T>
 struct AlignedVector
@@ -170,6 +169,15 @@ enum InterpolationType
   kCubicHermite, // cubic hermite (pchip)
 }; // InterpolationType
 
+/**
+ * Estimator of the scale of the residuals used by IRLS
+ */
+enum ScaleEstimatorType
+{
+  kExactMedian = 0x60, // median of the absolute residuals
+  kApproximateMedian,  // median from a histogram, within 2% of the exact value (fast)
+}; // ScaleEstimatorType
+
 struct AlgorithmParameters
 {
   //
@@ -246,6 +254,26 @@ struct AlgorithmParameters
    */
   int laplacianKernelSize;
 
+  /**
+   * If true, multi-channel descriptors also store their channels interleaved
+   * per pixel (DenseDescriptor::packChannels), which is used for warping.
+   *
+   * The channel planes are kept for the template, so this doubles the memory
+   * of the descriptors. Off by default
+   */
+  bool packDescriptorChannels;
+
+  /**
+   * If true, the packed channels are stored in 16-bit fixed point instead of
+   * float (DenseDescriptor::packChannelsInt16). Used if packDescriptorChannels
+   * is true.
+   *
+   * This only reduces the bandwidth of the warp, which reads half the bytes
+   * per pixel. The float channel planes are still kept for the template, so
+   * the descriptor memory grows by the packed copy (about 50%)
+   */
+  bool packDescriptorChannelsInt16;
+
   //
   // optimization
   //
@@ -290,6 +318,35 @@ struct AlgorithmParameters
    */
   LossFunctionType lossFunction;
 
+  /**
+   * The estimator of the scale of the residuals
+   */
+  ScaleEstimatorType scaleEstimator;
+
+  /**
+   * If true, the scale is estimated from one residual per point instead of
+   * one per point and channel. The channels are sampled in turns over blocks
+   * of points, so the cost is that of a single channel
+   */
+  bool scaleEstimatorSubsample;
+
+  /**
+   * If > 0, the points that no longer contribute to the objective (zero
+   * weight, or invalid twice in a row) are dropped after this many iterations
+   * and the optimizer continues with the others. Convergence is always
+   * verified with all the points. Zero disables it
+   */
+  int activeSetIterations;
+
+  /**
+   * If > 1, the first iterations of each level use every
+   * pointSubsampleStride-th point only. The stride is halved every
+   * pointSubsampleIterations iterations until all the points are used, the
+   * convergence tests are done with all the points. 1 disables it
+   */
+  int pointSubsampleStride;
+  int pointSubsampleIterations;
+
   /**
    * Descriptor type
    */
@@ -367,6 +424,20 @@ struct AlgorithmParameters
    */
   float minSaliency;
 
+  /**
+   * Maximum number of pixels to select per pyramid level. If there are more
+   * candidates, the image is split into buckets of pointSelectionBucketSize
+   * pixels and the strongest candidates of each bucket are kept, so that the
+   * points remain spread over the image. Use a value <= 0 to keep all
+   */
+  int maxPointsPerLevel;
+
+  /**
+   * Size (in pixels at the pyramid level) of the buckets used with
+   * maxPointsPerLevel
+   */
+  int pointSelectionBucketSize;
+
   /**
    * minimum valid disparity to use
    */
@@ -394,6 +465,29 @@ struct AlgorithmParameters
    */
   int maxTestLevel;
 
+  /**
+   * If > 0, the time allowed for the pose estimation of a frame in
+   * milliseconds. The time is split among the pyramid levels by their number
+   * of pixels and the iterations of each level are limited to its share. The
+   * finer levels that would not fit in the remaining time are skipped, see
+   * Result::finestLevel. The coarsest level is always used
+   */
+  float timeBudgetMs;
+
+  /**
+   * If true, the level above maxTestLevel is the last one when its solution
+   * is already good: it converged, its error per pixel is below
+   * adaptiveLevelMaxError and it moved the pose from the initialization by
+   * less than adaptiveLevelMaxTranslation (meters) and
+   * adaptiveLevelMaxRotation (degrees). To limit drift, all the levels are
+   * used at least once every adaptiveLevelFullResInterval estimations.
+   * See Result::finestLevel
+   */
+  bool adaptiveFinestLevel;
+  float adaptiveLevelMaxError;
+  float adaptiveLevelMaxTranslation;
+  float adaptiveLevelMaxRotation;
+  int adaptiveLevelFullResInterval;
 
   /**
    * normalize the values going into the linear system. Produces a solution
@@ -426,9 +520,21 @@ enum PoseEstimationStatus
   kFunctionTolReached,  //< ditto function value
   kGradientTolReached,  //< ditto gradient value (J'*F)
   kMaxIterations,       //< Maximum number of iteration
-  kSolverError          //< !
+  kSolverError,         //< !
+  kTimeBudgetReached    //< ran out of time, see AlgorithmParameters::timeBudgetMs
 }; // PoseEstimationStatus
 
+/**
+ * Tells you why the pose estimation stopped at a pyramid level
+ */
+enum PyramidStopReason
+{
+  kReachedMaxTestLevel = 0x70, //< all the levels down to maxTestLevel were used
+  kTimeBudgetExceeded,         //< the next level would not fit in timeBudgetMs
+  kTooFewPixels,               //< the next level has too few pixels to work
+  kCoarseSolutionGood          //< the solution is good enough, see adaptiveFinestLevel
+}; // PyramidStopReason
+
 /**
  * Tells you why the code decided to keyframe.
  *
@@ -469,6 +575,18 @@ struct OptimizerStatistics
   // Number of pixels used in this optimization
   unsigned int numPixels;
 
+  /**
+   * Number of iterations done with a subset of the points, see
+   * AlgorithmParameters::pointSubsampleStride
+   */
+  int numSubsampledIterations;
+
+  /**
+   * Total number of residuals computed by the function evaluations. It is
+   * numPixels per evaluation, less with subsampling or the active set
+   */
+  unsigned int numResidualEvaluations;
+
   /**
    * First order optimiality at the end of the optimization, aka the Inf norm of
    * the gradient vector at the solution.
@@ -529,6 +647,18 @@ struct Result
    */
   std::vector<OptimizerStatistics> optimizerStatistics;
 
+  /**
+   * The finest pyramid level used by the pose estimation, it is maxTestLevel
+   * unless the estimation stopped early, see pyramidStopReason. -1 if no level
+   * was used
+   */
+  int finestLevel;
+
+  /**
+   * Why the pose estimation did not go past finestLevel
+   */
+  PyramidStopReason pyramidStopReason;
+
   /**
    * If this is set to 'true' then we set a keyframe (usually from the previous
    * image)
@@ -604,6 +734,68 @@ struct ImageSize
 }; // ImageSize
 
 
+/**
+ * Computes the disparity map of a frame on demand.
+ *
+ * The disparity is only needed when a frame becomes a keyframe. Passing a
+ * provider to VisualOdometry::addFrame instead of a disparity map allows
+ * skipping the stereo computation for frames that are never used as keyframes.
+ *
+ * The returned disparity must have the same size as the image.
+ */
+typedef std::function<cv::Mat()> DisparityProvider;
+
+/**
+ * Computes the disparity at a sparse set of pixels on demand.
+ *
+ * Like DisparityProvider, it is called only when a frame becomes a keyframe,
+ * but only for the pixels selected for the template, so the cost of stereo is
+ * proportional to the number of points rather than the image area.
+ *
+ * \param xy full resolution pixel coordinates [x0, y0, x1, y1, ...]
+ * \param n  the number of pixels
+ * \param disparity output, one disparity per pixel. Invalid disparities
+ *        should be set to a negative value
+ */
+typedef std::function<void(const int* xy, int n, float* disparity)> SparseDisparityProvider;
+
+/**
+ * Keeps borrowed frame buffers alive.
+ *
+ * VisualOdometry holds a copy of the handle for as long as it reads the
+ * buffers of a borrowed frame, i.e. while the frame is the reference or the
+ * previous frame. The buffers may be reused once the last copy is released,
+ * for instance by a shared_ptr with a custom deleter that returns a slot to a
+ * ring buffer.
+ */
+typedef SharedPointer<void> BufferHandle;
+
+/**
+ * A view of the image and disparity of a frame. The buffers are borrowed if a
+ * handle is given, copied otherwise.
+ *
+ * The size of the buffers is the ImageSize given to VisualOdometry.
+ */
+struct FrameView
+{
+  const uint8_t* image = nullptr;  //< the image data
+  const float* disparity = nullptr; //< the disparity data
+
+  size_t imageStride = 0;      //< bytes per row of image (0 if rows are packed)
+  size_t disparityStride = 0;  //< bytes per row of disparity (0 if rows are packed)
+
+  BufferHandle handle; //< released when the buffers are no longer needed, the
+                       //< buffers are copied if not set
+
+  inline FrameView() {}
+
+  inline FrameView(const uint8_t* I, const float* D, BufferHandle h = nullptr,
+                   size_t I_stride = 0, size_t D_stride = 0)
+      : image(I), disparity(D), imageStride(I_stride), disparityStride(D_stride)
+      , handle(h) {}
+}; // FrameView
+
+
 std::string ToString(LossFunctionType);
 std::string ToString(VerbosityType);
 std::string ToString(PoseEstimationStatus);
@@ -611,12 +803,15 @@ std::string ToString(KeyFramingReason);
 std::string ToString(DescriptorType);
 std::string ToString(GradientEstimationType);
 std::string ToString(InterpolationType);
+std::string ToString(ScaleEstimatorType);
+std::string ToString(PyramidStopReason);
 
 LossFunctionType LossFunctionTypeFromString(std::string);
 DescriptorType DescriptorTypeFromString(std::string);
 VerbosityType VerbosityTypeFromString(std::string);
 GradientEstimationType GradientEstimationTypeFromString(std::string);
 InterpolationType InterpolationTypeFromString(std::string);
+ScaleEstimatorType ScaleEstimatorTypeFromString(std::string);
 
 }; // bpvo
 
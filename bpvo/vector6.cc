@@ -20,6 +20,7 @@
  */
 
 #include "bpvo/vector6.h"
+#include "bpvo/rank_update_avx2.h"
 #include <iostream>
 #include <random>
 
@@ -45,4 +46,27 @@ Vector6 Vector6::Random()
   return ret;
 }
 
+void Vector6::RankUpdate(const Vector6* J, const float* r, const float* w, int n,
+                         float* H, float* G, float* res_sq_norm)
+{
+  int i = 0;
+  if(HasRankUpdateAvx2())
+    i = RankUpdateAvx2(J, r, w, n, H, G, res_sq_norm);
+
+  for( ; i < n; ++i)
+  {
+    const float wr = w[i] * r[i];
+    for(int a = 0, k = 0; a < 6; ++a)
+    {
+      const float wj = w[i] * J[i][a];
+      for(int b = a; b < 6; ++b, ++k)
+        H[k] += wj * J[i][b];
+
+      G[a] += wr * J[i][a];
+    }
+
+    *res_sq_norm += wr * r[i];
+  }
+}
+
 } // bpvo
@@ -89,6 +89,15 @@ class Vector6
 
   static void RankUpdate(const Vector6& J, float w, float* buf);
 
+  /**
+   * Adds n points to H += J'*W*J, G += J'*W*r and res_sq_norm += r'*W*r.
+   *
+   * H is the upper triangle of the hessian in row major order [21]. Uses the
+   * AVX2/FMA kernel 8 points at a time if the CPU supports it
+   */
+  static void RankUpdate(const Vector6* J, const float* r, const float* w, int n,
+                         float* H, float* G, float* res_sq_norm);
+
  protected:
   alignas(DefaultAlignment) float _data[8];
 }; // Vector6
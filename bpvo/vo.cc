@@ -25,25 +25,71 @@
 #include "bpvo/trajectory.h"
 #include "bpvo/point_cloud.h"
 
+#include <externals/ThreadPool.h>
+
+#include <mutex>
+#include <condition_variable>
+
 namespace bpvo {
 
 class VisualOdometry::Impl
 {
  public:
   inline Impl(const Matrix33&, float, ImageSize, const AlgorithmParameters& p);
+  inline ~Impl();
+
+  /**
+   * adds a frame, args are passed to VisualOdometryFrame::setData
+   */
+  template <class ... Args> inline
+  Result addFrame(const Matrix44& guess, const Args& ... args);
+
+  /**
+   * same as above, the result is written to 'ret' reusing its storage
+   */
+  template <class ... Args> inline
+  void addFrame(Result& ret, const Matrix44& guess, const Args& ... args);
+
+  template <class ... Args> inline
+  std::future<Result> addFrameAsync(const Matrix44& guess, const Args& ... args);
 
-  inline Result addFrame(const cv::Mat&, const cv::Mat&, const Matrix44&);
+  /**
+   * \return cv::Mat headers to the borrowed buffers of the view
+   */
+  inline cv::Mat viewImage(const FrameView&) const;
+  inline cv::Mat viewDisparity(const FrameView&) const;
 
   inline const Trajectory& trajectory() const { return _trajectory; }
 
-  inline bool checkResult( const std::vector<OptimizerStatistics>& stats );
+  inline bool checkResult( const std::vector<OptimizerStatistics>& stats, int finest_level );
+
+  /**
+   * \return the pyramid level the last pose estimate is checked at. It is the
+   * finest level used, unless a level was skipped for lack of pixels, which
+   * fails the check at maxTestLevel
+   */
+  inline int checkLevel() const
+  {
+    return _vo_pose->stopReason() == kTooFewPixels ?
+        _params.maxTestLevel : _vo_pose->finestLevel();
+  }
   inline int numPointsAtLevel(int) const;
   inline const PointVector& pointsAtLevel(int) const;
 
  private:
 
+  typedef Eigen::Matrix<float,4,4,Eigen::DontAlign> UnalignedMatrix44;
+
+  /**
+   * maximum number of frames submitted with addFrameAsync that have not been
+   * processed yet
+   */
+  static constexpr int MaxPendingFrames = 3;
+
   AlgorithmParameters _params;
   ImageSize _image_size;
+  Matrix33 _K;
+  float _baseline;
   UniquePointer<VisualOdometryPoseEstimator> _vo_pose;
   UniquePointer<VisualOdometryFrame> _ref_frame;
   UniquePointer<VisualOdometryFrame> _cur_frame;
@@ -51,6 +97,30 @@ class VisualOdometry::Impl
   Matrix44 _T_kf;
   Trajectory _trajectory;
 
+  // spare frames used by the async pipeline
+  std::mutex _frame_pool_mutex;
+  std::vector<UniquePointer<VisualOdometryFrame>> _frame_pool;
+
+  // number of frames submitted with addFrameAsync that are not done yet
+  std::mutex _pending_mutex;
+  std::condition_variable _pending_cv;
+  int _num_pending;
+
+  // pipeline stages, each one runs on a single thread to preserve order
+  UniquePointer<ThreadPool> _descriptor_stage;
+  UniquePointer<ThreadPool> _pose_stage;
+
+  /**
+   * estimates the pose of _cur_frame, which must have data already
+   */
+  void processFrame(const Matrix44&, Result&);
+
+  UniquePointer<VisualOdometryFrame> acquireFrame();
+  void releaseFrame(UniquePointer<VisualOdometryFrame>);
+
+  void waitForPendingFrames();
+  void pendingFrameDone();
+
   KeyFramingReason shouldKeyFrame(const Matrix44&) const;
 
   UniquePointer<PointCloud> getPointCloudFromRefFrame() const;
@@ -69,7 +139,106 @@ Result VisualOdometry::addFrame(const cv::Mat& image, const cv::Mat& disparity,
   THROW_ERROR_IF( image.empty() || disparity.empty(),
                  "nullptr image/disparity" );
 
-  return _impl->addFrame(image, disparity, guess);
+  return _impl->addFrame(guess, image, disparity);
+}
+
+void VisualOdometry::addFrame(const cv::Mat& image, const cv::Mat& disparity,
+                              Result& result, const Matrix44& guess)
+{
+  THROW_ERROR_IF( image.empty() || disparity.empty(),
+                 "nullptr image/disparity" );
+
+  _impl->addFrame(result, guess, image, disparity);
+}
+
+std::future<Result> VisualOdometry::addFrameAsync(const cv::Mat& image,
+                                                  const cv::Mat& disparity,
+                                                  const Matrix44& guess)
+{
+  THROW_ERROR_IF( image.empty() || disparity.empty(),
+                 "nullptr image/disparity" );
+
+  return _impl->addFrameAsync(guess, image, disparity);
+}
+
+Result VisualOdometry::addFrame(const cv::Mat& image, const DisparityProvider& disparity,
+                                const Matrix44& guess)
+{
+  THROW_ERROR_IF( image.empty() || !disparity,
+                 "nullptr image/disparity provider" );
+
+  return _impl->addFrame(guess, image, disparity);
+}
+
+std::future<Result> VisualOdometry::addFrameAsync(const cv::Mat& image,
+                                                  const DisparityProvider& disparity,
+                                                  const Matrix44& guess)
+{
+  THROW_ERROR_IF( image.empty() || !disparity,
+                 "nullptr image/disparity provider" );
+
+  return _impl->addFrameAsync(guess, image, disparity);
+}
+
+Result VisualOdometry::addFrame(const cv::Mat& image, const SparseDisparityProvider& disparity,
+                                const Matrix44& guess)
+{
+  THROW_ERROR_IF( image.empty() || !disparity,
+                 "nullptr image/disparity provider" );
+
+  return _impl->addFrame(guess, image, disparity);
+}
+
+std::future<Result> VisualOdometry::addFrameAsync(const cv::Mat& image,
+                                                  const SparseDisparityProvider& disparity,
+                                                  const Matrix44& guess)
+{
+  THROW_ERROR_IF( image.empty() || !disparity,
+                 "nullptr image/disparity provider" );
+
+  return _impl->addFrameAsync(guess, image, disparity);
+}
+
+Result VisualOdometry::addFrame(const uint8_t* image, const float* disparity,
+                                const Matrix44& guess)
+{
+  return addFrame(FrameView(image, disparity), guess);
+}
+
+Result VisualOdometry::addFrame(const FrameView& view, const Matrix44& guess)
+{
+  Result ret;
+  addFrame(view, ret, guess);
+  return ret;
+}
+
+void VisualOdometry::addFrame(const FrameView& view, Result& result, const Matrix44& guess)
+{
+  THROW_ERROR_IF( view.image == nullptr || view.disparity == nullptr,
+                 "nullptr image/disparity" );
+
+  // without a handle we cannot tell the caller when the buffers are free, they
+  // are copied
+  if(!view.handle)
+    _impl->addFrame(result, guess, _impl->viewImage(view), _impl->viewDisparity(view));
+  else
+    _impl->addFrame(result, guess, _impl->viewImage(view), _impl->viewDisparity(view),
+                    view.handle);
+}
+
+std::future<Result> VisualOdometry::addFrameAsync(const FrameView& view, const Matrix44& guess)
+{
+  THROW_ERROR_IF( view.image == nullptr || view.disparity == nullptr,
+                 "nullptr image/disparity" );
+
+  // the buffers are read from the pipeline threads, copy them now if the
+  // caller cannot be told when they are free
+  if(!view.handle)
+    return _impl->addFrameAsync(guess, _impl->viewImage(view).clone(),
+                                _impl->viewDisparity(view).clone());
+
+  return _impl->addFrameAsync(guess, _impl->viewImage(view), _impl->viewDisparity(view),
+                              view.handle);
 }
 
 int VisualOdometry::numPointsAtLevel(int level) const
@@ -96,8 +265,11 @@ VisualOdometry::Impl::
 Impl(const Matrix33& K, float b, ImageSize s, const AlgorithmParameters& p)
   : _params(p)
   , _image_size(s)
+  , _K(K)
+  , _baseline(b)
   , _vo_pose(make_unique<VisualOdometryPoseEstimator>(p))
   , _T_kf(Matrix44::Identity())
+  , _num_pending(0)
 {
   if(_params.numPyramidLevels <= 0) {
     _params.numPyramidLevels = 1 + std::round(
@@ -110,63 +282,201 @@ Impl(const Matrix33& K, float b, ImageSize s, const AlgorithmParameters& p)
   _prev_frame = make_unique<VisualOdometryFrame>(K, b, _params);
 }
 
-static inline Result FirstFrameResult(int n_levels)
+VisualOdometry::Impl::~Impl()
+{
+  // the pools finish all queued tasks before joining their thread
+  _descriptor_stage.reset();
+  _pose_stage.reset();
+}
+
+/**
+ * sets r to a default constructed Result, the storage of the
+ * optimizerStatistics is kept
+ */
+static inline void ResetResult(Result& r)
 {
-  Result r;
   r.success = false;
   r.displacement.setIdentity();
   r.covariance.setIdentity();
-  r.optimizerStatistics.resize(n_levels);
-  r.isKeyFrame = true;
-  r.keyFramingReason = KeyFramingReason::kFirstFrame;
+  r.finestLevel = -1;
+  r.pyramidStopReason = kReachedMaxTestLevel;
+  r.isKeyFrame = false;
+  r.keyFramingReason = KeyFramingReason::kNoKeyFraming;
   r.pointCloud = nullptr;
+}
 
-  return r;
+static inline void FirstFrameResult(int n_levels, Result& r)
+{
+  ResetResult(r);
+  r.optimizerStatistics.assign(n_levels, OptimizerStatistics());
+  r.isKeyFrame = true;
+  r.keyFramingReason = KeyFramingReason::kFirstFrame;
 }
 
 inline bool VisualOdometry::Impl::
-checkResult(const std::vector<OptimizerStatistics>& stats)
+checkResult(const std::vector<OptimizerStatistics>& stats, int finest_level)
 {
-  std::stringstream ss;
-  for(int i = stats.size() - 1; i >= _params.maxTestLevel; --i)
-    {
-      ss << i << ": " << stats[i].finalError << "(" << stats[i].numPixels << "), ";
-    }
-
-  const OptimizerStatistics& finStats = stats[_params.maxTestLevel];
+  const OptimizerStatistics& finStats = stats[finest_level];
   if( finStats.finalError / finStats.numPixels > _params.maxSolutionError ) 
   {
+    // the message is only formatted on failure to keep the common path free of
+    // memory allocations
+    std::stringstream ss;
+    for(int i = stats.size() - 1; i >= finest_level; --i)
+      {
+        ss << i << ": " << stats[i].finalError << "(" << stats[i].numPixels << "), ";
+      }
+
      Info("Error exceeded: %s\n", ss.str().c_str());
      return false; 
   }
 
-  for(int i = stats.size() - 1; i >= _params.maxTestLevel; --i)
+  for(int i = stats.size() - 1; i >= finest_level; --i)
   {
     if( stats[i].status == kSolverError ) { return false; }
   }
   return true;
 }
 
-inline Result VisualOdometry::Impl::
-addFrame(const cv::Mat& I, const cv::Mat& D, const Matrix44& guess)
+template <class ... Args> inline Result VisualOdometry::Impl::
+addFrame(const Matrix44& guess, const Args& ... args)
+{
+  Result ret;
+  addFrame(ret, guess, args...);
+  return ret;
+}
+
+template <class ... Args> inline void VisualOdometry::Impl::
+addFrame(Result& ret, const Matrix44& guess, const Args& ... args)
 {
-  _cur_frame->setData(I, D);
+  waitForPendingFrames();
+
+  _cur_frame->setData(args...);
+  processFrame(guess, ret);
+}
+
+template <class ... Args> inline std::future<Result> VisualOdometry::Impl::
+addFrameAsync(const Matrix44& guess, const Args& ... args)
+{
+  {
+    std::unique_lock<std::mutex> lock(_pending_mutex);
+    _pending_cv.wait(lock, [=]() { return _num_pending < MaxPendingFrames; });
+    ++_num_pending;
+  }
+
+  if(!_descriptor_stage) {
+    _descriptor_stage = make_unique<ThreadPool>(1);
+    _pose_stage = make_unique<ThreadPool>(1);
+  }
+
+  // stage 1: image pyramid and descriptors on a spare frame
+  std::shared_future<VisualOdometryFrame*> frame;
+  try {
+    frame = _descriptor_stage->enqueue([=]()
+    {
+      auto f = acquireFrame();
+      f->setData(args...);
+      return f.release();
+    }).share();
+  } catch(...) {
+    pendingFrameDone();
+    throw;
+  }
+
+  // stage 2: pose estimation, in submission order
+  const UnalignedMatrix44 T_guess(guess);
+  return _pose_stage->enqueue([=]()
+  {
+    Result ret;
+    try {
+      // get() re-throws errors from the first stage
+      UniquePointer<VisualOdometryFrame> f(frame.get());
+      releaseFrame(std::move(_cur_frame));
+      _cur_frame = std::move(f);
+      processFrame(Matrix44(T_guess), ret);
+    } catch(...) {
+      pendingFrameDone();
+      throw;
+    }
 
+    pendingFrameDone();
+    return ret;
+  });
+}
+
+inline cv::Mat VisualOdometry::Impl::viewImage(const FrameView& v) const
+{
+  return cv::Mat(_image_size.rows, _image_size.cols, CV_8UC1,
+                 const_cast<uint8_t*>(v.image), v.imageStride);
+}
+
+inline cv::Mat VisualOdometry::Impl::viewDisparity(const FrameView& v) const
+{
+  return cv::Mat(_image_size.rows, _image_size.cols, CV_32FC1,
+                 const_cast<float*>(v.disparity), v.disparityStride);
+}
+
+UniquePointer<VisualOdometryFrame> VisualOdometry::Impl::acquireFrame()
+{
+  {
+    std::lock_guard<std::mutex> lock(_frame_pool_mutex);
+    if(!_frame_pool.empty()) {
+      auto ret = std::move(_frame_pool.back());
+      _frame_pool.pop_back();
+      return ret;
+    }
+  }
+
+  return make_unique<VisualOdometryFrame>(_K, _baseline, _params);
+}
+
+void VisualOdometry::Impl::releaseFrame(UniquePointer<VisualOdometryFrame> f)
+{
+  if(f) {
+    f->clear();
+    std::lock_guard<std::mutex> lock(_frame_pool_mutex);
+    _frame_pool.push_back(std::move(f));
+  }
+}
+
+void VisualOdometry::Impl::waitForPendingFrames()
+{
+  std::unique_lock<std::mutex> lock(_pending_mutex);
+  _pending_cv.wait(lock, [=]() { return _num_pending == 0; });
+}
+
+void VisualOdometry::Impl::pendingFrameDone()
+{
+  {
+    std::lock_guard<std::mutex> lock(_pending_mutex);
+    --_num_pending;
+  }
+  _pending_cv.notify_all();
+}
+
+void VisualOdometry::Impl::processFrame(const Matrix44& guess, Result& ret)
+{
   if(!_ref_frame->hasTemplate())
   {
     std::swap(_ref_frame, _cur_frame);
     _ref_frame->setTemplate();
     _trajectory.push_back( _T_kf );
-    return FirstFrameResult(_ref_frame->numLevels());
+    FirstFrameResult(_ref_frame->numLevels(), ret);
+    return;
   }
 
+  // the time budget covers all pose estimations of the frame
+  const auto t_frame = VisualOdometryPoseEstimator::Clock::now();
+
   Matrix44 T_est;
   Matrix44 T_guess = _T_kf * guess;
 
-  Result ret;
-  ret.optimizerStatistics = _vo_pose->estimatePose(_ref_frame.get(), _cur_frame.get(),
-                                                   T_guess, T_est);
-  ret.success = checkResult( ret.optimizerStatistics );
+  ResetResult(ret);
+  _vo_pose->estimatePose(_ref_frame.get(), _cur_frame.get(), T_guess, T_est,
+                         ret.optimizerStatistics, &t_frame);
+  ret.finestLevel = _vo_pose->finestLevel();
+  ret.pyramidStopReason = _vo_pose->stopReason();
+  ret.success = checkResult( ret.optimizerStatistics, checkLevel() );
   if( !ret.success )
   { 
     Info("Initial pose estimation failed\n");
@@ -213,12 +523,14 @@ addFrame(const cv::Mat& I, const cv::Mat& D, const Matrix44& guess)
       _ref_frame->setTemplate();
 
       T_guess = guess;
-      ret.optimizerStatistics = _vo_pose->estimatePose(_ref_frame.get(), _cur_frame.get(),
-                                                       T_guess, T_est);
+      _vo_pose->estimatePose(_ref_frame.get(), _cur_frame.get(), T_guess, T_est,
+                             ret.optimizerStatistics, &t_frame);
+      ret.finestLevel = _vo_pose->finestLevel();
+      ret.pyramidStopReason = _vo_pose->stopReason();
       ret.displacement = T_est;
       _T_kf = T_est;
 
-      ret.success = checkResult( ret.optimizerStatistics );  
+      ret.success = checkResult( ret.optimizerStatistics, checkLevel() );  
       if( !ret.success )
       {
         Info("Keyframe pose re-estimation failed\n" );
@@ -237,13 +549,14 @@ addFrame(const cv::Mat& I, const cv::Mat& D, const Matrix44& guess)
     }
   }
 
+  // _cur_frame is no longer needed, release its buffers if borrowed
+  _cur_frame->clear();
+
   // TODO
   // _trajectory.push_back(ret.pose);
 
   // if(ret.pointCloud)
   //   ret.pointCloud->pose() = _trajectory.back();
-
-  return ret;
 }
 
 inline KeyFramingReason VisualOdometry::Impl::
@@ -310,7 +623,8 @@ GetColor(const cv::Mat& image, const Warp& warp, const Point& p)
 inline UniquePointer<PointCloud> VisualOdometry::Impl::
 getPointCloudFromRefFrame() const
 {
-  const auto& points = pointsAtLevel(_params.maxTestLevel);
+  const int level = _vo_pose->weightsLevel();
+  const auto& points = pointsAtLevel(level);
   const auto& weights = _vo_pose->getWeights();
 
   const auto n = points.size();
@@ -322,7 +636,7 @@ getPointCloudFromRefFrame() const
   auto ret = make_unique<PointCloud>(n);
 
   const auto& image = *_ref_frame->imagePointer();
-  const auto& warp = _ref_frame->getTemplateDataAtLevel(_params.maxTestLevel)->warp();
+  const auto& warp = _ref_frame->getTemplateDataAtLevel(level)->warp();
   for(size_t i = 0; i < n; ++i) {
     auto color = GetColor(image, warp, points[i]);
     ret->operator[](i) = PointWithInfo(points[i], color, weights[i]);
@@ -23,6 +23,7 @@
 #define BPVO_VO_H
 
 #include <bpvo/types.h>
+#include <future>
 
 namespace bpvo {
 
@@ -76,6 +77,107 @@ class VisualOdometry
   Result addFrame(const cv::Mat& frame, const cv::Mat& disparity,
                   const Matrix44& guess = Matrix44::Identity());
 
+  /**
+   * Same as addFrame, the Result is written to 'result'.
+   *
+   * Passing the same Result with every frame reuses its optimizerStatistics.
+   * Once the buffers reach their steady state size, a frame that is not a
+   * keyframe is then processed without memory allocations. A keyframe
+   * allocates its pointCloud and a few temporaries per pyramid level
+   */
+  void addFrame(const cv::Mat& frame, const cv::Mat& disparity, Result& result,
+                const Matrix44& guess = Matrix44::Identity());
+
+  /**
+   * Asynchronous version of addFrame
+   *
+   * Frames go through a two stage pipeline. The image pyramid and dense
+   * descriptors of a frame are computed on a worker thread while the pose of
+   * the previously submitted frame is being estimated. Results are delivered
+   * in the order the frames were submitted.
+   *
+   * The image & disparity are shallow copied (cv::Mat is reference counted),
+   * do not write into their buffers until the returned future is ready.
+   *
+   * The call blocks if too many frames are in flight. A subsequent call to
+   * addFrame() waits for all pending frames to complete. Other methods should
+   * not be called until the pending futures are ready.
+   *
+   * \return a future holding the Result of the frame
+   */
+  std::future<Result> addFrameAsync(const cv::Mat& frame, const cv::Mat& disparity,
+                                    const Matrix44& guess = Matrix44::Identity());
+
+  /**
+   * Same as addFrame, but the disparity is computed on demand
+   *
+   * The provider is called at most once, and only if the frame becomes a
+   * keyframe (the current frame, or the previous frame when the current one
+   * fails to register). Stereo can thus be skipped for most frames.
+   *
+   * The provider is called during this call or the next call to addFrame, or
+   * not at all. It must keep the data it needs (e.g. the right image) alive
+   * until then, and must not call back into VisualOdometry
+   */
+  Result addFrame(const cv::Mat& frame, const DisparityProvider& disparity,
+                  const Matrix44& guess = Matrix44::Identity());
+
+  /**
+   * Asynchronous version of addFrame with a disparity provider. The provider
+   * is called from the pose estimation thread of the pipeline
+   */
+  std::future<Result> addFrameAsync(const cv::Mat& frame, const DisparityProvider& disparity,
+                                    const Matrix44& guess = Matrix44::Identity());
+
+  /**
+   * Same as addFrame with a DisparityProvider, but the disparity is requested
+   * only at the pixels selected for the template (all pyramid levels in one
+   * call). See SparseStereo in utils for a matcher that works this way
+   */
+  Result addFrame(const cv::Mat& frame, const SparseDisparityProvider& disparity,
+                  const Matrix44& guess = Matrix44::Identity());
+
+  /**
+   * Asynchronous version of addFrame with a sparse disparity provider
+   */
+  std::future<Result> addFrameAsync(const cv::Mat& frame, const SparseDisparityProvider& disparity,
+                                    const Matrix44& guess = Matrix44::Identity());
+
+  /**
+   * Zero-copy version of addFrame
+   *
+   * If view.handle is set, the image and disparity buffers are borrowed, not
+   * copied. They must remain valid and unchanged until VisualOdometry releases
+   * view.handle, which happens as soon as the frame is neither the reference
+   * nor the previous frame.
+   *
+   * Without a handle the buffers are copied, as with the cv::Mat overload, and
+   * may be reused as soon as the call returns
+   */
+  Result addFrame(const FrameView& view, const Matrix44& guess = Matrix44::Identity());
+
+  /**
+   * Zero-copy addFrame writing to 'result', see the cv::Mat version
+   */
+  void addFrame(const FrameView& view, Result& result,
+                const Matrix44& guess = Matrix44::Identity());
+
+  /**
+   * addFrame from packed buffers of the size given at construction. The
+   * buffers are copied, use a FrameView with a handle to borrow them.
+   * This is the same as addFrame(FrameView(image, disparity), guess)
+   */
+  Result addFrame(const uint8_t* image, const float* disparity,
+                  const Matrix44& guess = Matrix44::Identity());
+
+  /**
+   * Asynchronous version of the zero-copy addFrame. Borrowed buffers are read
+   * from the pipeline threads, the same lifetime rules apply. Without a handle
+   * the buffers are copied before the call returns
+   */
+  std::future<Result> addFrameAsync(const FrameView& view,
+                                    const Matrix44& guess = Matrix44::Identity());
+
   /**
    * \return the number of points at the specified pyramid level
    * The is the same as pointsAtLevel(level).size()
@@ -3,6 +3,7 @@
 #include "bpvo/dense_descriptor.h"
 #include "bpvo/dense_descriptor_pyramid.h"
 #include "bpvo/parallel_tasks.h"
+#include "bpvo/task_scheduler.h"
 #include "bpvo/utils.h"
 #include "bpvo/image_pyramid.h"
 
@@ -16,6 +17,7 @@ VisualOdometryFrame::VisualOdometryFrame(const Matrix33& K, float b, const Algor
     , _has_template(false)
     , _image(make_unique<cv::Mat>())
     , _disparity(make_unique<cv::Mat>())
+    , _is_borrowed(false)
     , _desc_pyr(make_unique<DenseDescriptorPyramid>(p))
 {
   Matrix33 K_pyr(K);
@@ -45,10 +47,72 @@ const TemplateData* VisualOdometryFrame::getTemplateDataAtLevel(size_t l) const
 
 int VisualOdometryFrame::numLevels() const { return _desc_pyr->size(); }
 
+void VisualOdometryFrame::clear()
+{
+  releaseBorrowedData();
+  _has_data = false;
+  _has_template = false;
+}
+
+void VisualOdometryFrame::releaseBorrowedData()
+{
+  if(_is_borrowed)
+  {
+    // drop the headers, otherwise the next copyTo would write into the
+    // borrowed buffers
+    _image->release();
+    _disparity->release();
+    _buffer_handle.reset();
+    _is_borrowed = false;
+  }
+}
+
 void VisualOdometryFrame::setData(const cv::Mat& image, const cv::Mat& disparity)
 {
+  releaseBorrowedData();
   image.copyTo( *_image );
   disparity.copyTo( *_disparity );
+  _disparity_provider = nullptr;
+  _sparse_disparity_provider = nullptr;
+  _desc_pyr->init(image);
+
+  _has_data = true;
+}
+
+void VisualOdometryFrame::setData(const cv::Mat& image, const DisparityProvider& disparity)
+{
+  releaseBorrowedData();
+  image.copyTo( *_image );
+  _disparity->release();
+  _disparity_provider = disparity;
+  _sparse_disparity_provider = nullptr;
+  _desc_pyr->init(image);
+
+  _has_data = true;
+}
+
+void VisualOdometryFrame::setData(const cv::Mat& image, const SparseDisparityProvider& disparity)
+{
+  releaseBorrowedData();
+  image.copyTo( *_image );
+  _disparity->release();
+  _disparity_provider = nullptr;
+  _sparse_disparity_provider = disparity;
+  _desc_pyr->init(image);
+
+  _has_data = true;
+}
+
+void VisualOdometryFrame::setData(const cv::Mat& image, const cv::Mat& disparity,
+                                  const BufferHandle& handle)
+{
+  releaseBorrowedData();
+  *_image = image;
+  *_disparity = disparity;
+  _buffer_handle = handle;
+  _is_borrowed = true;
+  _disparity_provider = nullptr;
+  _sparse_disparity_provider = nullptr;
   _desc_pyr->init(image);
 
   _has_data = true;
@@ -62,34 +126,91 @@ void VisualOdometryFrame::setTemplate()
 {
   THROW_ERROR_IF(!_has_data, "no data in frame");
 
-#define VO_FRAME_USE_PARALLEL 0
+  if(_disparity_provider)
+  {
+    const cv::Mat D = _disparity_provider();
+    THROW_ERROR_IF( D.rows != _image->rows || D.cols != _image->cols,
+                   "disparity provider returned a map of the wrong size" );
+    D.copyTo( *_disparity );
+    _disparity_provider = nullptr;
+  }
 
-#if VO_FRAME_USE_PARALLEL
-  ParallelTasks tasks(std::min(numLevels() - _max_test_level, 4));
-#endif
+  if(_sparse_disparity_provider)
+  {
+    setSparseTemplate();
+    _sparse_disparity_provider = nullptr;
+    _has_template = true;
+    return;
+  }
+
+  // checked before the levels are set on the TaskScheduler
+  THROW_ERROR_IF( _disparity->type() != CV_32FC1,
+                 "disparity must be CV_32FC1" );
+  THROW_ERROR_IF( _disparity->rows != _image->rows || _disparity->cols != _image->cols,
+                 "disparity must have the size of the image" );
+
+  forEachTemplateLevel(&VisualOdometryFrame::SetTemplateLevel);
+  _has_template = true;
+}
+
+void VisualOdometryFrame::setSparseTemplate()
+{
+  // select the pixels at all levels first, then request their disparity with
+  // a single call to the provider
+  const int n_levels = _tdata_pyr.size();
+  auto& offsets = _sparse_offsets;
+  offsets.assign(n_levels, 0);
+
+  forEachTemplateLevel(&VisualOdometryFrame::SelectTemplatePixels);
 
-  const cv::Mat& D = *_disparity;
-  for(int i = _tdata_pyr.size()-1; i >= _max_test_level; --i)
+  _sparse_xy.resize(0);
+  for(int i = n_levels - 1; i >= _max_test_level; --i)
   {
-    auto code = [=]()
-    {
-      _tdata_pyr[i]->setData(_desc_pyr->operator[](i), D);
-    }; // code
+    offsets[i] = _sparse_xy.size() / 2;
 
-#if VO_FRAME_USE_PARALLEL
-    tasks.add( code );
-#else
-    code();
-#endif
+    const auto& inds = _tdata_pyr[i]->selectedPixels();
+    for(size_t j = 0; j < inds.size(); j += 2)
+    {
+      _sparse_xy.push_back( inds[j + 1] << i );
+      _sparse_xy.push_back( inds[j + 0] << i );
+    }
   }
 
-#if VO_FRAME_USE_PARALLEL
-  tasks.wait();
-#endif
+  const int n = _sparse_xy.size() / 2;
+  _sparse_disparities.resize(n);
+  _sparse_disparity_provider(_sparse_xy.data(), n, _sparse_disparities.data());
 
-#undef VO_FRAME_USE_PARALLEL
+  forEachTemplateLevel(&VisualOdometryFrame::SetSparseTemplateLevel);
+}
 
-  _has_template = true;
+void VisualOdometryFrame::forEachTemplateLevel(void (*f)(void*, int))
+{
+  // the finest level is the most work, it runs on the calling thread
+  TaskGroup group;
+  for(int i = _tdata_pyr.size() - 1; i > _max_test_level; --i)
+    group.run(f, this, i);
+
+  f(this, _max_test_level);
+  group.wait();
+}
+
+void VisualOdometryFrame::SetTemplateLevel(void* frame, int i)
+{
+  auto* self = static_cast<VisualOdometryFrame*>(frame);
+  self->_tdata_pyr[i]->setData(self->_desc_pyr->operator[](i), *self->_disparity);
+}
+
+void VisualOdometryFrame::SelectTemplatePixels(void* frame, int i)
+{
+  auto* self = static_cast<VisualOdometryFrame*>(frame);
+  self->_tdata_pyr[i]->selectPixels(self->_desc_pyr->operator[](i));
+}
+
+void VisualOdometryFrame::SetSparseTemplateLevel(void* frame, int i)
+{
+  auto* self = static_cast<VisualOdometryFrame*>(frame);
+  self->_tdata_pyr[i]->setData(self->_desc_pyr->operator[](i),
+                               self->_sparse_disparities.data() + self->_sparse_offsets[i]);
 }
 
 void VisualOdometryFrame::setDataAndTemplate(const cv::Mat& image, const cv::Mat& disparity)
@@ -105,7 +226,8 @@ void VisualOdometryFrame::setDataAndTemplate(const cv::Mat& image, const cv::Mat
 
   for(size_t i = 0; i < _tdata_pyr.size(); ++i)
   {
-    auto code = [=]()
+    // by reference, the tasks are done before we return
+    auto code = [&, i]()
     {
       auto* desc = _desc_pyr->operator[](i);
       desc->compute(image_pyramid[i]);
@@ -38,6 +38,25 @@ class VisualOdometryFrame
    */
   void setData(const cv::Mat& image, const cv::Mat& disparity);
 
+  /**
+   * set the image now, the disparity is requested from the provider only when
+   * the template is computed, i.e. when the frame becomes a keyframe
+   */
+  void setData(const cv::Mat& image, const DisparityProvider& disparity);
+
+  /**
+   * set the image now, the disparity is requested from the provider only at the
+   * pixels selected for the template, when the frame becomes a keyframe
+   */
+  void setData(const cv::Mat& image, const SparseDisparityProvider& disparity);
+
+  /**
+   * borrow the image and disparity without copying them. The buffers must
+   * remain valid until clear() is called or new data is set, the handle is
+   * held until then
+   */
+  void setData(const cv::Mat& image, const cv::Mat& disparity, const BufferHandle& handle);
+
   /**
    */
   void setDataAndTemplate(const cv::Mat&, const cv::Mat&);
@@ -47,7 +66,11 @@ class VisualOdometryFrame
    */
   void setTemplate();
 
-  inline void clear() { _has_data = false; _has_template = false; }
+  /**
+   * marks the frame empty and releases borrowed buffers
+   */
+  void clear();
+
   inline bool empty() { return !_has_data; }
 
   inline bool hasTemplate() const { return _has_template; }
@@ -73,17 +96,38 @@ class VisualOdometryFrame
   const cv::Mat* imagePointer() const;
 
   /**
-   * \return pointer to the raw disparity
+   * \return pointer to the raw disparity. If the disparity is provided lazily,
+   * it is empty until setTemplate() is called
    */
   const cv::Mat* disparityPointer() const;
 
 
+ private:
+  void setSparseTemplate();
+  void releaseBorrowedData();
+
+  /**
+   * runs f(this, level) for the levels used by the template, in parallel.
+   * Each level has its own TemplateData and buffers
+   */
+  void forEachTemplateLevel(void (*f)(void*, int));
+  static void SetTemplateLevel(void* frame, int level);
+  static void SelectTemplatePixels(void* frame, int level);
+  static void SetSparseTemplateLevel(void* frame, int level);
+
  private:
   int _max_test_level;
   bool _has_data;
   bool _has_template;
   UniquePointer<cv::Mat> _image;
   UniquePointer<cv::Mat> _disparity;
+  DisparityProvider _disparity_provider;
+  SparseDisparityProvider _sparse_disparity_provider;
+  std::vector<int> _sparse_xy;
+  std::vector<int> _sparse_offsets;
+  std::vector<float> _sparse_disparities;
+  bool _is_borrowed; // true if _image and _disparity are borrowed views
+  BufferHandle _buffer_handle;
   UniquePointer<DenseDescriptorPyramid> _desc_pyr;
   std::vector<TemplateDataPointer> _tdata_pyr;
 }; // VisualOdometryFrame
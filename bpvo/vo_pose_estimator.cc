@@ -21,6 +21,7 @@
 
 #include <bpvo/vo_pose_estimator.h>
 #include <bpvo/vo_frame.h>
+#include <bpvo/math_utils.h>
 
 #include <algorithm>
 
@@ -55,22 +56,35 @@ class OptimizerLM
 VisualOdometryPoseEstimator::VisualOdometryPoseEstimator(const AlgorithmParameters& p)
     : _params(p)
     , _pose_est_params(p)
-    , _pose_est_params_low_res(p) {}
+    , _pose_est_params_low_res(p)
+    , _weights_level(p.maxTestLevel) {}
     //, _optimizer(new OptimizerLM(_pose_est_params)) {}
 
 VisualOdometryPoseEstimator::~VisualOdometryPoseEstimator() {}
 
-std::vector<OptimizerStatistics>
-VisualOdometryPoseEstimator::estimatePose(
+void VisualOdometryPoseEstimator::estimatePose(
     const VisualOdometryFrame* ref_frame, const VisualOdometryFrame* cur_frame,
-    const Matrix44& T_init, Matrix44& T_est)
+    const Matrix44& T_init, Matrix44& T_est, std::vector<OptimizerStatistics>& ret,
+    const Clock::time_point* frame_start)
 {
-  std::vector<OptimizerStatistics> ret(ref_frame->numLevels());
+  ret.assign(ref_frame->numLevels(), OptimizerStatistics());
   for(int i = 0; i < ret.size(); ++i )
   {
     ret[i].status = kSolverError;
   }
 
+  _finest_level = -1;
+  _stop_reason = kReachedMaxTestLevel;
+
+  const bool with_budget = _params.timeBudgetMs > 0.0f;
+  const auto t_start = frame_start ? *frame_start : Clock::now();
+  if(with_budget)
+    _ms_per_residual.resize(ref_frame->numLevels(), 0.0);
+
+  // every adaptiveLevelFullResInterval-th estimation uses all the levels
+  const bool adaptive = _params.adaptiveFinestLevel &&
+      _num_coarse_estimates + 1 < _params.adaptiveLevelFullResInterval;
+
   T_est = T_init;
   _pose_estimator.setParameters(_pose_est_params_low_res);
 
@@ -94,19 +108,113 @@ VisualOdometryPoseEstimator::estimatePose(
       Info("VOPoseEstimator: Pixels %d < min %d\n", 
            ref_frame->getTemplateDataAtLevel(i)->numPixels(), 
            minPix );
-      return ret;
+      _stop_reason = kTooFewPixels;
+      break;
+    }
+
+    if(with_budget && !setLevelBudget(ref_frame, i, t_start))
+    {
+      _stop_reason = kTimeBudgetExceeded;
+      break;
     }
 
+    // the weights are used for the point cloud at the finest level only, or
+    // the level the estimation may stop at
+    const bool store_weights = i == _params.maxTestLevel || with_budget ||
+        (adaptive && i == _params.maxTestLevel + 1);
+    _pose_estimator.setStoreWeights(store_weights);
+    if(store_weights)
+      _weights_level = i;
+    const auto t_level = Clock::now();
     ret[i] = _pose_estimator.run(ref_frame->getTemplateDataAtLevel(i),
                                  cur_frame->getDenseDescriptorAtLevel(i),
                                  T_est);
+    _finest_level = i;
+
+    if(with_budget && ret[i].numResidualEvaluations > 0)
+    {
+      const double ms = std::chrono::duration<double, std::milli>(
+          Clock::now() - t_level).count();
+      const double ms_per_residual = ms / ret[i].numResidualEvaluations;
+      auto& c = _ms_per_residual[i];
+      c = c > 0.0 ? 0.5 * (c + ms_per_residual) : ms_per_residual;
+    }
+
+    if(adaptive && i == _params.maxTestLevel + 1 &&
+       isCoarseSolutionGood(ret[i], T_init, T_est))
+    {
+      _stop_reason = kCoarseSolutionGood;
+      break;
+    }
     /*
     ret[i] = optimizer.run(ref_frame->getTemplateDataAtLevel(i),
                            cur_frame->getDenseDescriptorAtLevel(i),
                            T_est);*/
   }
 
-  return ret;
+  _pose_estimator.clearDeadline();
+
+  if(_finest_level == _params.maxTestLevel)
+    _num_coarse_estimates = 0;
+  else if(_stop_reason == kCoarseSolutionGood)
+    ++_num_coarse_estimates;
+}
+
+bool VisualOdometryPoseEstimator::isCoarseSolutionGood(
+    const OptimizerStatistics& stats, const Matrix44& T_init, const Matrix44& T_est) const
+{
+  if(stats.status != kParameterTolReached && stats.status != kFunctionTolReached &&
+     stats.status != kGradientTolReached)
+    return false;
+
+  if(stats.numPixels == 0 ||
+     stats.finalError / stats.numPixels > _params.adaptiveLevelMaxError)
+    return false;
+
+  // a large motion from the initialization is more likely to leave an error
+  // below the resolution of the coarse level
+  const Matrix44 dT = T_est * T_init.inverse();
+  if(dT.block<3,1>(0,3).norm() > _params.adaptiveLevelMaxTranslation)
+    return false;
+
+  const auto r = math::RotationMatrixToEulerAngles(dT.block<3,3>(0,0));
+  return math::rad2deg(r.lpNorm<Eigen::Infinity>()) <= _params.adaptiveLevelMaxRotation;
+}
+
+bool VisualOdometryPoseEstimator::setLevelBudget(
+    const VisualOdometryFrame* ref_frame, int level, Clock::time_point t_start)
+{
+  const double remaining = _params.timeBudgetMs - std::chrono::duration<double,
+        std::milli>(Clock::now() - t_start).count();
+
+  const int num_pixels = ref_frame->getTemplateDataAtLevel(level)->numPixels();
+  const double ms_per_eval = _ms_per_residual[level] * num_pixels;
+
+  // the coarsest level always runs, otherwise we have no pose at all. A finer
+  // level is worth it only if it can afford a couple of evaluations
+  if(level < ref_frame->numLevels() - 1 &&
+     (remaining <= 0.0 || 2.0 * ms_per_eval > remaining))
+    return false;
+
+  // the level gets a share of the remaining time proportional to its size
+  double num_pixels_left = 0.0;
+  for(int i = level; i >= _params.maxTestLevel; --i)
+    num_pixels_left += ref_frame->getTemplateDataAtLevel(i)->numPixels();
+  const double level_ms = std::max(0.0, remaining) * num_pixels /
+      std::max(1.0, num_pixels_left);
+
+  auto params = _pose_est_params;
+  if(ms_per_eval > 0.0)
+  {
+    // one evaluation is spent on the initial linearization
+    int max_iters = static_cast<int>(level_ms / ms_per_eval) - 1;
+    params.maxIterations = std::max(1, std::min(params.maxIterations, max_iters));
+  }
+
+  _pose_estimator.setParameters(params);
+  _pose_estimator.setDeadline(Clock::now() + std::chrono::duration_cast<Clock::duration>(
+          std::chrono::duration<double, std::milli>(level_ms)));
+  return true;
 }
 
 const WeightsVector& VisualOdometryPoseEstimator::getWeights() const
@@ -135,6 +243,7 @@ OptimizerLM::run(const TemplateData* tdata, const DenseDescriptor* channels,
 
   float sigma = 1.0f;
   AutoScaleEstimator scale_estimator;
+  scale_estimator.setEstimatorType(_params.scaleEstimator, _params.scaleEstimatorSubsample);
 
   Eigen::Matrix<float,6,6> H;
   Eigen::Matrix<float,6,1> G;
@@ -157,21 +266,6 @@ OptimizerLM::run(const TemplateData* tdata, const DenseDescriptor* channels,
     return ret;
   }; // Solve
 
-  /**
-   * replicate the valid flags so that they match the number of residuals
-   */
-  auto ReplicateValidFlags = [&]()
-  {
-    if(_residuals.size() != _valid.size()) {
-      int m = _residuals.size() / _valid.size();
-      decltype(_valid) tmp(_residuals.size());
-      auto* ptr = tmp.data();
-      for(int i = 0; i < m; ++i, ptr += _valid.size()) {
-        memcpy(ptr, _valid.data(), _valid.size() * sizeof(_valid[0]));
-      }
-    }
-  };
-
   /**
    * re-compute the weights for IRLS
    */
@@ -189,7 +283,6 @@ OptimizerLM::run(const TemplateData* tdata, const DenseDescriptor* channels,
   auto EvalFunc = [&](const Matrix44& pose_)
   {
     tdata->computeResiduals(channels, pose_, _residuals, _valid);
-    ReplicateValidFlags();
     ComputeWeights();
 
     num_func_evals++;
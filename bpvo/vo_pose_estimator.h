@@ -26,6 +26,8 @@
 #include <bpvo/template_data.h>
 #include <bpvo/types.h>
 
+#include <chrono>
+
 namespace bpvo {
 
 class VisualOdometryFrame;
@@ -33,6 +35,9 @@ class OptimizerLM;
 
 class VisualOdometryPoseEstimator
 {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
  public:
   VisualOdometryPoseEstimator(const AlgorithmParameters&);
   ~VisualOdometryPoseEstimator();
@@ -40,16 +45,35 @@ class VisualOdometryPoseEstimator
   /**
    * Estimate the pose of the cur_frame wrt to ref_frame
    *
-   * \return optimizerStatistics per pyrmaid level
-   *
    * \param T_init pose initialization
    * \param T_est  estimated pose
+   * \param stats  optimizerStatistics per pyramid level, the vector is reused
+   * \param frame_start if not null, AlgorithmParameters::timeBudgetMs counts
+   *        from this time instead of the start of the call. Used to share the
+   *        budget between the estimations of a frame
    */
-  std::vector<OptimizerStatistics>
-  estimatePose(const VisualOdometryFrame* ref_frame,
-               const VisualOdometryFrame* cur_frame,
-               const Matrix44& T_init,
-               Matrix44& T_est);
+  void estimatePose(const VisualOdometryFrame* ref_frame,
+                    const VisualOdometryFrame* cur_frame,
+                    const Matrix44& T_init,
+                    Matrix44& T_est,
+                    std::vector<OptimizerStatistics>& stats,
+                    const Clock::time_point* frame_start = nullptr);
+
+  /**
+   * \return the finest pyramid level used by the last call to estimatePose,
+   * -1 if none
+   */
+  inline int finestLevel() const { return _finest_level; }
+
+  /**
+   * \return why the last call to estimatePose did not use the finer levels
+   */
+  inline PyramidStopReason stopReason() const { return _stop_reason; }
+
+  /**
+   * \return the pyramid level of the weights returned by getWeights
+   */
+  inline int weightsLevel() const { return _weights_level; }
 
   float getFractionOfGoodPoints(float thresh) const;
 
@@ -60,6 +84,20 @@ class VisualOdometryPoseEstimator
   PoseEstimatorGN<TemplateData> _pose_estimator;
   PoseEstimatorParameters _pose_est_params;
   PoseEstimatorParameters _pose_est_params_low_res;
+
+  int _finest_level = -1;
+  PyramidStopReason _stop_reason = kReachedMaxTestLevel;
+  int _weights_level = 0;
+
+  // number of estimations since all the levels were used
+  int _num_coarse_estimates = 0;
+
+  // measured time per residual at each level in ms, to split the time budget
+  std::vector<double> _ms_per_residual;
+
+  bool setLevelBudget(const VisualOdometryFrame*, int level, Clock::time_point t_start);
+  bool isCoarseSolutionGood(const OptimizerStatistics&, const Matrix44& T_init,
+                            const Matrix44& T_est) const;
   //UniquePointer<OptimizerLM> _optimizer;
 }; // VisualOdometryPoseEstimator
 
@@ -50,11 +50,20 @@ if(CMAKE_COMPILER_IS_GNUCXX OR CMAKE_COMPILER_IS_CLANGCXX)
   addExtraCompilerOptions(-pthread)
   addExtraCompilerOptions(-Wabi)
 
-  addExtraCompilerOptions(-msse4.1)
-  addExtraCompilerOptions(-msse2)
-  addExtraCompilerOptions(-msse)
-  addExtraCompilerOptions(-mavx)
-  addExtraCompilerOptions(-mtune=native)
+  if(SIMD_BASELINE STREQUAL "native")
+    addExtraCompilerOptions(-march=native)
+  elseif(SIMD_BASELINE STREQUAL "avx2")
+    addExtraCompilerOptions(-mavx2)
+    addExtraCompilerOptions(-mfma)
+  elseif(SIMD_BASELINE STREQUAL "avx")
+    addExtraCompilerOptions(-mavx)
+  elseif(SIMD_BASELINE STREQUAL "sse4.1")
+    addExtraCompilerOptions(-msse4.1)
+  elseif(SIMD_BASELINE STREQUAL "sse2")
+    addExtraCompilerOptions(-msse2)
+  else()
+    message(FATAL_ERROR "Unknown SIMD_BASELINE \"${SIMD_BASELINE}\"")
+  endif()
   addExtraCompilerOptions(-mfpmath=sse)
 
   if(CMAKE_COMPILER_IS_GNUCXX)
@@ -131,15 +140,19 @@ set(CMAKE_EXE_LINKER_FLAGS_DEBUG   "${CMAKE_EXE_LINKER_FLAGS_DEBUG} ${EXTRA_EXE_
 
 # they mess up with the flags too much
 # and there seems to be an issue with AVX with gcc-4.9
-include(cmake/OptimizeForArchitecture.cmake)
-include(cmake/UserWarning.cmake)
-#set(Vc_AVX_INTRINSICS_BROKEN True)
-OptimizeForArchitecture()
-list(APPEND "${CMAKE_CXX_FLAGS}" "${Vc_ARCHITECTURE_FLAGS}")
-string(REPLACE ";" " " Vc_ARCHITECTURE_FLAGS_STR "${Vc_ARCHITECTURE_FLAGS}")
-set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} ${Vc_ARCHITECTURE_FLAGS}")
-
-list(APPEND CMAKE_CXX_FLAGS ${Vc_ARCHITECTURE_FLAGS})
+# the host flags are only used for a native build, they would raise the
+# baseline to the instruction sets of the build machine otherwise
+if(SIMD_BASELINE STREQUAL "native")
+  include(cmake/OptimizeForArchitecture.cmake)
+  include(cmake/UserWarning.cmake)
+  #set(Vc_AVX_INTRINSICS_BROKEN True)
+  OptimizeForArchitecture()
+  list(APPEND "${CMAKE_CXX_FLAGS}" "${Vc_ARCHITECTURE_FLAGS}")
+  string(REPLACE ";" " " Vc_ARCHITECTURE_FLAGS_STR "${Vc_ARCHITECTURE_FLAGS}")
+  set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} ${Vc_ARCHITECTURE_FLAGS}")
+
+  list(APPEND CMAKE_CXX_FLAGS ${Vc_ARCHITECTURE_FLAGS})
+endif()
 string(REPLACE ";" "  " FLAGS_STR "${CMAKE_CXX_FLAGS}")
 message(STATUS "flags ${FLAGS_STR}")
 set(CMAKE_CXX_FLAGS "${FLAGS_STR}")
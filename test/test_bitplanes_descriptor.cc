@@ -2,6 +2,7 @@
 #include "bpvo/timer.h"
 #include "bpvo/census.h"
 #include "bpvo/utils.h"
+#include "bpvo/imgproc.h"
 
 #include <opencv2/highgui/highgui.hpp>
 
@@ -31,13 +32,51 @@ void WriteImage(std::string filename, const cv::Mat& I)
   fclose(fp);
 }
 
+/**
+ * compares the fused BitPlanes channels against smoothing the binary channels,
+ * which was done before the census and the smoothing were fused
+ */
+static int CheckFused(int rows, int cols, float sigma_ct, float sigma_bp)
+{
+  cv::Mat I(rows, cols, CV_8UC1);
+  cv::randu(I, cv::Scalar(0), cv::Scalar(255));
+
+  BitPlanesDescriptor fused(sigma_ct, sigma_bp), binary(sigma_ct, -1.0f);
+  fused.compute(I);
+  binary.compute(I);
+
+  cv::Mat ref, buffer;
+  int num_bad = 0;
+  for(int i = 0; i < fused.numChannels(); ++i)
+  {
+    gaussianBlur(binary.getChannel(i), ref, 5, sigma_bp, buffer);
+
+    const cv::Mat& C = fused.getChannel(i);
+    for(int r = 0; r < rows; ++r)
+      for(int c = 0; c < cols; ++c)
+        num_bad += std::abs(C.at<float>(r,c) - ref.at<float>(r,c)) > 1e-5f;
+  }
+
+  printf("%dx%d sigma_ct %g: %d bad\n", rows, cols, sigma_ct, num_bad);
+  return num_bad;
+}
+
 int main()
 {
+  int num_bad = 0;
+
+  // the height is not a multiple of the bands, the last image is shorter than
+  // the blur
+  num_bad += CheckFused(100, 77, 0.0f, 1.618f);
+  num_bad += CheckFused(100, 77, 0.75f, 1.618f);
+  num_bad += CheckFused(4, 9, 0.0f, 1.618f);
+  num_bad += CheckFused(4, 9, 0.75f, 1.618f);
+
   cv::Mat I = cv::imread("/home/halismai/data/NewTsukubaStereoDataset/illumination/fluorescent/left/tsukuba_fluorescent_L_00001.png", cv::IMREAD_GRAYSCALE);
 
   if(I.empty()) {
     printf("failed to read image\n");
-    return 0;
+    return num_bad == 0 ? 0 : 1;
   }
 
   float sigma_ct = 0.75;
@@ -56,6 +95,6 @@ int main()
     WriteImage<float>(Format("C%d", i), desc.getChannel(i));
   }
 
-  return 0;
+  return num_bad == 0 ? 0 : 1;
 }
 
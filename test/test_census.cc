@@ -0,0 +1,115 @@
+#include "bpvo/census.h"
+#include "bpvo/census_avx.h"
+#include "bpvo/cpu_features.h"
+#include "bpvo/timer.h"
+
+#include <opencv2/core/core.hpp>
+
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace bpvo;
+
+//
+// plain implementations of the census masks
+//
+
+static uint8_t Census3x3(const cv::Mat& I, int y, int x)
+{
+  if(y < 1 || y >= I.rows - 1 || x < 1 || x >= I.cols - 1)
+    return 0;
+
+  uint8_t v = 0;
+  for(int dy = -1, k = 0; dy <= 1; ++dy)
+    for(int dx = -1; dx <= 1; ++dx)
+      if(dy || dx)
+        v |= (I.at<uint8_t>(y+dy, x+dx) >= I.at<uint8_t>(y, x)) << k++;
+  return v;
+}
+
+static uint32_t Census5x5(const cv::Mat& I, int y, int x)
+{
+  if(y < 2 || y >= I.rows - 2 || x < 2 || x >= I.cols - 2)
+    return 0;
+
+  uint32_t v = 0;
+  for(int dy = -2, t = 0; dy <= 2; ++dy)
+    for(int dx = -2; dx <= 2; ++dx)
+      if(dy || dx) {
+        if(I.at<uint8_t>(y+dy, x+dx) < I.at<uint8_t>(y, x))
+          v |= 1u << (8*(t/8) + 7 - t%8);
+        ++t;
+      }
+  return v;
+}
+
+static uint64_t Census9x7(const cv::Mat& I, int y, int x)
+{
+  if(y < 3 || y >= I.rows - 3 || x < 4 || x >= I.cols - 4)
+    return 0;
+
+  uint64_t v = 0;
+  for(int t = 0; t < 44; ++t) {
+    const int dy = Census9x7Offsets[t][0], dx = Census9x7Offsets[t][1];
+    v = (v << 1) | (I.at<uint8_t>(y+dy, x+dx) > I.at<uint8_t>(y-dy, x-dx));
+  }
+  return v;
+}
+
+int main()
+{
+  printf("CPU: %s\n", ToString(GetMaxSimdLevel()));
+
+  std::mt19937 gen(3);
+  std::uniform_int_distribution<int> dist(0, 255);
+
+  // widths around the vector sizes exercise the overlapping tails
+  const int sizes[][2] = { {480, 640}, {97, 131}, {40, 70}, {12, 33}, {9, 12} };
+
+  cv::Mat I_t(480, 640, CV_8UC1), C_t;
+  for(int i = 0; i < I_t.rows*I_t.cols; ++i)
+    I_t.ptr<uint8_t>()[i] = dist(gen);
+
+  std::vector<uint32_t> C5_t(I_t.rows*I_t.cols);
+  std::vector<uint64_t> C9_t(I_t.rows*I_t.cols);
+
+  // every kernel the CPU supports, the baseline is SSE
+  int num_bad = 0;
+  for(SimdLevel level : { kSimdSSE4_1, kSimdAVX2, kSimdAVX512 })
+  {
+    if(level > GetMaxSimdLevel())
+      break;
+
+    SetSimdLevel(level);
+
+    for(const auto& sz : sizes)
+    {
+      const int rows = sz[0], cols = sz[1];
+      cv::Mat I(rows, cols, CV_8UC1);
+      for(int i = 0; i < rows*cols; ++i) // with ties
+        I.ptr<uint8_t>()[i] = dist(gen) < 32 ? 100 : dist(gen);
+
+      cv::Mat C;
+      census(I, C);
+      std::vector<uint32_t> C5(rows*cols);
+      census5x5(I.ptr<uint8_t>(), rows, cols, C5.data());
+      std::vector<uint64_t> C9(rows*cols);
+      census9x7(I.ptr<uint8_t>(), rows, cols, C9.data());
+
+      for(int y = 0; y < rows; ++y)
+        for(int x = 0; x < cols; ++x)
+          num_bad += (C.at<uint8_t>(y,x) != Census3x3(I, y, x)) +
+              (C5[y*cols + x] != Census5x5(I, y, x)) +
+              (C9[y*cols + x] != Census9x7(I, y, x));
+    }
+
+    auto t3 = TimeCode(100, [&]() { census(I_t, C_t); });
+    auto t5 = TimeCode(100, [&]() { census5x5(I_t.ptr<uint8_t>(), I_t.rows, I_t.cols, C5_t.data()); });
+    auto t9 = TimeCode(100, [&]() { census9x7(I_t.ptr<uint8_t>(), I_t.rows, I_t.cols, C9_t.data()); });
+    printf("%-7s 3x3 %0.3f ms 5x5 %0.3f ms 9x7 %0.3f ms, %d mismatches so far\n",
+           ToString(level), t3, t5, t9, num_bad);
+  }
+
+  return num_bad == 0 ? 0 : 1;
+}
@@ -0,0 +1,181 @@
+#include "bpvo/vo.h"
+#include "bpvo/types.h"
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+using namespace bpvo;
+
+static const int rows = 240, cols = 320;
+
+/**
+ * a smooth random image with a constant disparity. Adding it repeatedly gives
+ * identical frames
+ */
+struct SyntheticScene
+{
+  cv::Mat I, D;
+  Matrix33 K;
+
+  SyntheticScene()
+  {
+    cv::Mat tmp;
+    I.create(rows, cols, CV_8UC1);
+    cv::randu(I, cv::Scalar(0), cv::Scalar(255));
+    cv::GaussianBlur(I, tmp, cv::Size(7,7), 2.0);
+    cv::normalize(tmp, I, 0, 255, cv::NORM_MINMAX);
+
+    D = cv::Mat(rows, cols, CV_32FC1, cv::Scalar(16.0f));
+
+    K << 400.0, 0.0, cols/2.0,
+         0.0, 400.0, rows/2.0,
+         0.0, 0.0, 1.0;
+  }
+}; // SyntheticScene
+
+static AlgorithmParameters MakeParameters()
+{
+  AlgorithmParameters params;
+  params.verbosity = VerbosityType::kSilent;
+  params.minRatioPixelsToWork = 0; // the synthetic image is small
+  return params;
+}
+
+/**
+ * \return the median finest level of frames 1..9 with the given budget
+ */
+static int MedianFinestLevel(const SyntheticScene& scene, float budget)
+{
+  auto params = MakeParameters();
+  params.timeBudgetMs = budget;
+  VisualOdometry vo(scene.K, 0.1, ImageSize(rows, cols), params);
+
+  vo.addFrame(scene.I, scene.D);
+
+  std::vector<int> levels;
+  for(int i = 1; i < 10; ++i)
+    levels.push_back(vo.addFrame(scene.I, scene.D).finestLevel);
+
+  std::nth_element(levels.begin(), levels.begin() + levels.size()/2, levels.end());
+  return levels[levels.size()/2];
+}
+
+//
+// with a budget that is exhausted by the coarsest level, the pose estimation
+// must stop there and say so
+//
+static int TestTimeBudget(const SyntheticScene& scene)
+{
+  auto params = MakeParameters();
+
+  int num_bad = 0;
+  for(float budget : { 0.0f, 1e-6f })
+  {
+    params.timeBudgetMs = budget;
+    VisualOdometry vo(scene.K, 0.1, ImageSize(rows, cols), params);
+
+    vo.addFrame(scene.I, scene.D); // the first frame has no pose to estimate
+
+    for(int i = 1; i < 10; ++i)
+    {
+      const Result result = vo.addFrame(scene.I, scene.D);
+      const int num_levels = result.optimizerStatistics.size();
+
+      // no budget uses all the levels, a tiny one only the coarsest
+      const int finest_level = budget > 0.0f ? num_levels - 1 : params.maxTestLevel;
+      const PyramidStopReason reason = budget > 0.0f ?
+          kTimeBudgetExceeded : kReachedMaxTestLevel;
+
+      printf("budget %g frame %d: finest level %d/%d %s\n", budget, i,
+             result.finestLevel, num_levels, ToString(result.pyramidStopReason).c_str());
+
+      if(num_levels < 2 || result.finestLevel != finest_level ||
+         result.pyramidStopReason != reason)
+        ++num_bad;
+    }
+  }
+
+  return num_bad;
+}
+
+//
+// the finest level must follow the budget. The timings depend on the machine,
+// hence the budget is doubled until the estimation goes past the coarsest
+// level. This first budget must not jump all the way to maxTestLevel
+//
+static int TestMidRangeBudget(const SyntheticScene& scene)
+{
+  const auto params = MakeParameters();
+  const int coarsest_level = MedianFinestLevel(scene, 1e-6f);
+
+  for(float budget = 1.0f/64; budget < 1000.0f; budget *= 2.0f)
+  {
+    const int finest_level = MedianFinestLevel(scene, budget);
+    if(finest_level < coarsest_level)
+    {
+      printf("budget %g: median finest level %d coarsest %d\n", budget,
+             finest_level, coarsest_level);
+      return finest_level > params.maxTestLevel ? 0 : 1;
+    }
+  }
+
+  printf("the estimation did not go past the coarsest level\n");
+  return 1;
+}
+
+//
+// identical frames are solved exactly at the coarse levels. With
+// adaptiveFinestLevel the estimation must stop at maxTestLevel+1, except for
+// one full resolution estimation every adaptiveLevelFullResInterval
+//
+static int TestAdaptiveLevel(const SyntheticScene& scene)
+{
+  auto params = MakeParameters();
+  params.adaptiveFinestLevel = true;
+  params.adaptiveLevelFullResInterval = 4;
+
+  // with identical frames the residuals are ~0 and the robust weights, hence
+  // the fraction of good points, are meaningless. A keyframe estimates twice
+  // and would shift the interval
+  params.maxFractionOfGoodPointsToKeyFrame = 0.0f;
+
+  VisualOdometry vo(scene.K, 0.1, ImageSize(rows, cols), params);
+
+  vo.addFrame(scene.I, scene.D); // the first frame has no pose to estimate
+
+  int num_bad = 0;
+  for(int i = 1; i <= 4*params.adaptiveLevelFullResInterval; ++i)
+  {
+    const Result result = vo.addFrame(scene.I, scene.D);
+
+    const bool full_res = i % params.adaptiveLevelFullResInterval == 0;
+    const int finest_level = full_res ? params.maxTestLevel : params.maxTestLevel + 1;
+    const PyramidStopReason reason = full_res ? kReachedMaxTestLevel : kCoarseSolutionGood;
+
+    printf("frame %d: finest level %d %s keyframe %d\n", i, result.finestLevel,
+           ToString(result.pyramidStopReason).c_str(), result.isKeyFrame);
+
+    if(result.isKeyFrame || result.finestLevel != finest_level ||
+       result.pyramidStopReason != reason)
+      ++num_bad;
+  }
+
+  return num_bad;
+}
+
+int main()
+{
+  const SyntheticScene scene;
+
+  int num_bad = 0;
+  num_bad += TestTimeBudget(scene);
+  num_bad += TestMidRangeBudget(scene);
+  num_bad += TestAdaptiveLevel(scene);
+
+  printf("%d bad\n", num_bad);
+  return num_bad == 0 ? 0 : 1;
+}
@@ -0,0 +1,127 @@
+#include "bpvo/nonmax_suppression.h"
+#include "bpvo/cpu_features.h"
+#include "bpvo/imgproc.h"
+#include "bpvo/timer.h"
+
+#include <opencv2/core/core.hpp>
+
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace bpvo;
+
+//
+// the per-pixel selection that NonMaxSuppression replaces
+//
+static void SelectPixels(const cv::Mat& S, int radius, float min_saliency, int border,
+                         std::vector<uint16_t>& inds)
+{
+  inds.resize(0);
+  for(int y = border; y < S.rows - border - 1; ++y)
+    for(int x = border; x < S.cols - border - 1; ++x)
+    {
+      const float v = S.at<float>(y, x);
+      if(v < min_saliency)
+        continue;
+
+      bool is_max = true;
+      for(int r = -radius; r <= radius && is_max; ++r)
+        for(int c = -radius; c <= radius && is_max; ++c)
+          is_max = (!r && !c) || S.at<float>(y + r, x + c) < v;
+
+      if(is_max) {
+        inds.push_back(y);
+        inds.push_back(x);
+      }
+    }
+}
+
+int main()
+{
+  printf("CPU: %s\n", ToString(GetMaxSimdLevel()));
+
+  std::mt19937 gen(7);
+  std::uniform_int_distribution<int> dist(0, 63);
+
+  const int sizes[][2] = { {480, 640}, {120, 160}, {37, 45}, {9, 13} };
+
+  cv::Mat S_t(480, 640, CV_32FC1), D_t(960, 1280, CV_32FC1);
+  for(int i = 0; i < S_t.rows*S_t.cols; ++i)
+    S_t.ptr<float>()[i] = dist(gen) / 63.0f;
+  for(int i = 0; i < D_t.rows*D_t.cols; ++i)
+    D_t.ptr<float>()[i] = dist(gen) - 8.0f;
+
+  NonMaxSuppression nms;
+  std::vector<uint16_t> inds, inds_ref;
+  std::vector<float> disparities;
+
+  int num_bad = 0;
+  for(SimdLevel level : { kSimdSSE4_1, kSimdAVX })
+  {
+    if(level > GetMaxSimdLevel())
+      break;
+
+    SetSimdLevel(level);
+
+    for(const auto& sz : sizes)
+      for(int radius = 0; radius <= 4; ++radius)
+      {
+        // quantized values give plenty of ties
+        cv::Mat S(sz[0], sz[1], CV_32FC1);
+        for(int i = 0; i < S.rows*S.cols; ++i)
+          S.ptr<float>()[i] = dist(gen) / 63.0f;
+
+        const int border = std::max(radius, 3);
+        nms.setRadius(radius);
+        nms.setMinSaliency(0.1f);
+        nms.setBorder(border);
+
+        nms.run(S, inds);
+        SelectPixels(S, radius, 0.1f, border, inds_ref);
+        num_bad += inds != inds_ref;
+
+        // the disparity is read from a map at twice the resolution
+        cv::Mat D(2*S.rows, 2*S.cols, CV_32FC1);
+        for(int i = 0; i < D.rows*D.cols; ++i)
+          D.ptr<float>()[i] = dist(gen) - 8.0f;
+
+        nms.run(S, NonMaxSuppression::Disparity{&D, 2, 1.0f, 40.0f}, inds, disparities);
+        size_t j = 0;
+        for(size_t i = 0; i < inds_ref.size(); i += 2) {
+          const float d = D.at<float>(2*inds_ref[i], 2*inds_ref[i+1]);
+          if(d >= 1.0f && d <= 40.0f) {
+            num_bad += j + 1 >= inds.size() || inds[j] != inds_ref[i] ||
+                inds[j+1] != inds_ref[i+1] || disparities[j/2] != d;
+            j += 2;
+          }
+        }
+        num_bad += j != inds.size() || disparities.size() != j/2;
+      }
+
+    nms.setRadius(1);
+    nms.setBorder(3);
+    auto t1 = TimeCode(100, [&]() { nms.run(S_t, inds); });
+    auto t1_d = TimeCode(100, [&]() {
+      nms.run(S_t, NonMaxSuppression::Disparity{&D_t, 2, 1.0f, 40.0f}, inds, disparities); });
+    nms.setRadius(3);
+    auto t3 = TimeCode(100, [&]() { nms.run(S_t, inds); });
+
+    IsLocalMax<float> is_local_max(S_t.ptr<const float>(), S_t.cols, 1);
+    auto t_ref = TimeCode(100, [&]() {
+      inds_ref.resize(0);
+      for(int y = 3; y < S_t.rows - 4; ++y)
+        for(int x = 3; x < S_t.cols - 4; ++x)
+          if(S_t.at<float>(y,x) >= 0.1f && is_local_max(y, x)) {
+            inds_ref.push_back(y);
+            inds_ref.push_back(x);
+          }
+    });
+
+    printf("%-7s r=1 %0.3f ms (with disparity %0.3f ms) r=3 %0.3f ms, "
+           "IsLocalMax r=1 %0.3f ms, %d mismatches so far\n",
+           ToString(level), t1, t1_d, t3, t_ref, num_bad);
+  }
+
+  return num_bad == 0 ? 0 : 1;
+}
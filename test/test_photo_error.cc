@@ -0,0 +1,121 @@
+#include "bpvo/photo_error.h"
+#include "bpvo/interp_avx2.h"
+#include "bpvo/timer.h"
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+using namespace bpvo;
+
+int main()
+{
+  const int rows = 480, cols = 640;
+  // odd number of points to exercise the tails
+  const int N = 320*240 + 5;
+
+  std::mt19937 gen(7);
+  std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+
+  std::vector<float> I1(rows*cols);
+  for(auto& v : I1)
+    v = dist(gen);
+
+  // template points are in raster order, warped with a small motion. Some of
+  // them fall outside the image
+  std::uniform_real_distribution<float> dist_d(-2.0f, 2.0f);
+  PhotoError::PointVector X(N);
+  std::vector<float> I0(N);
+  for(int i = 0; i < N; ++i) {
+    float x = 2.0f * (i % (cols/2)), y = 2.0f * (i / (cols/2));
+    X[i] = Point(x + dist_d(gen) - 1.0f, y + dist_d(gen), 1.0f, 1.0f);
+    I0[i] = dist(gen);
+  }
+
+  Matrix34 P(Matrix34::Zero());
+  P(0,0) = P(1,1) = P(2,2) = 1.0f;
+
+  printf("AVX2/FMA kernel: %s\n", HasBilinearAvx2() ? "yes" : "no");
+
+  PhotoError photo_error(kLinear);
+  ValidVector valid;
+  ResidualsVector R(N);
+
+  auto t_init = TimeCode(20, [&]() { photo_error.init(P, X, valid, rows, cols); });
+  auto t_run = TimeCode(20, [&]() { photo_error.run(I0.data(), I1.data(), R.data()); });
+
+  double max_err = 0.0;
+  int num_valid = 0;
+  for(int i = 0; i < N; ++i) {
+    double r_ref = 0.0;
+    if(valid[i]) {
+      int xi = (int) std::floor(X[i].x()), yi = (int) std::floor(X[i].y());
+      double xf = X[i].x() - xi, yf = X[i].y() - yi;
+      const float* p = I1.data() + yi*cols + xi;
+      r_ref = (1.0 - yf) * ((1.0 - xf)*p[0] + xf*p[1]) +
+          yf * ((1.0 - xf)*p[cols] + xf*p[cols+1]) - I0[i];
+      ++num_valid;
+    }
+    max_err = std::max(max_err, std::fabs(r_ref - R[i]));
+  }
+
+  printf("%d/%d valid points init %0.3f ms run %0.3f ms max error %g\n",
+         num_valid, N, t_init, t_run, max_err);
+
+  // 8 channels, one pass per channel vs. all channels per point
+  const int C = 8;
+  std::vector<float> I1_c(C*rows*cols), I0_c(C*N);
+  for(auto& v : I1_c)
+    v = dist(gen);
+  for(auto& v : I0_c)
+    v = dist(gen);
+
+  const float* I1_ptrs[C];
+  for(int c = 0; c < C; ++c)
+    I1_ptrs[c] = I1_c.data() + c*rows*cols;
+
+  ResidualsVector R_c(C*N), R_fused(C*N);
+  auto t_channels = TimeCode(20, [&]() {
+    for(int c = 0; c < C; ++c)
+      photo_error.run(I0_c.data() + c*N, I1_ptrs[c], R_c.data() + c*N);
+  });
+  auto t_fused = TimeCode(20, [&]() {
+    photo_error.run(I1_ptrs, C, I0_c.data(), N, R_fused.data(), N, 0, N);
+  });
+
+  // the same channels interleaved per pixel
+  std::vector<float> I1_packed(C*rows*cols);
+  for(int i = 0; i < rows*cols; ++i)
+    for(int c = 0; c < C; ++c)
+      I1_packed[i*C + c] = I1_ptrs[c][i];
+
+  ResidualsVector R_packed(C*N);
+  auto t_packed = TimeCode(20, [&]() {
+    photo_error.run(I1_packed.data(), C, C, I0_c.data(), N, R_packed.data(), N, 0, N);
+  });
+
+  // and in 16-bit fixed point
+  const float scale = 32767.0f;
+  std::vector<int16_t> I1_i16(C*rows*cols);
+  for(size_t i = 0; i < I1_i16.size(); ++i)
+    I1_i16[i] = static_cast<int16_t>(std::lrint(I1_packed[i] * scale));
+
+  ResidualsVector R_i16(C*N);
+  auto t_i16 = TimeCode(20, [&]() {
+    photo_error.run(I1_i16.data(), 1.0f / scale, C, C, I0_c.data(), N, R_i16.data(), N, 0, N);
+  });
+
+  float max_diff = 0.0f, max_diff_i16 = 0.0f;
+  for(int i = 0; i < C*N; ++i) {
+    max_diff = std::max(max_diff, std::fabs(R_c[i] - R_fused[i]));
+    max_diff = std::max(max_diff, std::fabs(R_c[i] - R_packed[i]));
+    max_diff_i16 = std::max(max_diff_i16, std::fabs(R_c[i] - R_i16[i]));
+  }
+
+  printf("%d channels: per channel %0.3f ms fused %0.3f ms packed %0.3f ms max difference %g\n",
+         C, t_channels, t_fused, t_packed, max_diff);
+  printf("%d channels: packed int16 %0.3f ms max difference %g\n", C, t_i16, max_diff_i16);
+
+  return max_err < 1e-5 && max_diff < 1e-5 && max_diff_i16 < 1e-3 ? 0 : 1;
+}
@@ -0,0 +1,89 @@
+#include "bpvo/linear_system_builder.h"
+#include "bpvo/rank_update_avx2.h"
+#include "bpvo/vector6.h"
+#include "bpvo/timer.h"
+
+#include <Eigen/Dense>
+
+#include <cstdio>
+#include <random>
+
+using namespace bpvo;
+
+typedef LinearSystemBuilder::Hessian  Hessian;
+typedef LinearSystemBuilder::Gradient Gradient;
+
+static inline double RelativeError(const Hessian& H, const Gradient& G,
+                                   const Eigen::Matrix<double,6,6>& H_ref,
+                                   const Eigen::Matrix<double,6,1>& G_ref)
+{
+  return std::max((H.cast<double>() - H_ref).norm() / H_ref.norm(),
+                  (G.cast<double>() - G_ref).norm() / G_ref.norm());
+}
+
+int main()
+{
+  // odd number of points to exercise the tails
+  const int N = 320*240 + 5;
+
+  std::mt19937 gen(7);
+  std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+  LinearSystemBuilder::JacobianVector J(N + 1, LinearSystemBuilder::Jacobian::Zero());
+  Vector6::AlignedStdVector J6(N);
+  ResidualsVector R(N), W(N);
+  ValidVector V(N, 1);
+  for(int i = 0; i < N; ++i) {
+    for(int k = 0; k < 6; ++k)
+      J6[i][k] = J[i][k] = dist(gen);
+    R[i] = dist(gen);
+    W[i] = 0.5f * (1.0f + dist(gen));
+  }
+
+  JacobianSoA<6> J_soa;
+  J_soa.assign(J.data(), N);
+
+  Eigen::Matrix<double,6,6> H_ref(Eigen::Matrix<double,6,6>::Zero());
+  Eigen::Matrix<double,6,1> G_ref(Eigen::Matrix<double,6,1>::Zero());
+  for(int i = 0; i < N; ++i) {
+    Eigen::Matrix<double,6,1> j = J[i].transpose().cast<double>();
+    H_ref += W[i] * j * j.transpose();
+    G_ref += (W[i] * R[i]) * j;
+  }
+
+  printf("AVX2/FMA kernel: %s\n", HasRankUpdateAvx2() ? "yes" : "no");
+
+  int num_bad = 0;
+  const double tol = 1e-4;
+
+  Hessian H;
+  Gradient G;
+  auto t_aos = TimeCode(20, [&]() { LinearSystemBuilder::Run(J, R, W, V, &H, &G); });
+  auto err = RelativeError(H, G, H_ref, G_ref);
+  printf("AoS     %0.3f ms error %g\n", t_aos, err);
+  num_bad += err > tol;
+
+  auto t_soa = TimeCode(20, [&]() {
+    NormalEquationsAccumulator acc;
+    acc.add(J_soa, 0, R.data(), W.data(), N);
+    acc.get(&H, &G);
+  });
+  err = RelativeError(H, G, H_ref, G_ref);
+  printf("SoA     %0.3f ms error %g\n", t_soa, err);
+  num_bad += err > tol;
+
+  auto t_v6 = TimeCode(20, [&]() {
+    float H_upper[21] = {0.0f}, G_data[6] = {0.0f}, e = 0.0f;
+    Vector6::RankUpdate(J6.data(), R.data(), W.data(), N, H_upper, G_data, &e);
+    for(int i = 0, k = 0; i < 6; ++i) {
+      for(int j = i; j < 6; ++j, ++k)
+        H(i, j) = H(j, i) = H_upper[k];
+      G[i] = G_data[i];
+    }
+  });
+  err = RelativeError(H, G, H_ref, G_ref);
+  printf("Vector6 %0.3f ms error %g\n", t_v6, err);
+  num_bad += err > tol;
+
+  return num_bad == 0 ? 0 : 1;
+}
@@ -0,0 +1,85 @@
+#include "bpvo/mestimator.h"
+#include "bpvo/cpu_features.h"
+#include "bpvo/timer.h"
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+
+using namespace bpvo;
+
+static float EstimateScale(ScaleEstimatorType t, bool subsample,
+                           const ResidualsVector& r, const ValidVector& v)
+{
+  AutoScaleEstimator e;
+  e.setEstimatorType(t, subsample);
+  return e.estimateScale(r, v);
+}
+
+int main()
+{
+  printf("CPU: %s\n", ToString(GetMaxSimdLevel()));
+
+  std::mt19937 gen(11);
+
+  // 8 channels of 10k points, as with BitPlanes, with a few sizes that are not
+  // a multiple of the vector size
+  const int num_channels = 8;
+  int num_bad = 0;
+  for(int n : {10000, 1003, 37})
+    for(float sigma : {0.01f, 1.0f, 20.0f})
+    {
+      std::normal_distribution<float> inliers(0.0f, sigma);
+      std::uniform_real_distribution<float> outliers(-50.0f*sigma, 50.0f*sigma);
+      std::uniform_int_distribution<int> coin(0, 9);
+
+      ResidualsVector r(num_channels * n);
+      ValidVector v(n);
+      for(auto& x : r)
+        x = coin(gen) < 2 ? outliers(gen) : inliers(gen);
+      for(auto& x : v)
+        x = coin(gen) != 0;
+
+      for(bool subsample : {false, true})
+      {
+        const float s0 = EstimateScale(kExactMedian, subsample, r, v);
+        for(SimdLevel level : { kSimdSSE2, kSimdAVX2 })
+        {
+          if(level > GetMaxSimdLevel())
+            break;
+
+          SetSimdLevel(level);
+          const float s1 = EstimateScale(kApproximateMedian, subsample, r, v);
+          const float err = std::fabs(s1 - s0) / s0;
+          if(err > 0.02f) {
+            printf("n=%d sigma=%g subsample=%d %s: %g vs %g\n", n, sigma, subsample,
+                   ToString(level), s1, s0);
+            ++num_bad;
+          }
+        }
+        SetSimdLevel(GetMaxSimdLevel());
+      }
+    }
+
+  {
+    const int n = 10000;
+    std::normal_distribution<float> dist(0.0f, 5.0f);
+    ResidualsVector r(num_channels * n);
+    ValidVector v(n, 1);
+    for(auto& x : r)
+      x = dist(gen);
+
+    AutoScaleEstimator e0, e1, e2;
+    e1.setEstimatorType(kApproximateMedian);
+    e2.setEstimatorType(kApproximateMedian, true);
+    float s0 = 0, s1 = 0, s2 = 0;
+    auto t0 = TimeCode(100, [&]() { e0.reset(); s0 = e0.estimateScale(r, v); });
+    auto t1 = TimeCode(100, [&]() { e1.reset(); s1 = e1.estimateScale(r, v); });
+    auto t2 = TimeCode(100, [&]() { e2.reset(); s2 = e2.estimateScale(r, v); });
+    printf("exact %0.3f ms (%f) approximate %0.3f ms (%f) subsampled %0.3f ms (%f)\n",
+           t0, s0, t1, s1, t2, s2);
+  }
+
+  printf("%d bad estimates\n", num_bad);
+  return num_bad == 0 ? 0 : 1;
+}
@@ -0,0 +1,47 @@
+#include "utils/sparse_stereo.h"
+#include "bpvo/timer.h"
+
+#include <opencv2/core/core.hpp>
+
+#include <cstdio>
+#include <cmath>
+#include <vector>
+
+using namespace bpvo;
+
+int main()
+{
+  // synthetic rectified pair, the right image is the left shifted by 'd_true'
+  const int rows = 240, cols = 320, d_true = 17;
+
+  cv::Mat left(rows, cols, CV_8UC1), right(rows, cols, CV_8UC1);
+  cv::randu(left, cv::Scalar(0), cv::Scalar(255));
+  for(int y = 0; y < rows; ++y)
+    for(int x = 0; x < cols; ++x)
+      right.at<uint8_t>(y, x) = x + d_true < cols ? left.at<uint8_t>(y, x + d_true) : 0;
+
+  std::vector<int> xy;
+  for(int y = 10; y < rows - 10; y += 7)
+    for(int x = 64; x < cols - 10; x += 5) {
+      xy.push_back(x);
+      xy.push_back(y);
+    }
+
+  const int n = xy.size() / 2;
+  std::vector<float> disparity(n);
+
+  SparseStereo::Config config;
+  config.numberOfDisparities = 48;
+  SparseStereo stereo(config);
+
+  auto t_ms = TimeCode(10, [&]() {
+                       stereo.setImages(left, right);
+                       stereo.compute(xy.data(), n, disparity.data()); });
+
+  int num_bad = 0;
+  for(int i = 0; i < n; ++i)
+    num_bad += std::fabs(disparity[i] - d_true) > 0.5f;
+
+  printf("%d points in %0.2f ms, %d bad\n", n, t_ms, num_bad);
+  return num_bad == 0 ? 0 : 1;
+}
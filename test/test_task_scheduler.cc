@@ -0,0 +1,79 @@
+#include "bpvo/task_scheduler.h"
+#include "bpvo/parallel.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+using namespace bpvo;
+
+static void Throw(void*, int i)
+{
+  throw std::runtime_error("task " + std::to_string(i));
+}
+
+static void Count(void* n, int)
+{
+  ++*static_cast<std::atomic<int>*>(n);
+}
+
+static void Sleep(void*, int)
+{
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+}
+
+int main()
+{
+  setNumThreads(4);
+
+  int num_bad = 0;
+
+  // a task that throws, on a worker or on the waiting thread, does not stop
+  // the others and wait() rethrows
+  for(int k = 0; k < 100; ++k)
+  {
+    std::atomic<int> n(0);
+    TaskGroup group;
+    for(int i = 0; i < 16; ++i)
+      group.run(i == k % 16 ? &Throw : &Count, &n, i);
+
+    bool caught = false;
+    try {
+      group.wait();
+    } catch(const std::runtime_error&) {
+      caught = true;
+    }
+
+    if(!caught || n != 15) {
+      printf("run %d: caught %d, %d tasks done\n", k, caught, n.load());
+      ++num_bad;
+    }
+
+    // the group can be used again after the exception
+    group.run(&Count, &n, 0);
+    group.wait();
+  }
+
+  // waiting on a long task sleeps instead of spinning
+  {
+    TaskGroup group;
+    const auto c0 = std::clock();
+    const auto t0 = std::chrono::steady_clock::now();
+    group.run(&Sleep, nullptr, 0);
+    group.wait();
+    const double cpu_ms = 1000.0 * (std::clock() - c0) / CLOCKS_PER_SEC;
+    const double wall_ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - t0).count();
+
+    printf("waited %0.1f ms, cpu %0.1f ms\n", wall_ms, cpu_ms);
+    if(cpu_ms > 0.5 * wall_ms)
+      ++num_bad;
+  }
+
+  printf("%d bad\n", num_bad);
+  return num_bad == 0 ? 0 : 1;
+}
@@ -0,0 +1,187 @@
+#include "bpvo/vo.h"
+#include "bpvo/types.h"
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+
+//
+// counts the heap allocations made by the process by interposing the glibc
+// allocation functions
+//
+static std::atomic<long> g_num_allocs(0);
+
+#if defined(__GLIBC__)
+extern "C" {
+void* __libc_malloc(size_t);
+void* __libc_calloc(size_t, size_t);
+void* __libc_realloc(void*, size_t);
+void* __libc_memalign(size_t, size_t);
+
+void* malloc(size_t n) { ++g_num_allocs; return __libc_malloc(n); }
+void* calloc(size_t n, size_t s) { ++g_num_allocs; return __libc_calloc(n, s); }
+void* realloc(void* p, size_t n) { ++g_num_allocs; return __libc_realloc(p, n); }
+void* memalign(size_t a, size_t n) { ++g_num_allocs; return __libc_memalign(a, n); }
+void* aligned_alloc(size_t a, size_t n) { ++g_num_allocs; return __libc_memalign(a, n); }
+
+int posix_memalign(void** p, size_t a, size_t n)
+{
+  ++g_num_allocs;
+  *p = __libc_memalign(a, n);
+  return *p ? 0 : 12; // ENOMEM
+}
+} // extern "C"
+#endif
+
+using namespace bpvo;
+
+static const int rows = 240, cols = 320;
+
+static VisualOdometry* MakeVo(const AlgorithmParameters& params)
+{
+  Matrix33 K;
+  K << 400.0, 0.0, cols/2.0,
+       0.0, 400.0, rows/2.0,
+       0.0, 0.0, 1.0;
+
+  return new VisualOdometry(K, 0.1, ImageSize(rows, cols), params);
+}
+
+int main()
+{
+#if !defined(__GLIBC__)
+  printf("allocation counting requires glibc, skipping\n");
+  return 0;
+#else
+  cv::Mat I(rows, cols, CV_8UC1), tmp;
+  cv::randu(I, cv::Scalar(0), cv::Scalar(255));
+  cv::GaussianBlur(I, tmp, cv::Size(7,7), 2.0);
+  cv::normalize(tmp, I, 0, 255, cv::NORM_MINMAX);
+
+  const cv::Mat D(rows, cols, CV_32FC1, cv::Scalar(16.0f));
+
+  // a wider image for the moving frames, they are windows of it
+  const int max_shift = 8;
+  cv::Mat I_wide(rows, cols + max_shift, CV_8UC1);
+  cv::randu(I_wide, cv::Scalar(0), cv::Scalar(255));
+  cv::GaussianBlur(I_wide, tmp, cv::Size(7,7), 2.0);
+  cv::normalize(tmp, I_wide, 0, 255, cv::NORM_MINMAX);
+
+  AlgorithmParameters params;
+  params.verbosity = VerbosityType::kSilent;
+  params.minRatioPixelsToWork = 0; // the synthetic image is small
+
+  int num_bad = 0;
+
+  // identical frames, hence no keyframes after the first one. Allow a few
+  // frames for the buffers to reach their steady state size
+  const int NumWarmupFrames = 5, NumFrames = 20;
+
+  // the borrowed buffers of a FrameView, the result is reused. The buffers
+  // outlive vo, the handle has nothing to release
+  {
+    UniquePointer<VisualOdometry> vo(MakeVo(params));
+    const FrameView view(I.ptr<uint8_t>(), D.ptr<float>(),
+                         BufferHandle(&g_num_allocs, [](void*) {}));
+
+    Result result;
+    for(int i = 0; i < NumWarmupFrames + NumFrames; ++i)
+    {
+      const long n0 = g_num_allocs;
+      vo->addFrame(view, result);
+      const long n = g_num_allocs - n0;
+
+      if(i >= NumWarmupFrames && (result.isKeyFrame || n > 0)) {
+        printf("view frame %d: %ld allocations keyframe: %d\n", i, n, result.isKeyFrame);
+        ++num_bad;
+      }
+    }
+  }
+
+  // the cv::Mat overload copies the frame into the buffers of the previous one
+  {
+    UniquePointer<VisualOdometry> vo(MakeVo(params));
+
+    Result result;
+    for(int i = 0; i < NumWarmupFrames + NumFrames; ++i)
+    {
+      const long n0 = g_num_allocs;
+      vo->addFrame(I, D, result);
+      const long n = g_num_allocs - n0;
+
+      if(i >= NumWarmupFrames && (result.isKeyFrame || n > 0)) {
+        printf("cv::Mat frame %d: %ld allocations keyframe: %d\n", i, n, result.isKeyFrame);
+        ++num_bad;
+      }
+    }
+  }
+
+  // a returned Result allocates its optimizerStatistics
+  {
+    UniquePointer<VisualOdometry> vo(MakeVo(params));
+
+    for(int i = 0; i < NumWarmupFrames + NumFrames; ++i)
+    {
+      const long n0 = g_num_allocs;
+      const bool is_keyframe = vo->addFrame(I, D).isKeyFrame;
+      const long n = g_num_allocs - n0;
+
+      if(i >= NumWarmupFrames && (is_keyframe || n > 1)) {
+        printf("returned Result frame %d: %ld allocations keyframe: %d\n", i, n, is_keyframe);
+        ++num_bad;
+      }
+    }
+  }
+
+  // keyframes: the frames move back and forth by one pixel, with the
+  // translation threshold every fourth frame is a keyframe. The template of a
+  // keyframe reuses the buffers of its frame, once they have seen all the
+  // images. What a keyframe still allocates:
+  //  - the PointCloud returned in the Result, and its points
+  //  - the string of the keyframing reason printed with Info
+  //  - the scratch matrix and its transpose of RigidBodyWarp::computeJacobian,
+  //    once per pyramid level
+  {
+    AlgorithmParameters kf_params(params);
+    kf_params.minTranslationMagToKeyFrame = 0.015; // a pixel is 0.00625 at disparity 16
+    UniquePointer<VisualOdometry> vo(MakeVo(kf_params));
+
+    const int NumMovingFrames = 20*max_shift;
+
+    Result result;
+    int num_keyframes = 0;
+    for(int i = 0; i < NumMovingFrames; ++i)
+    {
+      const int x = i % (2*max_shift) < max_shift ? i % max_shift : max_shift - i % max_shift;
+      const cv::Mat I_i(I_wide, cv::Range::all(), cv::Range(x, x + cols));
+
+      const long n0 = g_num_allocs;
+      vo->addFrame(I_i, D, result);
+      const long n = g_num_allocs - n0;
+
+      if(i < NumMovingFrames / 2)
+        continue;
+
+      const long num_levels = result.optimizerStatistics.size();
+      const long max_allocs = result.isKeyFrame ? 3 + 2*num_levels : 0;
+
+      num_keyframes += result.isKeyFrame;
+      if(!result.success || n > max_allocs) {
+        printf("moving frame %d: %ld allocations keyframe: %d success: %d\n",
+               i, n, result.isKeyFrame, result.success);
+        ++num_bad;
+      }
+    }
+
+    printf("%d keyframes\n", num_keyframes);
+    if(num_keyframes == 0)
+      ++num_bad;
+  }
+
+  printf("%d bad frames\n", num_bad);
+  return num_bad == 0 ? 0 : 1;
+#endif
+}
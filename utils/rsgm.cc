@@ -18,6 +18,8 @@ Please use the software provided in this package at your own risk. The executabl
 
 #include "utils/rsgm.h"
 #include "bpvo/utils.h"
+#include "bpvo/census.h"
+#include "bpvo/census_avx.h"
 
 #if !defined(WITH_GPL_CODE)
 struct RSGM::Impl {};
@@ -1393,79 +1395,6 @@ inline uint64* getPixel64(uint64* base, uint32 width, int j, int i)
     return base+i*width+j;
 }
 
-FORCEINLINE void testpixel(uint8* source, uint32 width, sint32 i, sint32 j,uint64& value, sint32 x, sint32 y)
-{
-    if (*getPixel8(source, width,j+x,i+y) - *getPixel8(source, width,j-x,i-y)>0) {
-        value += 1;
-    }
-}
-
-FORCEINLINE void testpixel2(uint8* source, uint32 width, sint32 i, sint32 j,uint64& value, sint32 x, sint32 y)
-{
-    value *= 2;
-    uint8 result = *getPixel8(source, width,j+x,i+y) - *getPixel8(source, width,j-x,i-y)>0;
-    value += result;
-}
-
-inline void census9x7_mode8(uint8* source, uint64* dest, uint32 width, uint32 height)
-{
-    memset(dest, 0, width*height*sizeof(uint64));
-
-    // HWCS central symmetric with 3 central rows
-    const int vert = 3;
-    const int hor = 4;
-    for (sint32 i=vert; i < (sint32)height-vert; i++) {
-        for (sint32 j=hor; j < (sint32)width-hor; j++) {
-            uint64 value = 0;
-            testpixel(source, width, i,j, value,-4,-3);
-            testpixel2(source, width, i,j, value,-3,-3);
-            testpixel2(source, width, i,j, value,-2,-3);
-            testpixel2(source, width, i,j, value,-1,-3);
-            testpixel2(source, width, i,j, value,0,-3 );
-            testpixel2(source, width, i,j, value,-4,-2);
-            testpixel2(source, width, i,j, value,-3,-2);
-            testpixel2(source, width, i,j, value,-2,-2);
-            testpixel2(source, width, i,j, value,-1,-2);
-            testpixel2(source, width, i,j, value,0,-2 );
-            testpixel2(source, width, i,j, value,-4,-1);
-            testpixel2(source, width, i,j, value,-3,-1);
-            testpixel2(source, width, i,j, value,-2,-1);
-            testpixel2(source, width, i,j, value,-1,-1);
-            testpixel2(source, width, i,j, value,0,-1 );
-            testpixel2(source, width, i,j, value,-4, 0);
-            testpixel2(source, width, i,j, value,-3, 0);
-            testpixel2(source, width, i,j, value,-2, 0);
-            testpixel2(source, width, i,j, value,-1, 0);
-            testpixel2(source, width, i,j, value,1,-3 );
-            testpixel2(source, width, i,j, value,2,-3 );
-            testpixel2(source, width, i,j, value,3,-3 );
-            testpixel2(source, width, i,j, value,4,-3 );
-            testpixel2(source, width, i,j, value,1,-2 );
-            testpixel2(source, width, i,j, value,2,-2 );
-            testpixel2(source, width, i,j, value,3,-2 );
-            testpixel2(source, width, i,j, value,4,-2 );
-            testpixel2(source, width, i,j, value,1,-1 );
-            testpixel2(source, width, i,j, value,2,-1 );
-            testpixel2(source, width, i,j, value,3,-1 );
-            testpixel2(source, width, i,j, value,4,-1 );
-            testpixel2(source, width, i,j, value,-4,-1);
-            testpixel2(source, width, i,j, value,-3,-1);
-            testpixel2(source, width, i,j, value,-2,-1);
-            testpixel2(source, width, i,j, value,-1,-1);
-            testpixel2(source, width, i,j, value,-4, 0);
-            testpixel2(source, width, i,j, value,-3, 0);
-            testpixel2(source, width, i,j, value,-2, 0);
-            testpixel2(source, width, i,j, value,-1, 0);
-            testpixel2(source, width, i,j, value,-4, 1);
-            testpixel2(source, width, i,j, value,-3, 1);
-            testpixel2(source, width, i,j, value,-2, 1);
-            testpixel2(source, width, i,j, value,-1, 1);
-            testpixel2(source, width, i,j, value,0,-1 );
-            *getPixel64(dest,width,j,i) = (uint64)value;
-        }
-    }
-}
-
 FORCEINLINE void testpixel_16bit(uint16* source, uint32 width, sint32 i, sint32 j, uint64& value, sint32 x, sint32 y)
 {
     if (*getPixel16(source, width, j + x, i + y) - *getPixel16(source, width, j - x, i - y) > 0) {
@@ -3045,7 +2974,11 @@ void census5x5_t_SSE(T* /*source*/, uint32* /*dest*/, uint32 /*width*/, uint32 /
 template <>
 void census5x5_t_SSE(uint8* source, uint32* dest, uint32 width, uint32 height)
 {
-    census5x5_SSE(source, dest, width, height);
+    // 32 or 64 pixels at a time when the CPU has AVX2 or AVX-512BW
+    if(bpvo::HasCensusAvx2())
+        bpvo::census5x5(source, height, width, dest);
+    else
+        census5x5_SSE(source, dest, width, height);
 }
 
 template <>
@@ -3063,7 +2996,7 @@ void census9x7_t(T* /*source*/, uint64* /*dest*/, uint32 /*width*/, uint32 /*hei
 template <>
 void census9x7_t(uint8* source, uint64* dest, uint32 width, uint32 height)
 {
-    census9x7_mode8(source, dest, width, height);
+    bpvo::census9x7(source, height, width, dest);
 }
 
 template <> inline
@@ -0,0 +1,209 @@
+/*
+   This file is part of bpvo.
+
+   bpvo is free software: you can redistribute it and/or modify
+   it under the terms of the Lesser GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   bpvo is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   Lesser GNU General Public License for more details.
+
+   You should have received a copy of the Lesser GNU General Public License
+   along with bpvo.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Contributor: halismai@cs.cmu.edu
+ */
+
+#include "utils/sparse_stereo.h"
+#include "bpvo/utils.h"
+
+#include <opencv2/core/core.hpp>
+
+#include <limits>
+
+namespace bpvo {
+
+namespace {
+
+static constexpr int CensusRadius = 2;
+
+/**
+ * 5x5 census of pixel x in row y, the center is skipped (24 bits)
+ */
+static inline uint32_t Census5x5(const cv::Mat& I, int y, int x)
+{
+  const uint8_t c = I.at<uint8_t>(y, x);
+  uint32_t ret = 0;
+  for(int r = -CensusRadius; r <= CensusRadius; ++r)
+  {
+    const uint8_t* p = I.ptr<uint8_t>(y + r) + x;
+    for(int k = -CensusRadius; k <= CensusRadius; ++k)
+    {
+      if(r || k)
+        ret = (ret << 1) | (p[k] > c);
+    }
+  }
+
+  return ret;
+}
+
+/**
+ * census transform of an image, computed a row at a time on demand
+ */
+class LazyCensus
+{
+ public:
+  inline void reset(const cv::Mat& I)
+  {
+    _image = I;
+    _census.resize(I.rows * I.cols);
+    _has_row.assign(I.rows, 0);
+  }
+
+  inline const uint32_t* row(int y)
+  {
+    uint32_t* dst = _census.data() + y*_image.cols;
+    if(!_has_row[y])
+    {
+      const int cols = _image.cols;
+      if(y < CensusRadius || y >= _image.rows - CensusRadius)
+      {
+        std::fill_n(dst, cols, 0u);
+      }
+      else
+      {
+        std::fill_n(dst, CensusRadius, 0u);
+        for(int x = CensusRadius; x < cols - CensusRadius; ++x)
+          dst[x] = Census5x5(_image, y, x);
+        std::fill_n(dst + cols - CensusRadius, CensusRadius, 0u);
+      }
+
+      _has_row[y] = 1;
+    }
+
+    return dst;
+  }
+
+ private:
+  cv::Mat _image;
+  std::vector<uint32_t> _census;
+  std::vector<uint8_t> _has_row;
+}; // LazyCensus
+
+}; // namespace
+
+struct SparseStereo::Impl
+{
+  LazyCensus left;
+  LazyCensus right;
+  int rows = 0;
+  int cols = 0;
+
+  std::vector<const uint32_t*> left_rows;
+  std::vector<const uint32_t*> right_rows;
+  std::vector<int> costs;
+
+  inline float match(const Config& conf, int x, int y)
+  {
+    const int w = conf.windowRadius;
+    if(x < w || x >= cols - w || y < w || y >= rows - w)
+      return -1.0f;
+
+    const int n_rows = 2*w + 1;
+    left_rows.resize(n_rows);
+    right_rows.resize(n_rows);
+    for(int r = 0; r < n_rows; ++r) {
+      left_rows[r] = left.row(y - w + r);
+      right_rows[r] = right.row(y - w + r);
+    }
+
+    const int d_min = std::max(conf.minDisparity, 0);
+    const int d_max = std::min(conf.minDisparity + conf.numberOfDisparities - 1, x - w);
+    if(d_max < d_min)
+      return -1.0f;
+
+    costs.resize(d_max - d_min + 1);
+    for(int d = d_min; d <= d_max; ++d)
+    {
+      int c = 0;
+      for(int r = 0; r < n_rows; ++r)
+      {
+        const uint32_t* cl = left_rows[r] + x;
+        const uint32_t* cr = right_rows[r] + x - d;
+        for(int k = -w; k <= w; ++k)
+          c += __builtin_popcount(cl[k] ^ cr[k]);
+      }
+      costs[d - d_min] = c;
+    }
+
+    const int n = costs.size();
+    int best = 0;
+    for(int i = 1; i < n; ++i)
+      if(costs[i] < costs[best])
+        best = i;
+
+    // uniqueness, ignoring the immediate neighbors of the best match
+    int second = std::numeric_limits<int>::max();
+    for(int i = 0; i < n; ++i)
+      if(std::abs(i - best) > 1)
+        second = std::min(second, costs[i]);
+
+    if(second != std::numeric_limits<int>::max() &&
+       costs[best] >= conf.uniquenessRatio * second)
+      return -1.0f;
+
+    float delta = 0.0f;
+    if(best > 0 && best < n - 1)
+    {
+      const int c_m = costs[best - 1], c_0 = costs[best], c_p = costs[best + 1];
+      const int denom = c_m - 2*c_0 + c_p;
+      if(denom > 0)
+        delta = 0.5f * (float) (c_m - c_p) / (float) denom;
+    }
+
+    return (float) (d_min + best) + delta;
+  }
+}; // SparseStereo::Impl
+
+SparseStereo::SparseStereo(Config conf)
+  : _config(conf), _impl(make_unique<Impl>())
+{
+  THROW_ERROR_IF( _config.numberOfDisparities <= 0, "numberOfDisparities must be > 0" );
+  THROW_ERROR_IF( _config.windowRadius < 0, "windowRadius must be >= 0" );
+}
+
+SparseStereo::~SparseStereo() {}
+
+void SparseStereo::setImages(const cv::Mat& left, const cv::Mat& right)
+{
+  THROW_ERROR_IF( left.type() != CV_8UC1 || right.type() != CV_8UC1,
+                 "images must be CV_8UC1" );
+  THROW_ERROR_IF( left.size() != right.size(), "image size mismatch" );
+
+  _impl->left.reset(left);
+  _impl->right.reset(right);
+  _impl->rows = left.rows;
+  _impl->cols = left.cols;
+}
+
+void SparseStereo::compute(const int* xy, int n, float* disparity)
+{
+  for(int i = 0; i < n; ++i)
+    disparity[i] = _impl->match(_config, xy[2*i + 0], xy[2*i + 1]);
+}
+
+SparseDisparityProvider SparseStereo::provider(const cv::Mat& left, const cv::Mat& right)
+{
+  return [=](const int* xy, int n, float* disparity)
+  {
+    this->setImages(left, right);
+    this->compute(xy, n, disparity);
+  };
+}
+
+}; // bpvo
@@ -0,0 +1,93 @@
+/*
+   This file is part of bpvo.
+
+   bpvo is free software: you can redistribute it and/or modify
+   it under the terms of the Lesser GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   bpvo is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   Lesser GNU General Public License for more details.
+
+   You should have received a copy of the Lesser GNU General Public License
+   along with bpvo.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Contributor: halismai@cs.cmu.edu
+ */
+
+#ifndef BPVO_UTILS_SPARSE_STEREO_H
+#define BPVO_UTILS_SPARSE_STEREO_H
+
+#include <bpvo/types.h>
+
+namespace cv {
+class Mat;
+}; // cv
+
+namespace bpvo {
+
+/**
+ * Computes disparities at a sparse set of pixels.
+ *
+ * Matching uses a 5x5 census transform aggregated with the hamming distance
+ * over a square window, followed by a line search along the epipolar line and
+ * parabolic subpixel refinement. The census of an image row is computed only
+ * when a pixel requires it, the cost of matching is proportional to the number
+ * of requested pixels.
+ */
+class SparseStereo
+{
+ public:
+  struct Config
+  {
+    int minDisparity;         //< smallest disparity to search
+    int numberOfDisparities;  //< size of the search range
+    int windowRadius;         //< radius of the aggregation window
+    float uniquenessRatio;    //< best cost must be < ratio * second best cost
+
+    Config()
+        : minDisparity(0),
+        numberOfDisparities(128),
+        windowRadius(2),
+        uniquenessRatio(0.95f) {}
+  }; // Config
+
+ public:
+  SparseStereo(Config = Config());
+  ~SparseStereo();
+
+  /**
+   * Sets the rectified stereo pair, both must be single channel uint8 images
+   * of the same size
+   */
+  void setImages(const cv::Mat& left, const cv::Mat& right);
+
+  /**
+   * Computes the disparity at the given pixels of the left image
+   *
+   * \param xy pixel coordinates [x0, y0, x1, y1, ...]
+   * \param n  number of pixels
+   * \param disparity output, -1 at pixels without a reliable match
+   */
+  void compute(const int* xy, int n, float* disparity);
+
+  /**
+   * \return a provider for VisualOdometry::addFrame that matches the given
+   * stereo pair on demand. The object must outlive the returned provider
+   */
+  SparseDisparityProvider provider(const cv::Mat& left, const cv::Mat& right);
+
+ private:
+  Config _config;
+
+  struct Impl;
+  UniquePointer<Impl> _impl;
+}; // SparseStereo
+
+}; // bpvo
+
+#endif // BPVO_UTILS_SPARSE_STEREO_H